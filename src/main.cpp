@@ -129,17 +129,109 @@ int main( int argc, char** argv ) {
     // --posOnly: only output "first-order" particle quantities to the resultant cutout, 
     //            including x, y, z, a, and id. vx, vy, vz, replication, and rotation 
     //            will be ommitted. Should speed up redistribution step.
+    // --healpix <nside>: while each step is in memory, also bin every particle into a 
+    //                    full-sky nested HEALPix count map at the given nside (at most
+    //                    8192), written to the output directory as 
+    //                    countMap_nside{nside}.{step}.bin
+    // --derived <col1,col2,...>: compute and write extra columns per cutout member from
+    //                            the data already in hand; any of v_los (line-of-sight 
+    //                            velocity), d (comoving distance), x_rot, y_rot, z_rot 
+    //                            (halo-centric rotated position), x_tan, y_tan (gnomonic 
+    //                            projection about the halo). With --posOnly, v_los is 
+    //                            still available, without exchanging or writing velocities
+    // --columns <col1,col2,...>: write only these columns. Any of id, x, y, z, redshift,
+    //                           theta, phi, any column present in the input lightcone 
+    //                           (vx, rotation, or galaxy properties, etc.), or any derived
+    //                           column (for -h or -f only). Only what is needed for these 
+    //                           is read, redistributed, and written. Overrides --posOnly
+    // --dedup: cut out halos with overlapping fields of view together, writing each 
+    //          particle once to a shared group_{n} directory, along with a bitmask of 
+    //          the halos containing it, rather than once per halo. Halo-frame columns 
+    //          (theta, phi, and rotated derived columns) are not written for those halos
+    // --idFile <file>: only cut out particles whose ids are listed in this file (text, 
+    //                  or raw int64 if the name ends in .bin). Other particles are 
+    //                  dropped right after reading, before redistribution
+    // --plan <fraction>: dry run. Read only the headers and the given fraction of each step,
+    //                   and print estimates of the cutout sizes, the read, exchange, and 
+    //                   write volumes and times, and a recommended node count, without 
+    //                   performing the cutout. Per-halo estimates are written to plan.csv
+    // --shard <K>: don't perform the cutout; instead, split the -f halo catalog into K halo
+    //              files of balanced estimated cost (from a --plan sample, 0.02 by default),
+    //              grouping halos that are near each other on the sky
+    // --mmap: for halo cutouts, read uncompressed POSIX GenericIO input directly from 
+    //         memory-mapped pages, copying out only particles within the cutout footprints
+    // --stream: for halo cutouts, read the input one GenericIO block at a time, keeping 
+    //           only particles within the cutout footprints, to bound memory use per rank
+    // --readersPerNode <n>: for halo cutouts, only open and read the input on the first n 
+    //                      ranks of each node, which forward it to the others in the 
+    //                      balancing exchange
+    // --readers <n>: as --readersPerNode, but n reader ranks in total, evenly spaced
+    // --buildStore <nside>: don't perform a cutout; instead, convert the lightcone steps 
+    //                      into a store in out_dir, tiled by HEALPix pixels at this nside
+    //                      (at most 8192), from which later halo cutouts can be served 
+    //                      (-h, -f, -t, and -p are not accepted). --columns selects extra
+    //                      columns to store
+    // --fromStore <dir>: for halo cutouts, read only the tiles of the store in dir (as 
+    //                   written by --buildStore) which intersect the cutout footprints,
+    //                   rather than every step of the lightcone
+    // --fromCutout <dir>: for halo cutouts, cut from the output of an earlier run with 
+    //                    -t and -p in dir, rather than from the lightcone. Every halo's
+    //                    footprint must lie within that cutout's bounds
+    // --stepCache <dir>: for halo cutouts, keep each rank's sorted particles for each 
+    //                   step in dir (node-local storage, such as /dev/shm), and reuse 
+    //                   them in later runs over the same steps with the same number of 
+    //                   ranks and columns, rather than reading and sorting again
+    // --preview <k>: for halo cutouts, read only every k-th GenericIO block of each step,
+    //               for a quick, approximate cutout. The fraction of each step read is
+    //               recorded in out_dir/preview.csv
+    // --watch <poll> <idle>: for halo cutouts, cut out each step as soon as the simulation
+    //                       has finished writing it, checking the lightcone directory 
+    //                       for new steps at least every poll seconds, until the last 
+    //                       step in range is done or none appears for idle seconds. 
+    //                       Finished steps are recorded in out_dir/watch_progress.csv,
+    //                       and skipped if the run is restarted
+    // --sphere <radius>: for halo cutouts, cut out all particles within this comoving 
+    //                   distance (in Mpc/h) of each halo, rather than an angular field.
+    //                   -b may then be omitted; if given, it only sets the angular 
+    //                   extent reported in the halo properties
+    // --box <side>: as --sphere, but for a cube of this comoving side length (in Mpc/h),
+    //              aligned with the simulation axes and centered on each halo
+    // --markEmpty: for halo cutouts, record the halos skipped in each step for lying 
+    //              outside of the sky it covers in out_dir/empty_halos.csv, as no
+    //              output is written for them
+    // --manifest <file>: cache the list of steps and their header files in this file, 
+    //                   and reuse it in later runs over the same lightcone, rather than
+    //                   scanning every step directory again
+    // --propsCatalog: write the properties and cutout geometry of all halos to one 
+    //                 columnar catalog, out_dir/halo_properties/, rather than writing
+    //                 a properties.csv per halo
+    // --propsCSV: with --propsCatalog, still write the per-halo properties.csv files
+    // --minMass <mass>: skip halos in the -f catalog with mass below this
+    // --haloCols <field=col,...>: if the -f catalog is a GenericIO file, override the 
+    //                             column names read for any of the fields tag, a, mass, 
+    //                             radius, cdelta, cdelta_err, x, y, z (see readHaloCatalog()
+    //                             in processLC.cpp for the defaults)
     // 
-    // All four of these additional options default to false
+    // All of these additional options default to false (off)
 
-    // start MPI 
-    MPI_Init(&argc, &argv);
+    // start MPI. The heavy loops of each rank (packing, sorting, HEALPix maps, and 
+    // building indices) run on OpenMP threads, while all MPI calls (including those of
+    // GenericIO) are made from the main thread, so funneled support is all that's needed
+    // to run fewer ranks with more threads each (e.g. one rank per NUMA domain)
+    int threadSupport;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &threadSupport);
     int myrank, numranks;
     MPI_Comm_size(MPI_COMM_WORLD, &numranks);
     MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
 
-    if(myrank == 0){ cout << "\n\n---------- Starting on " << numranks << 
-                           " MPI ranks ----------" << endl; }
+    if(myrank == 0){ 
+        cout << "\n\n---------- Starting on " << numranks << " MPI ranks, with " << 
+                omp_get_max_threads() << " threads each ----------" << endl; 
+        if(threadSupport < MPI_THREAD_FUNNELED){
+            cout << "Warning: the MPI library doesn't support funneled threads; run " <<
+                    "with OMP_NUM_THREADS=1 if threaded regions misbehave" << endl;
+        }
+    }
     char cart[3] = {'x', 'y', 'z'};
 
     string input_lc_dir, out_dir;
@@ -192,23 +284,13 @@ int main( int argc, char** argv ) {
         minStep = zToStep(maxZ);
     }
     
-    vector<string> step_strings;
-    getLCSteps(maxStep, minStep, input_lc_dir, step_strings);
-    if(myrank == 0){ 
-        cout << "MAX STEP: " << maxStep << endl;
-        cout << "MIN STEP: " << minStep << endl;
-        cout << "steps to include from z= " << minZ << " to z=" << maxZ << ": " << endl;
-        for(int i=0; i<step_strings.size(); ++i){ cout << step_strings[i] << " ";}
-        cout << endl;
-    }
-
     // might not use all of these but whatever
     vector<float> theta_cut(2);
     vector<float> phi_cut(2);
     vector<float> haloPos;
     vector<float> haloProps;
     vector<string> haloTags;
-    float boxLength;
+    float boxLength = 0;
     bool verbose = false;
     bool timeit = false;
     bool overwrite = false;
@@ -216,6 +298,12 @@ int main( int argc, char** argv ) {
     bool forceWriteProps = false;
     bool propsOnly = false;
     string massDef="sod";
+    string haloFileName;
+    float minMass = 0;
+    vector<string> haloColumnMap;
+    string manifestFile;
+    Cutout_options opts;
+    opts.outDir = out_dir;
 
     // check that supplied arguments are valid
     vector<string> args(argv+1, argv + argc);
@@ -231,18 +319,110 @@ int main( int argc, char** argv ) {
             (find(args.begin(), args.end(), "--boxLength") != args.end()));
     bool customMassDef = int((find(args.begin(), args.end(), "-m") != args.end()) ||
             (find(args.begin(), args.end(), "--massDef") != args.end()));
+    bool buildStore = (find(args.begin(), args.end(), "--buildStore") != args.end());
+    bool volumeCut = (find(args.begin(), args.end(), "--sphere") != args.end()) || 
+                     (find(args.begin(), args.end(), "--box") != args.end());
 
     // there are two general use cases of this cutout code, as described in the 
     // docstring below the declaration of this main function. Here, the program aborts
     // to prevent confused input arguments which mix those two use cases.
-    if( (customHalo || customHaloFile) ^ customBox ){ 
-        cout << "\n-h (or -f) and -b options must accompany eachother" << endl;
+    if( (customHalo || customHaloFile) ^ (customBox || volumeCut) ){ 
+        cout << "\n-h (or -f) and -b (or --sphere or --box) options must accompany eachother" << endl;
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( volumeCut && 
+        (((find(args.begin(), args.end(), "--sphere") != args.end()) && 
+          (find(args.begin(), args.end(), "--box") != args.end())) || 
+         (find(args.begin(), args.end(), "--dedup") != args.end()) || 
+         (find(args.begin(), args.end(), "--plan") != args.end()) || 
+         (find(args.begin(), args.end(), "--shard") != args.end())) ){
+        cout << "\n--sphere and --box can't be used together, or along with --dedup, " << 
+                "--plan, or --shard";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( ((find(args.begin(), args.end(), "--minMass") != args.end()) || 
+         (find(args.begin(), args.end(), "--haloCols") != args.end())) && !customHaloFile ){
+        cout << "\n--minMass and --haloCols do nothing if not used along with -f";
         MPI_Abort(MPI_COMM_WORLD, 0);
     }
     if( customMassDef && !customHaloFile){
         cout << "\n-m does nothing if not used along with -f";
         MPI_Abort(MPI_COMM_WORLD, 0);
     }
+    if( buildStore && (customHalo || customHaloFile || customThetaBounds || customPhiBounds) ){
+        cout << "\n--buildStore can't be used along with -h, -f, -t, or -p";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( (find(args.begin(), args.end(), "--fromStore") != args.end()) && 
+        (!(customHalo || customHaloFile) || 
+         (find(args.begin(), args.end(), "--mmap") != args.end()) || 
+         (find(args.begin(), args.end(), "--stream") != args.end()) || 
+         (find(args.begin(), args.end(), "--healpix") != args.end())) ){
+        cout << "\n--fromStore can only be used along with -h or -f, and not with --mmap, " << 
+                "--stream, or --healpix";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( (find(args.begin(), args.end(), "--fromCutout") != args.end()) && 
+        (!(customHalo || customHaloFile) || 
+         (find(args.begin(), args.end(), "--fromStore") != args.end()) || 
+         (find(args.begin(), args.end(), "--mmap") != args.end()) || 
+         (find(args.begin(), args.end(), "--stream") != args.end()) || 
+         (find(args.begin(), args.end(), "--healpix") != args.end())) ){
+        cout << "\n--fromCutout can only be used along with -h or -f, and not with --fromStore, " << 
+                "--mmap, --stream, or --healpix";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( (find(args.begin(), args.end(), "--stepCache") != args.end()) && 
+        (!(customHalo || customHaloFile) || 
+         (find(args.begin(), args.end(), "--fromStore") != args.end()) || 
+         (find(args.begin(), args.end(), "--fromCutout") != args.end()) || 
+         (find(args.begin(), args.end(), "--healpix") != args.end())) ){
+        cout << "\n--stepCache can only be used along with -h or -f, and not with --fromStore, " << 
+                "--fromCutout, or --healpix";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( (find(args.begin(), args.end(), "--preview") != args.end()) && 
+        (!(customHalo || customHaloFile) || 
+         (find(args.begin(), args.end(), "--fromStore") != args.end()) || 
+         (find(args.begin(), args.end(), "--fromCutout") != args.end()) || 
+         (find(args.begin(), args.end(), "--stepCache") != args.end())) ){
+        cout << "\n--preview can only be used along with -h or -f, and not with --fromStore, " << 
+                "--fromCutout, or --stepCache";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( (find(args.begin(), args.end(), "--watch") != args.end()) && 
+        (!(customHalo || customHaloFile) || 
+         (find(args.begin(), args.end(), "--fromStore") != args.end()) || 
+         (find(args.begin(), args.end(), "--fromCutout") != args.end()) || 
+         (find(args.begin(), args.end(), "--plan") != args.end()) || 
+         (find(args.begin(), args.end(), "--shard") != args.end())) ){
+        cout << "\n--watch can only be used along with -h or -f, and not with --fromStore, " << 
+                "--fromCutout, --plan, or --shard";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( (find(args.begin(), args.end(), "--markEmpty") != args.end()) && 
+        !(customHalo || customHaloFile) ){
+        cout << "\n--markEmpty can only be used along with -h or -f";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( ((find(args.begin(), args.end(), "--readersPerNode") != args.end()) || 
+         (find(args.begin(), args.end(), "--readers") != args.end())) && 
+        !(customHalo || customHaloFile) ){
+        cout << "\n--readersPerNode and --readers can only be used along with -h or -f";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( ((find(args.begin(), args.end(), "--derived") != args.end()) || 
+         (find(args.begin(), args.end(), "--propsCatalog") != args.end()) || 
+         (find(args.begin(), args.end(), "--plan") != args.end())) && 
+        !(customHalo || customHaloFile) ){
+        cout << "\n--derived, --propsCatalog, and --plan can only be used along with -h or -f";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    if( ((find(args.begin(), args.end(), "--dedup") != args.end()) || 
+         (find(args.begin(), args.end(), "--shard") != args.end())) && !customHaloFile ){
+        cout << "\n--dedup and --shard can only be used along with -f";
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
     if( customThetaBounds ^ customPhiBounds ){
         cout << "\n-t and -p options must accompany eachother";
         MPI_Abort(MPI_COMM_WORLD, 0);
@@ -252,7 +432,8 @@ int main( int argc, char** argv ) {
                 "that -h (or -f) and -b arguments are passed";
         MPI_Abort(MPI_COMM_WORLD, 0);
     }
-    if( !customThetaBounds && !customPhiBounds && !customHalo && !customHaloFile && !customBox ){
+    if( !customThetaBounds && !customPhiBounds && !customHalo && !customHaloFile && !customBox && 
+        !buildStore ){
         cout << "\nValid options are -h, -f, -b, -t, -p, -v, -m, and --timeit. See github readme for help";
         MPI_Abort(MPI_COMM_WORLD, 0);
     }
@@ -287,14 +468,20 @@ int main( int argc, char** argv ) {
             haloProps.push_back(-1.0); 
             haloProps.push_back(-1.0); 
             haloProps.push_back(-1.0); 
-            if(massDef == "sod")
+            if(massDef == "sod"){
                 haloProps.push_back(-1.0); 
                 haloProps.push_back(-1.0); 
                 haloProps.push_back(-1.0); 
+            }
         }
         else if(strcmp(argv[i],"-f")==0 || strcmp(argv[i],"--haloFile")==0){
-            string haloFileName(argv[++i]);
-            readHaloFile(haloFileName, haloPos, haloTags, haloProps, massDef);
+            haloFileName = argv[++i];
+        }
+        else if (strcmp(argv[i],"--minMass") == 0){
+            minMass = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i],"--haloCols") == 0){
+            splitCommaList(argv[++i], haloColumnMap);
         }
         else if (strcmp(argv[i],"-v")==0 || strcmp(argv[i],"--verbose")==0){
             verbose = true;
@@ -314,6 +501,169 @@ int main( int argc, char** argv ) {
         else if (strcmp(argv[i],"--propsOnly") == 0){
             propsOnly = true;
         }
+        else if (strcmp(argv[i],"--derived") == 0){
+            vector<string> derivedNames;
+            splitCommaList(argv[++i], derivedNames);
+            for(int c = 0; c < derivedNames.size(); ++c){
+                int col = derivedColumnIndex(derivedNames[c]);
+                if(col < 0){
+                    cout << "\nUnknown derived column " << derivedNames[c] << ". Valid options " <<
+                            "are v_los, d, x_rot, y_rot, z_rot, x_tan, and y_tan" << endl;
+                    MPI_Abort(MPI_COMM_WORLD, 0);
+                }
+                opts.derivedCols.push_back(col);
+            }
+        }
+        else if (strcmp(argv[i],"--columns") == 0){
+            // derived columns may be listed here too
+            vector<string> colNames;
+            splitCommaList(argv[++i], colNames);
+            for(int c = 0; c < colNames.size(); ++c){
+                int col = derivedColumnIndex(colNames[c]);
+                if(col >= 0){ opts.derivedCols.push_back(col); }
+                else{ opts.columns.push_back(colNames[c]); }
+            }
+        }
+        else if (strcmp(argv[i],"--idFile") == 0){
+            opts.useIdFilter = true;
+            readIdFile(argv[++i], opts.idFilter, myrank);
+        }
+        else if (strcmp(argv[i],"--plan") == 0){
+            opts.planFraction = strtof(argv[++i], NULL);
+            if(opts.planFraction <= 0 or opts.planFraction > 1){
+                cout << "\n--plan fraction must be in (0, 1]" << endl;
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+        }
+        else if (strcmp(argv[i],"--shard") == 0){
+            opts.numShards = atoi(argv[++i]);
+            if(opts.numShards < 1){
+                cout << "\n--shard requires a positive number of shards" << endl;
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+        }
+        else if (strcmp(argv[i],"--mmap") == 0){
+            opts.mmapInput = true;
+        }
+        else if (strcmp(argv[i],"--stream") == 0){
+            opts.streamInput = true;
+        }
+        else if (strcmp(argv[i],"--readersPerNode") == 0){
+            opts.readersPerNode = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i],"--readers") == 0){
+            opts.totalReaders = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i],"--buildStore") == 0){
+            opts.storeNside = atoi(argv[++i]);
+            if(!valid_nside(opts.storeNside) or opts.storeNside > MAX_STORE_NSIDE){
+                cout << "\n--buildStore nside must be a power of 2, at most " << MAX_STORE_NSIDE << endl;
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+        }
+        else if (strcmp(argv[i],"--fromStore") == 0){
+            opts.storeDir = string(argv[++i]);
+            if(opts.storeDir[opts.storeDir.size()-1] != '/'){ opts.storeDir += "/"; }
+        }
+        else if (strcmp(argv[i],"--fromCutout") == 0){
+            opts.cutoutDir = string(argv[++i]);
+            if(opts.cutoutDir[opts.cutoutDir.size()-1] != '/'){ opts.cutoutDir += "/"; }
+        }
+        else if (strcmp(argv[i],"--stepCache") == 0){
+            opts.cacheDir = string(argv[++i]);
+            if(opts.cacheDir[opts.cacheDir.size()-1] != '/'){ opts.cacheDir += "/"; }
+        }
+        else if (strcmp(argv[i],"--preview") == 0){
+            opts.previewStride = atoi(argv[++i]);
+            if(opts.previewStride < 1){
+                cout << "\n--preview requires a positive block stride" << endl;
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+        }
+        else if (strcmp(argv[i],"--watch") == 0){
+            opts.watchPoll = atoi(argv[++i]);
+            opts.watchIdle = atoi(argv[++i]);
+            if(opts.watchPoll < 1 or opts.watchIdle < 1){
+                cout << "\n--watch requires positive poll and idle times" << endl;
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+        }
+        else if (strcmp(argv[i],"--sphere") == 0 || strcmp(argv[i],"--box") == 0){
+            opts.volumeBox = (strcmp(argv[i],"--box") == 0);
+            opts.volumeRadius = strtof(argv[++i], NULL);
+            if(opts.volumeBox){ opts.volumeRadius /= 2; }
+            if(!(opts.volumeRadius > 0)){
+                cout << "\n--sphere and --box require a positive size" << endl;
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+        }
+        else if (strcmp(argv[i],"--markEmpty") == 0){
+            opts.markEmpty = true;
+        }
+        else if (strcmp(argv[i],"--manifest") == 0){
+            manifestFile = string(argv[++i]);
+        }
+        else if (strcmp(argv[i],"--propsCatalog") == 0){
+            opts.propsCatalog = true;
+        }
+        else if (strcmp(argv[i],"--propsCSV") == 0){
+            opts.propsCSV = true;
+        }
+        else if (strcmp(argv[i],"--dedup") == 0){
+            opts.dedupOverlaps = true;
+        }
+        else if (strcmp(argv[i],"--healpix") == 0){
+            opts.healpixNside = atoi(argv[++i]);
+            if(!valid_nside(opts.healpixNside) or opts.healpixNside > MAX_MAP_NSIDE){
+                cout << "\n--healpix nside must be a power of 2, at most " << MAX_MAP_NSIDE << endl;
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+        }
+    }
+    
+    // derived columns are computed in the halo frame, so can't be listed in --columns
+    // for cutouts with theta-phi bounds
+    if(customThetaBounds and opts.derivedCols.size() > 0){
+        cout << "\nDerived columns can only be written along with -h or -f" << endl;
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    // find the steps to include, along with their header files, once for all ranks
+    // (see buildStepManifest() in processLC.cpp). If watching, start with the steps 
+    // which are completely written, as more are found once these are cut out
+    opts.minStep = minStep;
+    opts.maxStep = maxStep;
+    opts.manifestFile = manifestFile;
+    if(opts.watchPoll > 0){
+        if(!waitForSteps(input_lc_dir, opts, opts.manifest, myrank)){
+            if(myrank == 0){ cout << "\nNo steps left to cut out" << endl; }
+            MPI_Finalize();
+            return 0;
+        }
+    }else{
+        buildStepManifest(input_lc_dir, maxStep, minStep, manifestFile, opts.manifest, myrank);
+    }
+    vector<string> step_strings = opts.manifest.steps;
+    if(myrank == 0){ 
+        cout << "MAX STEP: " << maxStep << endl;
+        cout << "MIN STEP: " << minStep << endl;
+        cout << "steps to include from z= " << minZ << " to z=" << maxZ << ": " << endl;
+        for(int i=0; i<step_strings.size(); ++i){ cout << step_strings[i] << " ";}
+        cout << endl;
+    }
+
+    // sharding is based on the dry-run estimates, at a small sample by default
+    if(opts.numShards > 0 and opts.planFraction == 0){ opts.planFraction = 0.02; }
+
+    // read the halo catalog, once all options affecting how to read it are known. 
+    // GenericIO catalogs are recognized by their header
+    if(customHaloFile){
+        if(isGenericIOFile(haloFileName)){
+            readHaloCatalog(haloFileName, haloPos, haloTags, haloProps, massDef, minMass, 
+                            haloColumnMap, myrank, numranks);
+        }else{
+            readHaloFile(haloFileName, haloPos, haloTags, haloProps, massDef, minMass);
+        }
     }
 
     // if customHaloFile == true, then create an output subdirectory per halo in out_dir
@@ -360,7 +710,16 @@ int main( int argc, char** argv ) {
                     for(int i=0;i<3;++i){ cout << cart[i] << "=" << haloPos[k+i] << " ";}
                 }
             }
-            cout << endl << "box length: " << boxLength << " arcmin" << endl;
+            if(opts.volumeRadius > 0 and opts.volumeBox){
+                cout << endl << "comoving box side: " << 2*opts.volumeRadius << " Mpc/h" << endl;
+            }else if(opts.volumeRadius > 0){
+                cout << endl << "comoving sphere radius: " << opts.volumeRadius << " Mpc/h" << endl;
+            }else{
+                cout << endl << "box length: " << boxLength << " arcmin" << endl;
+            }
+        
+        }else if(buildStore){
+            cout << "lightcone will be stored in tiles at nside " << opts.storeNside << endl;
         
         }else{
             cout << "theta bounds: ";
@@ -374,6 +733,43 @@ int main( int argc, char** argv ) {
         cout << "timeit is set to " << timeit << endl;
         cout << "overwrite is set to " << overwrite << endl;
         cout << "posOnly is set to " << positionOnly << endl;
+        if(opts.columns.size() > 0){
+            cout << "columns: ";
+            for(int c = 0; c < opts.columns.size(); ++c){ cout << opts.columns[c] << " "; }
+            cout << endl;
+        }
+        if(opts.useIdFilter){ 
+            cout << "restricting to " << opts.idFilter.ids.size() << " particle ids" << endl; 
+        }
+        if(opts.planFraction > 0){ 
+            cout << "planning only, from a sample of " << opts.planFraction << " of each step" << endl; 
+        }
+        if(opts.numShards > 0){ cout << "sharding halos into " << opts.numShards << " jobs" << endl; }
+        if(opts.mmapInput){ cout << "reading input from memory-mapped files" << endl; }
+        if(!opts.storeDir.empty()){ cout << "reading input from the store in " << opts.storeDir << endl; }
+        if(!opts.cutoutDir.empty()){ cout << "cutting from the cutout in " << opts.cutoutDir << endl; }
+        if(!opts.cacheDir.empty()){ cout << "caching sorted steps in " << opts.cacheDir << endl; }
+        if(opts.previewStride > 1){ 
+            cout << "PREVIEW: reading every " << opts.previewStride << "th block of each step" << endl; 
+        }
+        if(opts.watchPoll > 0){ 
+            cout << "watching for new steps every " << opts.watchPoll << " s" << endl; 
+        }
+        if(opts.streamInput){ cout << "streaming input one block at a time" << endl; }
+        if(opts.readersPerNode > 0){ cout << "reading on " << opts.readersPerNode << " ranks per node" << endl; }
+        else if(opts.totalReaders > 0){ cout << "reading on " << opts.totalReaders << " ranks" << endl; }
+        if(opts.propsCatalog){ cout << "writing halo properties catalog" << endl; }
+        if(opts.dedupOverlaps){ cout << "deduplicating overlapping cutouts" << endl; }
+        if(opts.healpixNside > 0){ 
+            cout << "writing HEALPix count maps at nside " << opts.healpixNside << endl; 
+        }
+        if(opts.derivedCols.size() > 0){
+            cout << "derived columns: ";
+            for(int c = 0; c < opts.derivedCols.size(); ++c){ 
+                cout << derivedColumnName(opts.derivedCols[c]) << " "; 
+            }
+            cout << endl;
+        }
     }
 
     // call overloaded processing function
@@ -383,13 +779,15 @@ int main( int argc, char** argv ) {
     MPI_Barrier(MPI_COMM_WORLD);
     start = MPI_Wtime();
 
-    if(customHalo || customHaloFile){
-        processLC(input_lc_dir, halo_out_dirs, step_strings, haloPos, haloProps, 
+    if(buildStore){
+        buildLCStore(step_strings, myrank, numranks, verbose, timeit, overwrite, positionOnly, opts);
+    }else if(customHalo || customHaloFile){
+        processLC(input_lc_dir, halo_out_dirs, step_strings, haloPos, haloProps, haloTags,
                   boxLength, myrank, numranks, verbose, timeit, overwrite, positionOnly, 
-                  forceWriteProps, propsOnly);
+                  forceWriteProps, propsOnly, opts);
     }else{
         processLC(input_lc_dir, out_dir, step_strings, theta_cut, phi_cut, 
-                  myrank, numranks, verbose, timeit, overwrite, positionOnly);
+                  myrank, numranks, verbose, timeit, overwrite, positionOnly, opts);
     }
 
     MPI_Barrier(MPI_COMM_WORLD);
@@ -4,6 +4,2555 @@ using namespace std;
 using namespace gio;
 
 
+//////////////////////////////////////////////////////
+//
+//                 cutout helpers
+//
+//////////////////////////////////////////////////////
+
+static void toSpherical(POSVEL_T x, POSVEL_T y, POSVEL_T z, POSVEL_T &d, float &theta, 
+                        float &phi){
+    // The spherical coordinate transform applied to every particle read, with theta
+    // and phi in arcsec. phi is folded into [-90, 90] deg by atan, as expected by the 
+    // cutout bounds
+    
+    d = (float)sqrt(x*x + y*y + z*z);
+    theta = acos(z/d) * 180.0 / PI * ARCSEC;
+    
+    // prevent NaNs on y-z plane
+    if(x == 0 && y > 0)
+        phi = 90.0 * ARCSEC;
+    else if(x == 0 && y < 0)
+        phi = -90.0 * ARCSEC;
+    else
+        phi = atan(y/x) * 180.0 / PI * ARCSEC;
+}
+
+
+//======================================================================================
+
+
+static bool inHaloCutout(const particle_pos &p, const float *R, 
+                         const float *theta_cut, const float *phi_cut,
+                         float *v_rot, float &v_theta, float &v_phi){
+    // Rotates a particle into the frame of a target halo, and checks whether it lies 
+    // within the halo's (constant, equatorial) angular bounds. 
+    //
+    // Params:
+    // :param p: the particle
+    // :param R: the 3x3 (row major) rotation matrix which brings the halo to (r, 90, 0) 
+    //           in spherical coords
+    // :param theta_cut: the [min, max] theta bounds in the rotated frame, in arcsec
+    // :param phi_cut: the [min, max] phi bounds in the rotated frame, in arcsec
+    // :param v_rot: array to fill with the rotated cartesian position of the particle
+    // :param v_theta: to be set to the rotated theta of the particle, in arcsec
+    // :param v_phi: to be set to the rotated phi of the particle, in arcsec
+    // :return: true if the particle is within the cutout
+
+    for(int i = 0; i < 3; ++i){
+        v_rot[i] = R[3*i]*p.x + R[3*i+1]*p.y + R[3*i+2]*p.z;
+    }
+
+    // spherical coordinate transformation
+    float d = (float)sqrt(v_rot[0]*v_rot[0] + v_rot[1]*v_rot[1] + v_rot[2]*v_rot[2]);
+    v_theta = acos(v_rot[2]/d) * 180.0 / PI * ARCSEC;
+
+    // prevent NaNs on y-z plane
+    if(v_rot[0] == 0 && v_rot[1] > 0)
+        v_phi = 90.0 * ARCSEC;
+    else if(v_rot[0] == 0 && v_rot[1] < 0)
+        v_phi = -90.0 * ARCSEC;
+    else
+        v_phi = atan(v_rot[1]/v_rot[0]) * 180.0 / PI * ARCSEC; 
+
+    return v_theta > theta_cut[0] && v_theta < theta_cut[1] && 
+           v_phi > phi_cut[0] && v_phi < phi_cut[1];
+}
+
+
+//======================================================================================
+
+
+static bool inHaloVolume(const particle_pos &p, const float *halo_pos, float radius, bool box){
+    // Checks whether a particle lies within the comoving volume around a target halo:
+    // within radius of the halo if box is false, or within radius of it along each of 
+    // the x, y, and z axes if box is true
+
+    float dx = p.x - halo_pos[0];
+    float dy = p.y - halo_pos[1];
+    float dz = p.z - halo_pos[2];
+    if(box){ return fabs(dx) <= radius and fabs(dy) <= radius and fabs(dz) <= radius; }
+    return dx*dx + dy*dy + dz*dz <= radius*radius;
+}
+
+
+//======================================================================================
+
+
+template<int SHAPE, bool ROTATE>
+static void selectHaloParticles(const vector<particle_pos> &particles, const int *candidates,
+                                int first, int numCandidates, const float *theta_rough, 
+                                const float *phi_rough, const float *R, 
+                                const float *theta_cut, const float *phi_cut,
+                                const float *halo_pos, float radius, Halo_selection &sel){
+    // The cutout kernel: finds the particles in one halo's cutout, of a footprint given
+    // by SHAPE (a Cutout_shape), among candidates within its rough bounds. If ROTATE, 
+    // the rotated position of each particle found is also kept, for output. Both are 
+    // fixed at compile time, so that each instantiation's loop holds only the tests and
+    // stores it needs (see chooseSelectKernel())
+    //
+    // Params:
+    // :param particles: the particles
+    // :param candidates: the positions of the candidates, for volume shapes
+    // :param first: the position of the first candidate, for SHAPE_FIELD, whose 
+    //               candidates are a contiguous range (of theta-sorted particles, within
+    //               the rough theta bounds, or of all particles, if they weren't sorted)
+    // :param numCandidates: the number of candidates
+    // :param theta_rough: the halo's rough [min, max] theta bounds, in arcsec
+    // :param phi_rough: the halo's rough [min, max] phi bounds, in arcsec
+    // :param R: the halo's rotation matrix
+    // :param theta_cut: the theta bounds in the rotated frame, in arcsec
+    // :param phi_cut: the phi bounds in the rotated frame, in arcsec
+    // :param halo_pos: the halo position
+    // :param radius: the sphere radius, or half the cube side, for volume shapes
+    // :param sel: the selection to fill
+    // :return: none
+
+    sel.n.clear();
+    sel.v_rot.clear();
+    sel.v_theta.clear();
+    sel.v_phi.clear();
+    
+    for(int j = 0; j < numCandidates; ++j){
+        int n = (SHAPE == SHAPE_FIELD) ? first + j : candidates[j];
+        const particle_pos &p = particles[n];
+        
+        float v_rot[3];
+        float v_theta;
+        float v_phi;
+        if(SHAPE == SHAPE_FIELD){
+            if(p.phi <= phi_rough[0] or p.phi >= phi_rough[1] or 
+               p.theta < theta_rough[0] or p.theta > theta_rough[1]){ continue; }
+            if(!inHaloCutout(p, R, theta_cut, phi_cut, v_rot, v_theta, v_phi)){ continue; }
+        }else{
+            if(!inHaloVolume(p, halo_pos, radius, SHAPE == SHAPE_BOX)){ continue; }
+            if(ROTATE){ inHaloCutout(p, R, theta_cut, phi_cut, v_rot, v_theta, v_phi); }
+        }
+        
+        sel.n.push_back(n);
+        if(ROTATE){
+            sel.v_rot.insert(sel.v_rot.end(), v_rot, v_rot + 3);
+            sel.v_theta.push_back(v_theta);
+            sel.v_phi.push_back(v_phi);
+        }
+    }
+}
+
+
+typedef void (*Select_kernel)(const vector<particle_pos>&, const int*, int, int, const float*,
+                              const float*, const float*, const float*, const float*, 
+                              const float*, float, Halo_selection&);
+
+
+static Select_kernel chooseSelectKernel(int shape, bool rotate){
+    // Picks the instantiation of selectHaloParticles() for a run's cutout shape, and 
+    // whether any output column needs the rotated particle positions
+
+    static const Select_kernel kernels[NUM_SHAPES][2] = {
+        {selectHaloParticles<SHAPE_FIELD, false>, selectHaloParticles<SHAPE_FIELD, true>},
+        {selectHaloParticles<SHAPE_SPHERE, false>, selectHaloParticles<SHAPE_SPHERE, true>},
+        {selectHaloParticles<SHAPE_BOX, false>, selectHaloParticles<SHAPE_BOX, true>}
+    };
+    return kernels[shape][rotate ? 1 : 0];
+}
+
+
+// fewest candidates per thread for which a halo's selection is split over threads
+#define SELECT_THREAD_MIN 65536
+
+
+static void selectParallel(Select_kernel kernel, const vector<particle_pos> &particles, 
+                           const int *candidates, int first, int numCandidates, 
+                           const float *theta_rough, const float *phi_rough, const float *R, 
+                           const float *theta_cut, const float *phi_cut,
+                           const float *halo_pos, float radius, Halo_selection &sel){
+    // Runs a cutout kernel (see chooseSelectKernel()) over one halo's candidates, split 
+    // into contiguous chunks over the OpenMP threads, if there are enough of them (as 
+    // when the particles weren't sorted, and every halo scans all of them). The 
+    // chunks' selections are joined in order, so that the result is the same as that 
+    // of a single call. Params as for selectHaloParticles()
+
+    int numChunks = min(omp_get_max_threads(), max(1, numCandidates / SELECT_THREAD_MIN));
+    if(numChunks == 1){
+        kernel(particles, candidates, first, numCandidates, theta_rough, phi_rough, R, 
+               theta_cut, phi_cut, halo_pos, radius, sel);
+        return;
+    }
+    
+    vector<Halo_selection> chunkSel(numChunks);
+    #pragma omp parallel for schedule(static, 1)
+    for(int t = 0; t < numChunks; ++t){
+        int lo = (int64_t)numCandidates * t / numChunks;
+        int hi = (int64_t)numCandidates * (t+1) / numChunks;
+        kernel(particles, candidates ? candidates + lo : NULL, first + lo, hi - lo, theta_rough, phi_rough, R, 
+               theta_cut, phi_cut, halo_pos, radius, chunkSel[t]);
+    }
+    
+    sel = chunkSel[0];
+    for(int t = 1; t < numChunks; ++t){
+        sel.n.insert(sel.n.end(), chunkSel[t].n.begin(), chunkSel[t].n.end());
+        sel.v_rot.insert(sel.v_rot.end(), chunkSel[t].v_rot.begin(), chunkSel[t].v_rot.end());
+        sel.v_theta.insert(sel.v_theta.end(), chunkSel[t].v_theta.begin(), chunkSel[t].v_theta.end());
+        sel.v_phi.insert(sel.v_phi.end(), chunkSel[t].v_phi.begin(), chunkSel[t].v_phi.end());
+    }
+}
+
+
+//======================================================================================
+
+
+static void gatherHaloColumns(const vector<particle_pos> &particles, const vector<char> &rows,
+                              const Column_schema &schema, const vector<int> &derivedCols,
+                              float halo_r, const Halo_selection &sel, Buffers_write &w){
+    // Fills the write buffers of a halo's cutout from the particles found by 
+    // selectHaloParticles(), one selected column at a time, so that the choice of 
+    // columns is made once per column, rather than per particle, and columns which 
+    // aren't written are never touched
+    //
+    // Params:
+    // :param particles: the theta-sorted particles
+    // :param rows: the exchanged non-core columns of the particles, as rows
+    // :param schema: the column schema
+    // :param derivedCols: the derived columns to write, as Derived_col values
+    // :param halo_r: the distance to the halo
+    // :param sel: the particles in the cutout
+    // :param w: the write buffers to fill (w.extra and w.derived already sized)
+    // :return: none
+    
+    size_t k = sel.n.size();
+    const int *idx = sel.n.data();
+
+    if(schema.writeCore[CORE_THETA]){ w.theta.assign(sel.v_theta.begin(), sel.v_theta.end()); }
+    if(schema.writeCore[CORE_PHI]){ w.phi.assign(sel.v_phi.begin(), sel.v_phi.end()); }
+    if(schema.writeCore[CORE_X]){
+        w.x.resize(k);
+        for(size_t j = 0; j < k; ++j){ w.x[j] = particles[idx[j]].x; }
+    }
+    if(schema.writeCore[CORE_Y]){
+        w.y.resize(k);
+        for(size_t j = 0; j < k; ++j){ w.y[j] = particles[idx[j]].y; }
+    }
+    if(schema.writeCore[CORE_Z]){
+        w.z.resize(k);
+        for(size_t j = 0; j < k; ++j){ w.z[j] = particles[idx[j]].z; }
+    }
+    if(schema.writeCore[CORE_REDSHIFT]){
+        w.redshift.resize(k);
+        for(size_t j = 0; j < k; ++j){ w.redshift[j] = aToZ(particles[idx[j]].a); }
+    }
+    if(schema.writeCore[CORE_ID]){
+        w.id.resize(k);
+        for(size_t j = 0; j < k; ++j){ w.id[j] = particles[idx[j]].id; }
+    }
+    
+    // non-core columns, from each particle's row
+    for(int c = 0; c < schema.extra.size(); ++c){
+        const Column_info &col = schema.extra[c];
+        if(!col.exchange){ continue; }
+        w.extra[c].resize(k * col.size);
+        for(size_t j = 0; j < k; ++j){
+            memcpy(&w.extra[c][j*col.size], &rows[(size_t)idx[j]*schema.rowSize + col.rowOffset], 
+                   col.size);
+        }
+    }
+    
+    // derived columns, from the rotated positions and observer-frame distances
+    for(int c = 0; c < derivedCols.size(); ++c){
+        vector<float> &out = w.derived[c];
+        out.resize(k);
+        const float *v = sel.v_rot.data();
+        switch(derivedCols[c]){
+            case DERIVED_V_LOS: for(size_t j = 0; j < k; ++j){ out[j] = particles[idx[j]].v_los; } break;
+            case DERIVED_D:     for(size_t j = 0; j < k; ++j){ out[j] = particles[idx[j]].d; } break;
+            case DERIVED_X_ROT: for(size_t j = 0; j < k; ++j){ out[j] = v[3*j] - halo_r; } break;
+            case DERIVED_Y_ROT: for(size_t j = 0; j < k; ++j){ out[j] = v[3*j+1]; } break;
+            case DERIVED_Z_ROT: for(size_t j = 0; j < k; ++j){ out[j] = v[3*j+2]; } break;
+            case DERIVED_X_TAN: 
+                for(size_t j = 0; j < k; ++j){ out[j] = v[3*j+1]/v[3*j] * 180.0/PI * ARCSEC; } 
+                break;
+            case DERIVED_Y_TAN: 
+                for(size_t j = 0; j < k; ++j){ out[j] = v[3*j+2]/v[3*j] * 180.0/PI * ARCSEC; } 
+                break;
+        }
+    }
+}
+
+
+//======================================================================================
+
+
+static void allgatherTable(vector<float> &table, int stride, const vector<int> &counts,
+                           const vector<int> &offsets){
+    // Shares a flat per-halo table of which each rank has filled its own slice,
+    // given as counts and offsets in halos, with stride floats per halo
+
+    vector<int> scaledCounts(counts.size());
+    vector<int> scaledOffsets(offsets.size());
+    for(int ri = 0; ri < counts.size(); ++ri){
+        scaledCounts[ri] = stride*counts[ri];
+        scaledOffsets[ri] = stride*offsets[ri];
+    }
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, table.data(), &scaledCounts[0], 
+                   &scaledOffsets[0], MPI_FLOAT, MPI_COMM_WORLD);
+}
+
+
+//======================================================================================
+
+
+static void computeHaloGeometry(const vector<float> &halo_pos, float boxLength, 
+                                float volumeRadius, int myrank, int numranks, 
+                                Halo_geometry &geo){
+    // Finds the rotation and angular bounds of the cutout about each target halo. Each
+    // rank computes a contiguous slice of the halos, with OpenMP threads, and the 
+    // slices are then shared with an Allgatherv.
+    //
+    // The cutout is first defined with constant theta and phi bounds that encapsulate
+    // a field of angular size boxLength for the target halo *if it were lying on the 
+    // equator*, at (r, 90, 0). With the cutout sized correctly, we then "point it" at 
+    // the true halo position to get the real non-constant angular bounds, by rotating
+    // the four unit vectors (A, B, C, D) directed toward the corners of the bounded 
+    // fov on the equator with the inverse of the halo's rotation matrix:
+    //
+    //                                          C
+    //                                        _--_ 
+    //    B-----------C                     _-    -_  
+    //    |           |    R_inv          _-        -_   
+    //    |           |  -------->>   B _-            -_ D
+    //    |   fov     |                  -_   fov    _-
+    //    |           |                    -_      _-
+    //    A-----------D                      -_  _-  <--- boxLength
+    //          ^                              --
+    //          |__ boxLength                  A
+    //
+    // The rough bounds, used to quickly remove particles that certainly are not in 
+    // the field of view, are then the max and min theta and phi among the rotated 
+    // corners, with a buffer of constant size 10 arcmin (where typical cluster cutouts 
+    // at modest redshifts come out to have a width of order 1 degree). For comoving 
+    // volume cutouts, the rough bounds instead enclose the sphere of volumeRadius 
+    // about the halo, as seen from the observer
+    //
+    // Params:
+    // :param halo_pos: the halo positions, three components per halo
+    // :param boxLength: the angular width of the cutouts, in arcmin
+    // :param volumeRadius: the radius of a sphere enclosing each comoving volume 
+    //                      cutout, or 0 for angular cutouts
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :param geo: the Halo_geometry to fill
+    // :return: none
+    
+    int numHalos = halo_pos.size()/3;
+    float ang_buffer = 600; // buffer in arcsec
+    
+    // calculate dtheta and dphi in radians gven boxlength in arcmin, and the 
+    // constant bounds in arcsec
+    float halfBoxLength = ((boxLength/2.0) / 60) * PI/180.0;
+    float dtheta = halfBoxLength;
+    float dphi = dtheta;
+    geo.theta_cut[0] = (PI/2 - dtheta) * 180.0/PI * ARCSEC;
+    geo.theta_cut[1] = (PI/2 + dtheta) * 180.0/PI * ARCSEC;
+    geo.phi_cut[0] = (0 - dphi) * 180.0/PI * ARCSEC;
+    geo.phi_cut[1] = (0 + dphi) * 180.0/PI * ARCSEC;
+    
+    // corners A, B, C, D as (theta, phi) in radians
+    float corner_theta[4];
+    float corner_phi[4];
+    for(int c = 0; c < 4; ++c){
+        corner_theta[c] = (geo.theta_cut[(c == 0 or c == 3) ? 1 : 0] / ARCSEC) * PI/180.0;
+        corner_phi[c] = (geo.phi_cut[(c < 2) ? 1 : 0] / ARCSEC) * PI/180.0;
+    }
+    
+    geo.R.resize(9*numHalos);
+    geo.theta_rough.resize(2*numHalos);
+    geo.phi_rough.resize(2*numHalos);
+    geo.halo_r.resize(numHalos);
+
+    vector<int> counts(numranks);
+    vector<int> offsets(numranks);
+    for(int ri = 0; ri < numranks; ++ri){
+        offsets[ri] = (int64_t)numHalos * ri / numranks;
+        counts[ri] = (int64_t)numHalos * (ri+1) / numranks - offsets[ri];
+    }
+    
+    #pragma omp parallel for schedule(static)
+    for(int h = offsets[myrank]; h < offsets[myrank] + counts[myrank]; ++h){
+        
+        const float *pos = &halo_pos[3*h];
+        float *R = &geo.R[9*h];
+        geo.halo_r[h] = (float)sqrt(pos[0]*pos[0] + pos[1]*pos[1] + pos[2]*pos[2]);
+        haloRotation(pos, R);
+
+        float theta_min = 1e30, theta_max = -1e30;
+        float phi_min = 1e30, phi_max = -1e30;
+        for(int c = 0; c < 4; ++c){
+            float v[3] = {sin(corner_theta[c]) * cos(corner_phi[c]), 
+                          sin(corner_theta[c]) * sin(corner_phi[c]), 
+                          cos(corner_theta[c])};
+            
+            // rotate by R_inv = R^T
+            float v_rot[3];
+            for(int i = 0; i < 3; ++i){
+                v_rot[i] = R[i]*v[0] + R[3+i]*v[1] + R[6+i]*v[2];
+            }
+            float theta = acos(v_rot[2]) * 180.0/PI * ARCSEC;
+            float phi = atan(v_rot[1]/v_rot[0]) * 180.0/PI * ARCSEC;
+            theta_min = min(theta_min, theta);
+            theta_max = max(theta_max, theta);
+            phi_min = min(phi_min, phi);
+            phi_max = max(phi_max, phi);
+        }
+        geo.theta_rough[2*h] = theta_min - ang_buffer;
+        geo.theta_rough[2*h+1] = theta_max + ang_buffer;
+        geo.phi_rough[2*h] = phi_min - ang_buffer;
+        geo.phi_rough[2*h+1] = phi_max + ang_buffer;
+
+        if(volumeRadius > 0){
+            
+            // the sphere subtends a cap of angular radius alpha about the halo. If the 
+            // cap doesn't contain a pole, its extent in phi is +-asin(sin(alpha)/sin(theta)),
+            // unless that crosses the y-z plane, where the lightcone's phi wraps
+            float r = geo.halo_r[h];
+            float theta_h = acos(pos[2]/r);
+            float phi_h = (pos[0] == 0) ? (pos[1] > 0 ? PI/2 : -PI/2) : atan(pos[1]/pos[0]);
+            float alpha = (r > volumeRadius) ? asin(volumeRadius/r) : PI;
+            
+            theta_min = theta_h - alpha;
+            theta_max = theta_h + alpha;
+            phi_min = -PI/2;
+            phi_max = PI/2;
+            if(theta_min > 0 and theta_max < PI){
+                float dphi = asin(min(1.0f, sin(alpha)/sin(theta_h)));
+                if(phi_h - dphi > -PI/2 and phi_h + dphi < PI/2){
+                    phi_min = phi_h - dphi;
+                    phi_max = phi_h + dphi;
+                }
+            }
+            geo.theta_rough[2*h] = max(0.0f, theta_min) * 180.0/PI * ARCSEC - ang_buffer;
+            geo.theta_rough[2*h+1] = min((float)PI, theta_max) * 180.0/PI * ARCSEC + ang_buffer;
+            geo.phi_rough[2*h] = phi_min * 180.0/PI * ARCSEC - ang_buffer;
+            geo.phi_rough[2*h+1] = phi_max * 180.0/PI * ARCSEC + ang_buffer;
+        }
+    }
+
+    // share the slices
+    allgatherTable(geo.halo_r, 1, counts, offsets);
+    allgatherTable(geo.R, 9, counts, offsets);
+    allgatherTable(geo.theta_rough, 2, counts, offsets);
+    allgatherTable(geo.phi_rough, 2, counts, offsets);
+}
+
+
+//======================================================================================
+
+
+static void writePropertiesCatalog(string out_dir, const vector<string> &halo_dirs, 
+                                   const vector<float> &halo_pos, const vector<float> &halo_props,
+                                   const Halo_geometry &geo, float halfBoxLength, int myrank, 
+                                   int numranks){
+    // Writes the properties and cutout geometry of all target halos to one columnar 
+    // catalog, as the directory out_dir/halo_properties/, containing one float32 binary 
+    // file per column with one entry per halo (except rotation.bin, which has the nine
+    // elements of each halo's row-major rotation matrix), and an index.csv mapping rows 
+    // to halo output directories. The columns contain the same quantities as each 
+    // properties.csv, plus the rough cutout bounds and rotation. Each rank writes the 
+    // slice of halos it computed in computeHaloGeometry(). Must be called by all ranks.
+    //
+    // Params:
+    // :param out_dir: the top-level output directory
+    // :param halo_dirs: the output directory of each halo
+    // :param halo_pos: the halo positions, three components per halo
+    // :param halo_props: the halo properties, three (fof) or six (sod) per halo
+    // :param geo: the halo geometry, as filled by computeHaloGeometry()
+    // :param halfBoxLength: half the angular width of the cutouts, in radians
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :return: none
+    
+    int numHalos = halo_pos.size()/3;
+    int numProps = numHalos > 0 ? halo_props.size() / numHalos : 0;
+    int first = (int64_t)numHalos * myrank / numranks;
+    int last = (int64_t)numHalos * (myrank+1) / numranks;
+    int count = last - first;
+    
+    string cat_dir = out_dir + "halo_properties/";
+    if(myrank == 0){
+        mkdir(cat_dir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IXOTH);
+        
+        ofstream index_file((cat_dir + "index.csv").c_str());
+        index_file << "#row, halo_dir\n";
+        for(int h = 0; h < numHalos; ++h){ index_file << h << ", " << halo_dirs[h] << "\n"; }
+        cout << "writing properties of " << numHalos << " halos to " << cat_dir << endl;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    vector<string> names;
+    names.push_back("halo_redshift");
+    names.push_back("halo_lc_shell");
+    if(numProps == 6){
+        names.push_back("sod_halo_mass");
+        names.push_back("sod_halo_radius");
+        names.push_back("sod_halo_cdelta");
+        names.push_back("sod_halo_cdelta_error");
+    }else{
+        names.push_back("fof_halo_mass");
+    }
+    names.push_back("halo_lc_x");
+    names.push_back("halo_lc_y");
+    names.push_back("halo_lc_z");
+    names.push_back("boxRadius_Mpc");
+    names.push_back("boxRadius_arcsec");
+    names.push_back("theta_rough_min");
+    names.push_back("theta_rough_max");
+    names.push_back("phi_rough_min");
+    names.push_back("phi_rough_max");
+    
+    vector<vector<float> > cols(names.size(), vector<float>(count));
+    for(int n = 0; n < count; ++n){
+        int h = first + n;
+        int c = 0;
+        for(int i = 0; i < numProps; ++i){ cols[c++][n] = halo_props[numProps*h + i]; }
+        for(int i = 0; i < 3; ++i){ cols[c++][n] = halo_pos[3*h + i]; }
+        cols[c++][n] = atan(halfBoxLength) * geo.halo_r[h];
+        cols[c++][n] = halfBoxLength * 180.0/PI * ARCSEC;
+        cols[c++][n] = geo.theta_rough[2*h];
+        cols[c++][n] = geo.theta_rough[2*h+1];
+        cols[c++][n] = geo.phi_rough[2*h];
+        cols[c++][n] = geo.phi_rough[2*h+1];
+    }
+
+    MPI_Offset offset = sizeof(float) * first;
+    for(int c = 0; c < names.size(); ++c){
+        writeColumn(cat_dir + names[c] + ".bin", cols[c].data(), count, MPI_FLOAT, offset);
+    }
+    writeColumn(cat_dir + "rotation.bin", const_cast<float*>(&geo.R[9*first]), 9*count, MPI_FLOAT, 
+                9*offset);
+}
+
+
+//======================================================================================
+
+
+static MPI_Comm makeReaderComm(int readersPerNode, int totalReaders, int myrank, 
+                               int numranks, bool &isReader){
+    // Selects the ranks which open and read the lightcone input, and returns a 
+    // communicator over them (or MPI_COMM_NULL on all other ranks). By default, every
+    // rank reads. If readersPerNode > 0, the first readersPerNode ranks on each node 
+    // read; otherwise, if totalReaders > 0, that many ranks evenly spaced in 
+    // MPI_COMM_WORLD read (which, with ranks placed in blocks, spreads them over nodes).
+    // Reading is then done by GenericIO's MismatchRedistribute over the readers only, 
+    // so that the filesystem sees a few clients doing large reads, and the data is 
+    // forwarded to all other ranks by the balancing exchange which follows the read.
+    // Only used by the halo overload of processLC(), since the other has no such 
+    // exchange (main.cpp rejects reader options without -h or -f). Rank 0 is always a
+    // reader. Must be called by all ranks.
+    //
+    // Params:
+    // :param readersPerNode: the number of reader ranks per node, or 0
+    // :param totalReaders: the total number of reader ranks, or 0
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :param isReader: to be set to true if this rank is a reader
+    // :return: the reader communicator, to be freed by the caller if not MPI_COMM_WORLD
+
+    if(readersPerNode > 0){
+        MPI_Comm node_comm;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+        int noderank;
+        MPI_Comm_rank(node_comm, &noderank);
+        MPI_Comm_free(&node_comm);
+        isReader = (noderank < readersPerNode);
+    }
+    else if(totalReaders > 0 and totalReaders < numranks){
+        // ranks r for which floor(r*totalReaders/numranks) increments
+        isReader = ((int64_t)myrank * totalReaders / numranks != 
+                    (int64_t)(myrank-1) * totalReaders / numranks) or myrank == 0;
+    }
+    else{
+        isReader = true;
+        return MPI_COMM_WORLD;
+    }
+
+    MPI_Comm reader_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, isReader ? 0 : MPI_UNDEFINED, myrank, &reader_comm);
+    
+    int numReaders = isReader;
+    MPI_Allreduce(MPI_IN_PLACE, &numReaders, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if(myrank == 0){ cout << "Reading input on " << numReaders << " of " << numranks << " ranks" << endl; }
+    return reader_comm;
+}
+
+
+//////////////////////////////////////////////////////
+//
+//              column schema helpers
+//
+//////////////////////////////////////////////////////
+
+static void resolveColumnSchema(const vector<Column_info> &available, Column_schema &schema, 
+                                int myrank){
+    // Completes a Column_schema (as built by selectColumns() in util.cpp) by looking up 
+    // the type of each extra column among the variables of the input, and laying out 
+    // the exchanged columns into rows. Aborts if a requested column is not present 
+    // in the input.
+    //
+    // Params:
+    // :param available: the variables present in the input, with their types
+    // :param schema: the Column_schema to complete
+    // :param myrank: this rank's identifier
+    // :return: none
+
+    schema.rowSize = 0;
+    for(int c = 0; c < schema.extra.size(); ++c){
+        Column_info &col = schema.extra[c];
+        
+        int v = 0;
+        while(v < available.size() and available[v].name != col.name){ ++v; }
+        if(v == available.size()){
+            if(myrank == 0){
+                cout << "\nColumn " << col.name << " not found in lightcone. Available columns are: ";
+                for(int vv = 0; vv < available.size(); ++vv){ cout << available[vv].name << " "; }
+                cout << endl;
+            }
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+        
+        col.size = available[v].size;
+        col.isFloat = available[v].isFloat;
+        col.isSigned = available[v].isSigned;
+        if(col.exchange){
+            col.rowOffset = schema.rowSize;
+            schema.rowSize += col.size;
+        }
+    }
+}
+
+
+//======================================================================================
+
+
+static void resolveColumnSchema(GenericIO &GIO, Column_schema &schema, int myrank){
+    // As above, with the variables of an opened GenericIO file
+    //
+    // Params:
+    // :param GIO: a GenericIO object, for which openAndReadHeader() has been called
+    // :param schema: the Column_schema to complete
+    // :param myrank: this rank's identifier
+    // :return: none
+
+    vector<GenericIO::VariableInfo> VI;
+    GIO.getVariableInfo(VI);
+    
+    vector<Column_info> available(VI.size());
+    for(int v = 0; v < VI.size(); ++v){
+        available[v].name = VI[v].Name;
+        available[v].size = VI[v].Size;
+        available[v].isFloat = VI[v].IsFloat;
+        available[v].isSigned = VI[v].IsSigned;
+    }
+    resolveColumnSchema(available, schema, myrank);
+}
+
+
+//======================================================================================
+
+
+static void bcastColumnSchema(Column_schema &schema){
+    // Broadcasts the column types and row layout of a Column_schema, as completed by 
+    // resolveColumnSchema() on rank 0, to all other ranks (which need not have opened 
+    // the input, see makeReaderComm()). Must be called by all ranks.
+    //
+    // Params:
+    // :param schema: the Column_schema, with the same columns selected on all ranks
+    // :return: none
+
+    int numExtra = schema.extra.size();
+    vector<int> layout(4*numExtra + 1);
+    for(int c = 0; c < numExtra; ++c){
+        layout[4*c] = schema.extra[c].size;
+        layout[4*c+1] = schema.extra[c].isFloat;
+        layout[4*c+2] = schema.extra[c].isSigned;
+        layout[4*c+3] = schema.extra[c].rowOffset;
+    }
+    layout[4*numExtra] = schema.rowSize;
+    
+    MPI_Bcast(layout.data(), layout.size(), MPI_INT, 0, MPI_COMM_WORLD);
+    
+    for(int c = 0; c < numExtra; ++c){
+        schema.extra[c].size = layout[4*c];
+        schema.extra[c].isFloat = layout[4*c+1];
+        schema.extra[c].isSigned = layout[4*c+2];
+        schema.extra[c].rowOffset = layout[4*c+3];
+    }
+    schema.rowSize = layout[4*numExtra];
+}
+
+
+//======================================================================================
+
+
+static void addRawVariable(GenericIO &GIO, const Column_info &col, vector<char> &buf){
+    // Adds a non-core column to a GenericIO reader, with a raw byte buffer as the
+    // destination. GenericIO checks the element type of the destination against 
+    // that of the file, so the buffer is handed over as a pointer to the matching type.
+    //
+    // Params:
+    // :param GIO: a GenericIO object, for which openAndReadHeader() has been called
+    // :param col: the column, as completed by resolveColumnSchema()
+    // :param buf: the buffer, already sized to hold the column plus the reader's 
+    //             requested extra space
+    // :return: none
+
+    char *data = &buf[0];
+    if(col.isFloat){
+        if(col.size == 4){ GIO.addVariable(col.name, (float*)data, true); }
+        else{ GIO.addVariable(col.name, (double*)data, true); }
+    }
+    else if(col.isSigned){
+        switch(col.size){
+            case 1: GIO.addVariable(col.name, (int8_t*)data, true); break;
+            case 2: GIO.addVariable(col.name, (int16_t*)data, true); break;
+            case 4: GIO.addVariable(col.name, (int32_t*)data, true); break;
+            default: GIO.addVariable(col.name, (int64_t*)data, true); break;
+        }
+    }
+    else{
+        switch(col.size){
+            case 1: GIO.addVariable(col.name, (uint8_t*)data, true); break;
+            case 2: GIO.addVariable(col.name, (uint16_t*)data, true); break;
+            case 4: GIO.addVariable(col.name, (uint32_t*)data, true); break;
+            default: GIO.addVariable(col.name, (uint64_t*)data, true); break;
+        }
+    }
+}
+
+
+
+//////////////////////////////////////////////////////
+//
+//                  input reading
+//
+//////////////////////////////////////////////////////
+
+static void readGIOStep(MPI_Comm comm, string file_name, unsigned Method, 
+                        Column_schema &schema, int myrank, Buffers_read &r, size_t &Np){
+    // Reads this rank's share of a whole lightcone step with GenericIO, in one call, 
+    // as redistributed over the ranks of comm. Only the core (x, y, z, a, id) and 
+    // extra columns are filled. Also completes the column schema from the file header.
+    //
+    // Params:
+    // :param comm: the communicator of the ranks reading the step
+    // :param file_name: the lightcone step header file
+    // :param Method: the GenericIO file IO method
+    // :param schema: the column schema of the run, to be completed
+    // :param myrank: this rank's identifier
+    // :param r: the read buffers to fill
+    // :param Np: to be set to the number of particles read
+    // :return: none
+
+    GenericIO GIO(comm, file_name, Method);
+    GIO.openAndReadHeader(GenericIO::MismatchRedistribute);
+
+    MPI_Barrier(comm);
+    Np = GIO.readNumElems();
+    
+    // find the types of the requested non-core columns
+    resolveColumnSchema(GIO, schema, myrank);
+    int numExtra = schema.extra.size();
+   
+    // resize buffers   
+    r.x.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
+    r.y.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
+    r.z.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
+    r.a.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
+    r.id.resize(Np + GIO.requestedExtraSpace()/sizeof(ID_T));
+    r.extra.resize(numExtra);
+    for(int c = 0; c < numExtra; ++c){
+        r.extra[c].resize(Np*schema.extra[c].size + GIO.requestedExtraSpace());
+    }
+
+    // do reading
+    GIO.addVariable("x", r.x, true); 
+    GIO.addVariable("y", r.y, true); 
+    GIO.addVariable("z", r.z, true); 
+    GIO.addVariable("a", r.a, true); 
+    GIO.addVariable("id", r.id, true); 
+    for(int c = 0; c < numExtra; ++c){
+        addRawVariable(GIO, schema.extra[c], r.extra[c]);
+    }
+
+    GIO.readData(); 
+    
+    // resize again to remove reader extra space
+    r.x.resize(Np);
+    r.y.resize(Np);
+    r.z.resize(Np);
+    r.a.resize(Np);
+    r.id.resize(Np);
+    for(int c = 0; c < numExtra; ++c){
+        r.extra[c].resize(Np*schema.extra[c].size);
+    }
+}
+
+
+//======================================================================================
+
+
+
+static bool readMappedStep(string file_name, Column_schema &schema, const Footprint_mask *mask,
+                           int blockStride, int readerRank, int numReaders, int myrank, 
+                           Buffers_read &r, size_t &Np, size_t &Np_read){
+    // Reads this rank's share of a lightcone step from memory-mapped pages (see 
+    // mapGIOFile() in util.cpp), rather than through GenericIO. The blocks of the file 
+    // (or every blockStride-th block, for a preview) are dealt out to the reader ranks 
+    // in turn. For each particle, d, theta, and phi 
+    // are computed directly from the mapped positions and, if a mask is given, 
+    // particles outside of it are skipped, so that only those which may fall in a 
+    // cutout are ever copied into the read buffers. Also completes the column schema 
+    // from the file's variables. Returns false if the file can't be read this way, in 
+    // which case the buffers should be discarded, and the step read with GenericIO.
+    //
+    // Params:
+    // :param file_name: the lightcone step header file
+    // :param schema: the column schema of the run, to be completed
+    // :param mask: the footprint mask to apply, or NULL to keep all particles
+    // :param blockStride: only every blockStride-th block is read (1 for all blocks)
+    // :param readerRank: this rank's index among the reader ranks
+    // :param numReaders: the number of reader ranks
+    // :param myrank: this rank's identifier
+    // :param r: the read buffers to fill (x, y, z, d, theta, phi, a, id, and extra)
+    // :param Np: to be set to the number of particles kept
+    // :param Np_read: to be set to the number of particles in this rank's blocks
+    // :return: true if the step was read
+
+    Mapped_gio gio;
+    if(!mapGIOFile(file_name, gio)){ return false; }
+    resolveColumnSchema(gio.vars, schema, myrank);
+
+    // find the core and extra columns, which must have their usual types
+    const char *coreNames[5] = {"x", "y", "z", "a", "id"};
+    int coreSizes[5] = {sizeof(POSVEL_T), sizeof(POSVEL_T), sizeof(POSVEL_T), sizeof(POSVEL_T), sizeof(ID_T)};
+    int coreVar[5];
+    for(int k = 0; k < 5; ++k){
+        coreVar[k] = -1;
+        for(int v = 0; v < gio.vars.size(); ++v){ 
+            if(gio.vars[v].name == coreNames[k]){ coreVar[k] = v; } 
+        }
+        if(coreVar[k] < 0 or gio.vars[coreVar[k]].size != coreSizes[k]){ return false; }
+    }
+    int numExtra = schema.extra.size();
+    vector<int> extraVar(numExtra);
+    for(int c = 0; c < numExtra; ++c){
+        for(int v = 0; v < gio.vars.size(); ++v){ 
+            if(gio.vars[v].name == schema.extra[c].name){ extraVar[c] = v; } 
+        }
+    }
+    r.extra.resize(numExtra);
+    
+    Np_read = 0;
+    for(int b = readerRank*blockStride; b < gio.blockFile.size(); b += numReaders*blockStride){
+        
+        const char *cols[5];
+        for(int k = 0; k < 5; ++k){ cols[k] = mappedBlock(gio, b, coreVar[k]); }
+        vector<const char*> extraCols(numExtra);
+        for(int c = 0; c < numExtra; ++c){ extraCols[c] = mappedBlock(gio, b, extraVar[c]); }
+        if(!gio.ok){
+            unmapGIOFile(gio);
+            return false;
+        }
+
+        size_t blockNp = gio.blockNp[b];
+        Np_read += blockNp;
+        for(size_t n = 0; n < blockNp; ++n){
+            POSVEL_T x, y, z, d;
+            float theta, phi;
+            memcpy(&x, cols[0] + n*sizeof(POSVEL_T), sizeof(POSVEL_T));
+            memcpy(&y, cols[1] + n*sizeof(POSVEL_T), sizeof(POSVEL_T));
+            memcpy(&z, cols[2] + n*sizeof(POSVEL_T), sizeof(POSVEL_T));
+            toSpherical(x, y, z, d, theta, phi);
+            if(mask != NULL and !footprintContains(*mask, theta, phi)){ continue; }
+
+            POSVEL_T a;
+            ID_T id;
+            memcpy(&a, cols[3] + n*sizeof(POSVEL_T), sizeof(POSVEL_T));
+            memcpy(&id, cols[4] + n*sizeof(ID_T), sizeof(ID_T));
+            r.x.push_back(x);
+            r.y.push_back(y);
+            r.z.push_back(z);
+            r.d.push_back(d);
+            r.theta.push_back(theta);
+            r.phi.push_back(phi);
+            r.a.push_back(a);
+            r.id.push_back(id);
+            for(int c = 0; c < numExtra; ++c){
+                int size = schema.extra[c].size;
+                r.extra[c].insert(r.extra[c].end(), extraCols[c] + n*size, extraCols[c] + (n+1)*size);
+            }
+        }
+    }
+    
+    unmapGIOFile(gio);
+    Np = r.x.size();
+    return true;
+}
+
+
+//======================================================================================
+
+
+static void readGIOBlock(GenericIO &GIO, int block, const Column_schema &schema, 
+                         Buffers_read &stage, size_t &blockNp){
+    // Reads the core (x, y, z, a, id) and extra columns of one block of a GenericIO 
+    // file, opened with MismatchAllowed, into a staging buffer
+
+    blockNp = GIO.readNumElems(block);
+    size_t extraSpace = GIO.requestedExtraSpace();
+    int numExtra = schema.extra.size();
+
+    stage.x.resize(blockNp + extraSpace/sizeof(POSVEL_T));
+    stage.y.resize(blockNp + extraSpace/sizeof(POSVEL_T));
+    stage.z.resize(blockNp + extraSpace/sizeof(POSVEL_T));
+    stage.a.resize(blockNp + extraSpace/sizeof(POSVEL_T));
+    stage.id.resize(blockNp + extraSpace/sizeof(ID_T));
+    stage.extra.resize(numExtra);
+    for(int c = 0; c < numExtra; ++c){
+        stage.extra[c].resize(blockNp*schema.extra[c].size + extraSpace);
+    }
+    if(blockNp == 0){ return; }
+
+    GIO.clearVariables();
+    GIO.addVariable("x", stage.x, true); 
+    GIO.addVariable("y", stage.y, true); 
+    GIO.addVariable("z", stage.z, true); 
+    GIO.addVariable("a", stage.a, true); 
+    GIO.addVariable("id", stage.id, true); 
+    for(int c = 0; c < numExtra; ++c){
+        addRawVariable(GIO, schema.extra[c], stage.extra[c]);
+    }
+    GIO.readData(block, false, false);
+}
+
+
+//======================================================================================
+
+
+static void filterStagedBlock(const Buffers_read &stage, size_t blockNp, 
+                              const Column_schema &schema, const Footprint_mask *mask, 
+                              Buffers_read &r){
+    // Computes d, theta, and phi for each particle of a staged block, and appends 
+    // those inside the mask (or all, if mask is NULL) to the read buffers
+
+    int numExtra = schema.extra.size();
+    r.extra.resize(numExtra);
+    for(size_t n = 0; n < blockNp; ++n){
+        POSVEL_T d;
+        float theta, phi;
+        toSpherical(stage.x[n], stage.y[n], stage.z[n], d, theta, phi);
+        if(mask != NULL and !footprintContains(*mask, theta, phi)){ continue; }
+
+        r.x.push_back(stage.x[n]);
+        r.y.push_back(stage.y[n]);
+        r.z.push_back(stage.z[n]);
+        r.d.push_back(d);
+        r.theta.push_back(theta);
+        r.phi.push_back(phi);
+        r.a.push_back(stage.a[n]);
+        r.id.push_back(stage.id[n]);
+        for(int c = 0; c < numExtra; ++c){
+            int size = schema.extra[c].size;
+            r.extra[c].insert(r.extra[c].end(), &stage.extra[c][n*size], &stage.extra[c][n*size] + size);
+        }
+    }
+}
+
+
+//======================================================================================
+
+
+static void readStreamedStep(string file_name, unsigned Method, Column_schema &schema, 
+                             const Footprint_mask *mask, int blockStride, int readerRank, 
+                             int numReaders, int myrank, Buffers_read &r, size_t &Np, 
+                             size_t &Np_read){
+    // Reads this rank's share of a lightcone step one GenericIO block at a time, rather
+    // than all at once. The blocks of the file (or every blockStride-th block, for a 
+    // preview) are dealt out to the reader ranks in turn. Each block is read into a 
+    // staging buffer, and its particles transformed to spherical coordinates and, if a 
+    // mask is given, filtered against it, with only those inside appended to the read 
+    // buffers. Two staging buffers are used, so that
+    // the next block is read (by the master thread, which makes any MPI calls inside 
+    // GenericIO) while the last is filtered (by a second OpenMP thread, if available).
+    // Memory per rank is then bounded by two blocks plus the particles kept, rather 
+    // than by all blocks read. Also completes the column schema from the file header.
+    //
+    // Params:
+    // :param file_name: the lightcone step header file
+    // :param Method: the GenericIO file IO method
+    // :param schema: the column schema of the run, to be completed
+    // :param mask: the footprint mask to apply, or NULL to keep all particles
+    // :param blockStride: only every blockStride-th block is read (1 for all blocks)
+    // :param readerRank: this rank's index among the reader ranks
+    // :param numReaders: the number of reader ranks
+    // :param myrank: this rank's identifier
+    // :param r: the read buffers to fill (x, y, z, d, theta, phi, a, id, and extra)
+    // :param Np: to be set to the number of particles kept
+    // :param Np_read: to be set to the number of particles in this rank's blocks
+    // :return: none
+
+    GenericIO GIO(MPI_COMM_SELF, file_name, Method);
+    GIO.openAndReadHeader(GenericIO::MismatchAllowed, -1, false);
+    resolveColumnSchema(GIO, schema, myrank);
+    
+    vector<int> blocks;
+    for(int b = readerRank*blockStride; b < GIO.readNRanks(); b += numReaders*blockStride){ 
+        blocks.push_back(b); 
+    }
+    
+    Buffers_read stage[2];
+    size_t stageNp[2] = {0, 0};
+    Np_read = 0;
+    if(blocks.size() > 0){ readGIOBlock(GIO, blocks[0], schema, stage[0], stageNp[0]); }
+
+    for(int k = 0; k < blocks.size(); ++k){
+        int cur = k % 2;
+        int next = (k+1) % 2;
+        bool readNext = (k+1 < blocks.size());
+        Np_read += stageNp[cur];
+
+        #pragma omp parallel num_threads(2)
+        {
+            int numThreads = omp_get_num_threads();
+            int thread = omp_get_thread_num();
+            if(thread == 0 and readNext){ 
+                readGIOBlock(GIO, blocks[k+1], schema, stage[next], stageNp[next]); 
+            }
+            if(thread == numThreads-1){ 
+                filterStagedBlock(stage[cur], stageNp[cur], schema, mask, r); 
+            }
+        }
+    }
+    Np = r.x.size();
+}
+
+
+//======================================================================================
+
+
+
+//////////////////////////////////////////////////////
+//
+//              halo catalog reading
+//
+//////////////////////////////////////////////////////
+
+void readHaloCatalog(string fileName, vector<float> &haloPos, vector<string> &haloTags,
+                     vector<float> &haloProps, string massDef, float minMass,
+                     const vector<string> &columnMap, int myrank, int numranks){
+    // Reads target halos from a GenericIO halo catalog, filling the same vectors, in 
+    // the same layout, as readHaloFile() in util.cpp does for text catalogs. All ranks 
+    // read a portion of the file, apply the mass cut, and then gather the result.
+    // Only the needed columns are read. By default, these are 
+    //
+    // tag: fof_halo_tag        radius: sod_halo_radius           x: x
+    // a: a                     cdelta: sod_halo_cdelta           y: y
+    // mass: fof_halo_mass      cdelta_err: sod_halo_cdelta_error z: z
+    //       (sod_halo_mass if massDef=='sod')
+    //
+    // where radius, cdelta, and cdelta_err are only read if massDef=='sod'. The redshift
+    // and lightcone shell of each halo are found from its scale factor a.
+    //
+    // Params:
+    // :param fileName: the GenericIO halo catalog
+    // :param haloPos: float vector to hold halo positions
+    // :param haloTags: string vector to hold halo tags
+    // :param haloProps: float vector to hold halo properties (see readHaloFile())
+    // :param massDef: the mass definition, either 'sod' or 'fof'
+    // :param minMass: halos with mass below this are skipped
+    // :param columnMap: overrides of the column names above, each as field=column
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :return: none
+
+    enum {TAG, A, MASS, RADIUS, CDELTA, CDELTA_ERR, X, Y, Z, NUM_FIELDS};
+    const char *fields[NUM_FIELDS] = {"tag", "a", "mass", "radius", "cdelta", "cdelta_err", 
+                                      "x", "y", "z"};
+    string columns[NUM_FIELDS] = {"fof_halo_tag", "a", "fof_halo_mass", "sod_halo_radius", 
+                                  "sod_halo_cdelta", "sod_halo_cdelta_error", "x", "y", "z"};
+    bool sod = (massDef == "sod");
+    if(sod){ columns[MASS] = "sod_halo_mass"; }
+    int numProps = sod ? 6 : 3;
+    
+    for(int c = 0; c < columnMap.size(); ++c){
+        size_t eq = columnMap[c].find('=');
+        int f = 0;
+        while(f < NUM_FIELDS and (eq == string::npos or columnMap[c].substr(0, eq) != fields[f])){ ++f; }
+        if(f == NUM_FIELDS){
+            if(myrank == 0){ 
+                cout << "\nInvalid halo column mapping " << columnMap[c] << "; expected field=column, " <<
+                        "with field one of tag, a, mass, radius, cdelta, cdelta_err, x, y, z" << endl;
+            }
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+        columns[f] = columnMap[c].substr(eq+1);
+    }
+
+    // read the needed columns as raw buffers
+    Column_schema schema;
+    vector<int> fieldCol(NUM_FIELDS, -1);
+    for(int f = 0; f < NUM_FIELDS; ++f){
+        if(!sod and (f == RADIUS or f == CDELTA or f == CDELTA_ERR)){ continue; }
+        Column_info col;
+        col.name = columns[f];
+        col.exchange = false;
+        fieldCol[f] = schema.extra.size();
+        schema.extra.push_back(col);
+    }
+
+    unsigned Method = GenericIO::FileIOPOSIX;
+    const char *EnvStr = getenv("GENERICIO_USE_MPIIO");
+    if(EnvStr && string(EnvStr) == "1"){
+        Method = GenericIO::FileIOMPI;  
+    }
+    
+    size_t Np;
+    vector<vector<char> > bufs(schema.extra.size());
+    {
+        GenericIO GIO(MPI_COMM_WORLD, fileName, Method);
+        GIO.openAndReadHeader(GenericIO::MismatchRedistribute);
+        Np = GIO.readNumElems();
+        resolveColumnSchema(GIO, schema, myrank);
+        
+        for(int c = 0; c < schema.extra.size(); ++c){
+            bufs[c].resize(Np*schema.extra[c].size + GIO.requestedExtraSpace());
+            addRawVariable(GIO, schema.extra[c], bufs[c]);
+        }
+        GIO.readData();
+    }
+    
+    // apply mass cut and pack this rank's halos
+    vector<float> localPos;
+    vector<float> localProps;
+    vector<int64_t> localTags;
+    for(size_t n = 0; n < Np; ++n){
+        double vals[NUM_FIELDS] = {0};
+        for(int f = 0; f < NUM_FIELDS; ++f){
+            if(fieldCol[f] < 0){ continue; }
+            const Column_info &col = schema.extra[fieldCol[f]];
+            vals[f] = columnValue(col, &bufs[fieldCol[f]][n*col.size]);
+        }
+        if(vals[MASS] < minMass){ continue; }
+
+        // tags are read directly, since int64 tags don't survive conversion to double
+        const Column_info &tagCol = schema.extra[fieldCol[TAG]];
+        int64_t tag = (int64_t)vals[TAG];
+        if(!tagCol.isFloat and tagCol.size == 8){ memcpy(&tag, &bufs[fieldCol[TAG]][n*8], 8); }
+        localTags.push_back(tag);
+
+        float zz = aToZ(vals[A]);
+        localProps.push_back(zz);
+        localProps.push_back(zToStep(zz));
+        localProps.push_back(vals[MASS]);
+        if(sod){
+            localProps.push_back(vals[RADIUS]);
+            localProps.push_back(vals[CDELTA]);
+            localProps.push_back(vals[CDELTA_ERR]);
+        }
+        localPos.push_back(vals[X]);
+        localPos.push_back(vals[Y]);
+        localPos.push_back(vals[Z]);
+    }
+    vector<vector<char> >().swap(bufs);
+
+    // gather all halos to all ranks
+    int numLocal = localTags.size();
+    vector<int> counts(numranks);
+    vector<int> offsets(numranks, 0);
+    MPI_Allgather(&numLocal, 1, MPI_INT, &counts[0], 1, MPI_INT, MPI_COMM_WORLD);
+    for(int ri = 1; ri < numranks; ++ri){ offsets[ri] = offsets[ri-1] + counts[ri-1]; }
+    int numHalos = offsets.back() + counts.back();
+    
+    vector<int64_t> tags(numHalos);
+    MPI_Allgatherv(localTags.data(), numLocal, MPI_INT64_T, 
+                   tags.data(), &counts[0], &offsets[0], MPI_INT64_T, MPI_COMM_WORLD);
+
+    vector<int> scaledCounts(numranks);
+    vector<int> scaledOffsets(numranks);
+    for(int ri = 0; ri < numranks; ++ri){ scaledCounts[ri] = 3*counts[ri]; scaledOffsets[ri] = 3*offsets[ri]; }
+    haloPos.resize(3*numHalos);
+    MPI_Allgatherv(localPos.data(), 3*numLocal, MPI_FLOAT, 
+                   haloPos.data(), &scaledCounts[0], &scaledOffsets[0], MPI_FLOAT, MPI_COMM_WORLD);
+    
+    for(int ri = 0; ri < numranks; ++ri){ 
+        scaledCounts[ri] = numProps*counts[ri]; 
+        scaledOffsets[ri] = numProps*offsets[ri]; 
+    }
+    haloProps.resize(numProps*numHalos);
+    MPI_Allgatherv(localProps.data(), numProps*numLocal, MPI_FLOAT, 
+                   haloProps.data(), &scaledCounts[0], &scaledOffsets[0], MPI_FLOAT, MPI_COMM_WORLD);
+
+    for(int h = 0; h < numHalos; ++h){ haloTags.push_back(to_string((long long)tags[h])); }
+    
+    if(myrank == 0){
+        cout << "Read " << numHalos << " halos from GenericIO catalog " << fileName;
+        if(minMass > 0){ cout << " above mass " << minMass; }
+        cout << endl;
+    }
+}
+
+
+//======================================================================================
+
+
+//////////////////////////////////////////////////////
+//
+//                 step manifest
+//
+//////////////////////////////////////////////////////
+
+static void writeManifestText(const Step_manifest &manifest, ostream &out){
+    // Writes a step manifest as text, in the format of the on-disk manifest cache (this
+    // is also how the manifest is broadcast). The header path is last on each line, so 
+    // that it may contain spaces
+
+    out << "# lc_cutout step manifest: step, blocks, elements, header size, header mtime, header\n";
+    out << "prefix " << manifest.subdirPrefix << "\n";
+    for(int i = 0; i < manifest.steps.size(); ++i){
+        out << manifest.steps[i] << " " << manifest.numBlocks[i] << " " << 
+               manifest.numElems[i] << " " << manifest.headerSize[i] << " " << 
+               manifest.headerMtime[i] << " " << manifest.headers[i] << "\n";
+    }
+}
+
+static void readManifestText(istream &in, Step_manifest &manifest){
+    // Reads a step manifest as written by writeManifestText(). Malformed lines are skipped
+
+    manifest = Step_manifest();
+    string line;
+    while(getline(in, line)){
+        if(line.size() == 0 or line[0] == '#'){ continue; }
+        if(line.compare(0, 7, "prefix ") == 0){
+            manifest.subdirPrefix = line.substr(7);
+            continue;
+        }
+        istringstream lineStream(line);
+        string step;
+        int numBlocks;
+        int64_t numElems, headerSize, headerMtime;
+        if(!(lineStream >> step >> numBlocks >> numElems >> headerSize >> headerMtime)){ continue; }
+        string header;
+        getline(lineStream >> ws, header);
+        
+        manifest.steps.push_back(step);
+        manifest.numBlocks.push_back(numBlocks);
+        manifest.numElems.push_back(numElems);
+        manifest.headerSize.push_back(headerSize);
+        manifest.headerMtime.push_back(headerMtime);
+        manifest.headers.push_back(header);
+    }
+}
+
+
+//======================================================================================
+
+
+void buildStepManifest(string dir_name, int maxStep, int minStep, string cacheFile, 
+                       Step_manifest &manifest, int myrank){
+    // Builds the manifest of lightcone steps to process: the step numbers within 
+    // [minStep, maxStep], their GenericIO header files, and the number of blocks and 
+    // elements in each. This replaces scanning the top-level directory on every rank, 
+    // and the per-step directory scans (which are slow over thousands of hashed block 
+    // files) at the start of every step. 
+    //
+    // Everything is done on rank 0, which lists dir_name once, and broadcast to all 
+    // ranks in one message. If cacheFile is given and exists, entries for steps found 
+    // there are reused as long as the header file's size and modification time are 
+    // unchanged, which costs one stat() per step rather than a directory scan and a 
+    // header read. Any new or changed steps are then found as usual, and the cache is 
+    // rewritten. Must be called by all ranks.
+    //
+    // Params:
+    // :param dir_name: the path to a lightcone output directory (see getLCSteps() in 
+    //                  util.cpp for the expected structure)
+    // :param maxStep: the maximum step of interest 
+    // :param minStep: the minimum step of interest
+    // :param cacheFile: the manifest cache file, or an empty string to not use one
+    // :param manifest: the manifest to fill
+    // :param myrank: this rank's identifier
+    // :return: none
+
+    string manifestText;
+    if(myrank == 0){
+        cout << "\nReading directory: " << dir_name << endl;
+        
+        vector<string> subdirs;
+        getLCSubdirs(dir_name, subdirs);
+        if(subdirs.size() == 0){
+            cout << "\nNo lightcone step subdirectories found in " << dir_name << endl;
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+
+        // find the prefix (chars before the step number) in the subdirectory names.
+        // It is assumed that all subdirs have the same prefix.
+        for(string::size_type j = 0; j < subdirs[0].size(); ++j){
+            if( isdigit(subdirs[0][j]) > 0){
+                manifest.subdirPrefix = subdirs[0].substr(0, j);
+                break;
+            }
+        }
+        cout << "Subdir prefix is: " << manifest.subdirPrefix << endl;
+        
+        vector<string> steps;
+        getLCSteps(maxStep, minStep, dir_name, steps);
+        
+        Step_manifest cached;
+        if(cacheFile.size() > 0 and does_file_exist(cacheFile)){
+            ifstream cache(cacheFile.c_str());
+            readManifestText(cache, cached);
+        }
+        
+        int numReused = 0;
+        int numFound = 0;
+        for(int i = 0; i < steps.size(); ++i){
+            
+            ostringstream step_dir;
+            step_dir << dir_name << manifest.subdirPrefix << steps[i] << "/";
+
+            // reuse the cached entry if the header is unchanged
+            int c = find(cached.steps.begin(), cached.steps.end(), steps[i]) - cached.steps.begin();
+            struct stat headerStat;
+            if(c < cached.steps.size() and stat(cached.headers[c].c_str(), &headerStat) == 0 and
+               cached.headers[c].compare(0, step_dir.str().size(), step_dir.str()) == 0 and
+               headerStat.st_size == cached.headerSize[c] and 
+               headerStat.st_mtime == cached.headerMtime[c]){
+                
+                manifest.steps.push_back(steps[i]);
+                manifest.headers.push_back(cached.headers[c]);
+                manifest.numBlocks.push_back(cached.numBlocks[c]);
+                manifest.numElems.push_back(cached.numElems[c]);
+                manifest.headerSize.push_back(cached.headerSize[c]);
+                manifest.headerMtime.push_back(cached.headerMtime[c]);
+                numReused++;
+                continue;
+            }
+
+            // otherwise, find the header file, and read it for the block and element counts
+            string file_name;
+            getLCFile(step_dir.str(), file_name);
+            string header = step_dir.str() + file_name;
+            stat(header.c_str(), &headerStat);
+            
+            int numBlocks = 0;
+            int64_t numElems = 0;
+            {
+                GenericIO GIO(MPI_COMM_SELF, header, GenericIO::FileIOPOSIX);
+                GIO.openAndReadHeader(GenericIO::MismatchAllowed, -1, false);
+                numBlocks = GIO.readNRanks();
+                for(int b = 0; b < numBlocks; ++b){ numElems += GIO.readNumElems(b); }
+            }
+            
+            manifest.steps.push_back(steps[i]);
+            manifest.headers.push_back(header);
+            manifest.numBlocks.push_back(numBlocks);
+            manifest.numElems.push_back(numElems);
+            manifest.headerSize.push_back(headerStat.st_size);
+            manifest.headerMtime.push_back(headerStat.st_mtime);
+            numFound++;
+        }
+        
+        cout << "Found " << manifest.steps.size() << " steps in range";
+        if(cacheFile.size() > 0){ cout << " (" << numReused << " from manifest cache)"; }
+        cout << endl;
+
+        // update the cache with any new steps, keeping entries for steps out of this 
+        // run's range
+        if(cacheFile.size() > 0 and numFound > 0){
+            Step_manifest merged = manifest;
+            for(int c = 0; c < cached.steps.size(); ++c){
+                if(find(steps.begin(), steps.end(), cached.steps[c]) != steps.end()){ continue; }
+                merged.steps.push_back(cached.steps[c]);
+                merged.headers.push_back(cached.headers[c]);
+                merged.numBlocks.push_back(cached.numBlocks[c]);
+                merged.numElems.push_back(cached.numElems[c]);
+                merged.headerSize.push_back(cached.headerSize[c]);
+                merged.headerMtime.push_back(cached.headerMtime[c]);
+            }
+            ofstream cache(cacheFile.c_str());
+            writeManifestText(merged, cache);
+        }
+
+        ostringstream text;
+        writeManifestText(manifest, text);
+        manifestText = text.str();
+    }
+    
+    // broadcast to all ranks
+    int textSize = manifestText.size();
+    MPI_Bcast(&textSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if(myrank != 0){ manifestText.resize(textSize); }
+    MPI_Bcast(const_cast<char*>(manifestText.data()), textSize, MPI_CHAR, 0, MPI_COMM_WORLD);
+    if(myrank != 0){
+        istringstream text(manifestText);
+        readManifestText(text, manifest);
+    }
+}
+
+
+//======================================================================================
+
+
+static bool stepWritten(string step_dir, time_t now, int settleSeconds){
+    // Checks whether a lightcone step directory holds a header file (as found by 
+    // getLCFile() in util.cpp), and no file which was modified in the last 
+    // settleSeconds, in which case the step is taken to be completely written
+
+    DIR *dp = opendir(step_dir.c_str());
+    if(dp == NULL){ return false; }
+    
+    bool haveHeader = false;
+    time_t newest = 0;
+    struct dirent *dirp;
+    while((dirp = readdir(dp)) != NULL){
+        string name(dirp->d_name);
+        if(name == "." or name == ".."){ continue; }
+        
+        struct stat fileStat;
+        if(stat((step_dir + name).c_str(), &fileStat) != 0){ continue; }
+        newest = max(newest, fileStat.st_mtime);
+        if(name.find("lc") != string::npos and name.find("#") == string::npos and 
+           name.find("SubInput") == string::npos){ haveHeader = true; }
+    }
+    closedir(dp);
+    return haveHeader and now - newest >= settleSeconds;
+}
+
+
+//======================================================================================
+
+
+bool waitForSteps(string dir_name, const Cutout_options &opts, Step_manifest &manifest, 
+                  int myrank){
+    // For --watch, waits for lightcone steps within [opts.minStep, opts.maxStep] to be 
+    // completely written, and appends them to the manifest (as found by 
+    // buildStepManifest()). Steps already in the manifest, or recorded as done in 
+    // {outDir}/watch_progress.csv by an earlier run, are skipped. A step is taken to 
+    // be complete once its directory holds a header file, and no file in it has been
+    // modified for twice the polling interval. Rank 0 looks for such steps whenever 
+    // inotify reports a change to dir_name, and at least every opts.watchPoll seconds
+    // (which is all that's done if inotify isn't available). Must be called by all ranks.
+    //
+    // Params:
+    // :param dir_name: the path to the lightcone output directory
+    // :param opts: the run options, with the step range, polling interval, and idle 
+    //              timeout
+    // :param manifest: the manifest of steps found so far, to append to
+    // :param myrank: this rank's identifier
+    // :return: true if any steps were appended; false if opts.maxStep is already in the
+    //          manifest, or no step was completed within opts.watchIdle seconds
+    
+    vector<int> ready;
+    if(myrank == 0){
+        vector<string> known(manifest.steps);
+        ifstream progress((opts.outDir + "watch_progress.csv").c_str());
+        string line;
+        while(getline(progress, line)){
+            if(line.size() > 0 and line[0] != '#'){ known.push_back(line.substr(0, line.find(','))); }
+        }
+
+        int inotifyFd = inotify_init1(IN_NONBLOCK);
+        if(inotifyFd >= 0){ inotify_add_watch(inotifyFd, dir_name.c_str(), IN_CREATE | IN_MOVED_TO | IN_MODIFY); }
+        
+        time_t waitStart = time(NULL);
+        while(true){
+            vector<string> subdirs;
+            getLCSubdirs(dir_name, subdirs);
+            vector<string> steps;
+            getLCSteps(opts.maxStep, opts.minStep, dir_name, steps);
+            
+            bool finished = false;
+            string prefix;
+            for(int j = 0; subdirs.size() > 0 and j < subdirs[0].size(); ++j){
+                if(isdigit(subdirs[0][j])){ prefix = subdirs[0].substr(0, j); break; }
+            }
+            for(int k = 0; k < steps.size(); ++k){
+                if(find(known.begin(), known.end(), steps[k]) != known.end()){
+                    if(atoi(steps[k].c_str()) >= opts.maxStep){ finished = true; }
+                    continue;
+                }
+                if(stepWritten(dir_name + prefix + steps[k] + "/", time(NULL), 2*opts.watchPoll)){
+                    ready.push_back(atoi(steps[k].c_str()));
+                }
+            }
+            if(ready.size() > 0 or finished){ break; }
+            if(time(NULL) - waitStart >= opts.watchIdle){
+                cout << "\nNo new step completed in " << opts.watchIdle << " s; done watching" << endl;
+                break;
+            }
+            
+            // wait for a change to the lightcone directory, or the next poll
+            if(inotifyFd >= 0){
+                struct pollfd pfd = {inotifyFd, POLLIN, 0};
+                if(poll(&pfd, 1, opts.watchPoll * 1000) > 0){
+                    char events[4096];
+                    while(read(inotifyFd, events, sizeof(events)) > 0){}
+                }
+            }else{
+                sleep(opts.watchPoll);
+            }
+        }
+        if(inotifyFd >= 0){ close(inotifyFd); }
+        if(ready.size() > 0){ cout << "\nFound " << ready.size() << " newly completed step(s)" << endl; }
+    }
+
+    int numReady = ready.size();
+    MPI_Bcast(&numReady, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    ready.resize(numReady);
+    MPI_Bcast(ready.data(), numReady, MPI_INT, 0, MPI_COMM_WORLD);
+    
+    // find the header file, and the block and element counts, of each new step
+    for(int k = 0; k < numReady; ++k){
+        Step_manifest found;
+        buildStepManifest(dir_name, ready[k], ready[k], opts.manifestFile, found, myrank);
+        manifest.subdirPrefix = found.subdirPrefix;
+        for(int j = 0; j < found.steps.size(); ++j){
+            manifest.steps.push_back(found.steps[j]);
+            manifest.headers.push_back(found.headers[j]);
+            manifest.numBlocks.push_back(found.numBlocks[j]);
+            manifest.numElems.push_back(found.numElems[j]);
+            manifest.headerSize.push_back(found.headerSize[j]);
+            manifest.headerMtime.push_back(found.headerMtime[j]);
+        }
+    }
+    return numReady > 0;
+}
+
+
+//======================================================================================
+
+
+
+
+//////////////////////////////////////////////////////
+//
+//                 run planning
+//
+//////////////////////////////////////////////////////
+
+// assumed per-rank throughputs, in bytes/s, for the phases that the planner can't 
+// measure from its sampled read
+#define PLAN_EXCHANGE_RATE 1.0e9
+#define PLAN_WRITE_RATE 2.5e8
+
+static void estimateHaloCounts(string file_name, const Halo_geometry &geo, float fraction,
+                               int myrank, int numranks, size_t &totalNp, size_t &sampledNp,
+                               double &sampleBytes, double &sampleTime, vector<double> &counts){
+    // Estimates the number of particles from one lightcone step that will fall in each 
+    // target halo's cutout, by reading a sample of the step. The GenericIO blocks of the 
+    // file (one per rank that wrote it) are opened independently, and every 
+    // (1/fraction)-th block is read by one of the ranks in turn, with only x, y, and z 
+    // read. Each sampled particle is then put through the same rough and final cuts as 
+    // in the cutout kernel, and the counts per halo are scaled by the ratio of the total
+    // number of particles in the step (from the block headers alone) to the number sampled.
+    // Must be called by all ranks.
+    //
+    // Params:
+    // :param file_name: the lightcone step header file
+    // :param geo: the halo geometry, as filled by computeHaloGeometry()
+    // :param fraction: the fraction of blocks to read, in (0, 1]
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :param totalNp: to be set to the total number of particles in the step
+    // :param sampledNp: to be set to the total number of particles sampled
+    // :param sampleBytes: to be set to the number of bytes read by this rank
+    // :param sampleTime: to be set to the time spent reading by this rank
+    // :param counts: vector to fill with the estimated number of particles per halo
+    // :return: none
+
+    int numHalos = geo.halo_r.size();
+    vector<particle_pos> sample;
+    totalNp = 0;
+    sampleBytes = 0;
+    
+    double start = MPI_Wtime();
+    {
+        GenericIO GIO(MPI_COMM_SELF, file_name, GenericIO::FileIOPOSIX);
+        GIO.openAndReadHeader(GenericIO::MismatchAllowed, -1, false);
+        int numBlocks = GIO.readNRanks();
+        int stride = max(1, (int)round(1.0/fraction));
+
+        for(int b = 0; b < numBlocks; ++b){
+            size_t Np = GIO.readNumElems(b);
+            totalNp += Np;
+            if(b % stride != 0 or (b/stride) % numranks != myrank or Np == 0){ continue; }
+
+            vector<POSVEL_T> x(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
+            vector<POSVEL_T> y(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
+            vector<POSVEL_T> z(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
+            GIO.clearVariables();
+            GIO.addVariable("x", x, true); 
+            GIO.addVariable("y", y, true); 
+            GIO.addVariable("z", z, true); 
+            GIO.readData(b, false, false);
+            sampleBytes += 3 * Np * sizeof(POSVEL_T);
+
+            for(size_t n = 0; n < Np; ++n){
+                particle_pos p;
+                p.x = x[n]; 
+                p.y = y[n]; 
+                p.z = z[n];
+                toSpherical(x[n], y[n], z[n], p.d, p.theta, p.phi);
+                sample.push_back(p);
+            }
+        }
+    }
+    sampleTime = MPI_Wtime() - start;
+    
+    // count sampled members per halo, as in the cutout kernel
+    sort(sample.begin(), sample.end(), comp_by_theta);
+    vector<double> localCounts(numHalos, 0);
+    
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(int h = 0; h < numHalos; ++h){
+        particle_pos left_dummy;
+        left_dummy.theta = geo.theta_rough[2*h];
+        particle_pos right_dummy;
+        right_dummy.theta = geo.theta_rough[2*h+1];
+        
+        size_t minN = lower_bound(sample.begin(), sample.end(), left_dummy, comp_by_theta) - sample.begin();
+        size_t maxN = upper_bound(sample.begin(), sample.end(), right_dummy, comp_by_theta) - sample.begin();
+        for(size_t n = minN; n < maxN; ++n){
+            if(sample[n].phi <= geo.phi_rough[2*h] or sample[n].phi >= geo.phi_rough[2*h+1]){ continue; }
+            float v_rot[3];
+            float v_theta;
+            float v_phi;
+            if(inHaloCutout(sample[n], &geo.R[9*h], geo.theta_cut, geo.phi_cut, v_rot, v_theta, v_phi)){
+                localCounts[h] += 1;
+            }
+        }
+    }
+
+    size_t localNp = sample.size();
+    MPI_Allreduce(&localNp, &sampledNp, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+    counts.resize(numHalos);
+    MPI_Allreduce(localCounts.data(), counts.data(), numHalos, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    
+    double scale = sampledNp > 0 ? (double)totalNp / sampledNp : 0;
+    for(int h = 0; h < numHalos; ++h){ counts[h] *= scale; }
+}
+
+
+//======================================================================================
+
+
+static void planCutout(const Step_manifest &manifest, const Halo_geometry &geo, 
+                       Column_schema schema, int numDerived, float fraction, string out_dir, 
+                       int myrank, int numranks, vector<double> &haloTotals){
+    // Estimates the cost of a halo cutout run without performing it (see --plan in 
+    // main.cpp). For each step, the particle count is found from the GenericIO headers, 
+    // and the cutout membership per halo is estimated from a sampled read with 
+    // estimateHaloCounts(). From these, the volumes to be read, exchanged, and written 
+    // are printed per step and in total, along with rough phase times and a recommended 
+    // node count. Read times are extrapolated from the sampled read, and the exchange 
+    // and write times assume the per-rank rates PLAN_EXCHANGE_RATE and PLAN_WRITE_RATE.
+    // The node count is the fewest nodes (with as many ranks per node as this run) 
+    // whose combined memory, taking half of each node's physical memory to be usable, 
+    // can hold the largest step in its read, send, and receive buffers at once. 
+    // The estimated member count of every halo, summed over steps, is written by 
+    // rank 0 to out_dir/plan.csv
+    //
+    // Params:
+    // :param manifest: the steps to include, as built by buildStepManifest()
+    // :param geo: the halo geometry, as filled by computeHaloGeometry()
+    // :param schema: the column schema of the run, as built by selectColumns()
+    // :param numDerived: the number of derived columns to be written
+    // :param fraction: the fraction of blocks to read per step
+    // :param out_dir: the top-level output directory
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :param haloTotals: vector to fill with the estimated member count of each halo, 
+    //                    summed over steps
+    // :return: none
+
+    int numHalos = geo.halo_r.size();
+    haloTotals.assign(numHalos, 0);
+
+    // ranks and memory per node of this run
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+    int ranksPerNode;
+    MPI_Comm_size(node_comm, &ranksPerNode);
+    MPI_Comm_free(&node_comm);
+    double nodeMem = (double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+
+    double totRead = 0, totExchange = 0, totWrite = 0;
+    double totReadTime = 0, totExchangeTime = 0, totWriteTime = 0;
+    double maxStepMem = 0;
+    
+    if(myrank == 0){
+        cout << "\n---------- Planning run from a " << fraction*100 << "% sample of each step ----------" << endl;
+        cout << "\nstep, particles, est_members, read_GB, exchange_GB, write_GB, " << 
+                "est_read_s, est_exchange_s, est_write_s" << endl;
+    }
+
+    for(int i = 0; i < manifest.steps.size(); ++i){
+        
+        if(atoi(manifest.steps[i].c_str()) == 499){ continue; }
+        string file_name = manifest.headers[i];
+
+        // bytes per particle in each phase, given the selected columns
+        {
+            GenericIO GIO(MPI_COMM_SELF, file_name, GenericIO::FileIOPOSIX);
+            GIO.openAndReadHeader(GenericIO::MismatchAllowed, -1, false);
+            resolveColumnSchema(GIO, schema, myrank);
+        }
+        double readBytes = 4*sizeof(POSVEL_T) + sizeof(ID_T);
+        for(int c = 0; c < schema.extra.size(); ++c){ readBytes += schema.extra[c].size; }
+        double exchangeBytes = sizeof(particle_pos) + schema.rowSize;
+        double writeBytes = schema.rowSize + 4*numDerived;
+        for(int c = 0; c < NUM_CORE; ++c){ 
+            if(schema.writeCore[c]){ writeBytes += (c == CORE_ID) ? sizeof(ID_T) : sizeof(float); }
+        }
+
+        size_t totalNp, sampledNp;
+        double sampleBytes, sampleTime;
+        vector<double> counts;
+        estimateHaloCounts(file_name, geo, fraction, myrank, numranks, totalNp, sampledNp, 
+                           sampleBytes, sampleTime, counts);
+        
+        double members = 0;
+        for(int h = 0; h < numHalos; ++h){ 
+            haloTotals[h] += counts[h]; 
+            members += counts[h];
+        }
+
+        // per-rank read rate, from the sampled read
+        double rates[2] = {sampleBytes, sampleTime};
+        double totRates[2];
+        MPI_Allreduce(rates, totRates, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        double readRate = totRates[1] > 0 ? totRates[0] / totRates[1] : 0;
+
+        double stepRead = totalNp * readBytes;
+        double stepExchange = totalNp * exchangeBytes * (numranks-1) / numranks;
+        double stepWrite = members * writeBytes;
+        double readTime = readRate > 0 ? stepRead / (readRate * numranks) : 0;
+        double exchangeTime = stepExchange / (PLAN_EXCHANGE_RATE * numranks);
+        double writeTime = stepWrite / (PLAN_WRITE_RATE * numranks);
+        
+        totRead += stepRead;
+        totExchange += stepExchange;
+        totWrite += stepWrite;
+        totReadTime += readTime;
+        totExchangeTime += exchangeTime;
+        totWriteTime += writeTime;
+        maxStepMem = max(maxStepMem, totalNp * (readBytes + 2*exchangeBytes));
+
+        if(myrank == 0){
+            cout << manifest.steps[i] << ", " << totalNp << ", " << (size_t)members << ", " << 
+                    stepRead/1e9 << ", " << stepExchange/1e9 << ", " << stepWrite/1e9 << ", " << 
+                    readTime << ", " << exchangeTime << ", " << writeTime << endl;
+        }
+    }
+
+    int recNodes = (int)ceil(maxStepMem / (0.5 * nodeMem));
+    if(myrank == 0){
+        cout << "\nTotal read: " << totRead/1e9 << " GB (est. " << totReadTime << " s on " << 
+                numranks << " ranks)" << endl;
+        cout << "Total exchange: " << totExchange/1e9 << " GB (est. " << totExchangeTime << " s, assuming " <<
+                PLAN_EXCHANGE_RATE/1e9 << " GB/s per rank)" << endl;
+        cout << "Total write: " << totWrite/1e9 << " GB (est. " << totWriteTime << " s, assuming " <<
+                PLAN_WRITE_RATE/1e9 << " GB/s per rank)" << endl;
+        cout << "Largest step needs ~" << maxStepMem/1e9 << " GB of memory across all ranks; " <<
+                "recommended node count: " << max(1, recNodes) << " (at " << ranksPerNode << 
+                " ranks per node)" << endl;
+
+        ofstream plan_file((out_dir + "plan.csv").c_str());
+        plan_file << "#halo_idx, est_members\n";
+        for(int h = 0; h < numHalos; ++h){ plan_file << h << ", " << (size_t)haloTotals[h] << "\n"; }
+        cout << "Wrote per-halo estimates to " << out_dir << "plan.csv" << endl;
+    }
+}
+
+
+//======================================================================================
+
+
+// the fixed cost of cutting out and writing one halo at one step (creating its output 
+// files and the collective writes), in units of the cost of one member particle
+#define SHARD_HALO_OVERHEAD 2.0e4
+
+static void shardHalos(const vector<string> &halo_tags, const vector<float> &halo_pos, 
+                       const vector<float> &halo_props, const vector<double> &haloMembers,
+                       int numSteps, int numShards, string out_dir, int myrank){
+    // Partitions the target halos into numShards halo files of balanced estimated cost,
+    // to be run as independent jobs. The cost of each halo is its estimated number of 
+    // members over all steps (as found by planCutout()), plus SHARD_HALO_OVERHEAD per 
+    // step. Halos are ordered along the nested HEALPix index of their sky position 
+    // (at nside 8192), which keeps nearby halos together, so that each shard covers a 
+    // compact region of the sky. That ordering is then cut into contiguous pieces at 
+    // the multiples of 1/numShards of the cumulative cost. 
+    //
+    // Each shard is written by rank 0 to out_dir/shard_<k>.txt, in the text halo file 
+    // format read by readHaloFile() (see util.cpp), along with a summary in 
+    // out_dir/shards.csv.
+    //
+    // Params:
+    // :param halo_tags: the tag of each halo, as read from the halo file
+    // :param halo_pos: the halo positions, three components per halo
+    // :param halo_props: the halo properties, three (fof) or six (sod) per halo
+    // :param haloMembers: the estimated member count of each halo over all steps
+    // :param numSteps: the number of steps to be cut out
+    // :param numShards: the number of shards
+    // :param out_dir: the top-level output directory
+    // :param myrank: this rank's identifier
+    // :return: none
+
+    if(myrank != 0){ return; }
+
+    int numHalos = halo_pos.size()/3;
+    int numProps = numHalos > 0 ? halo_props.size() / numHalos : 0;
+    
+    vector<int64_t> pix(numHalos);
+    vector<double> cost(numHalos);
+    double totalCost = 0;
+    for(int h = 0; h < numHalos; ++h){
+        pix[h] = vec2pix_nest(8192, halo_pos[3*h], halo_pos[3*h+1], halo_pos[3*h+2]);
+        cost[h] = haloMembers[h] + SHARD_HALO_OVERHEAD * numSteps;
+        totalCost += cost[h];
+    }
+    vector<int> order(numHalos);
+    std::iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](int a, int b){return pix[a] < pix[b];} );
+
+    ofstream summary_file((out_dir + "shards.csv").c_str());
+    summary_file << "#shard, num_halos, est_cost\n";
+    cout << "\nSharding " << numHalos << " halos into " << numShards << " jobs" << endl;
+    
+    double cumCost = 0;
+    double maxShardCost = 0;
+    int next = 0;
+    for(int k = 0; k < numShards; ++k){
+        
+        ostringstream shard_file_name;
+        shard_file_name << out_dir << "shard_" << k << ".txt";
+        ofstream shard_file(shard_file_name.str().c_str());
+        shard_file << setprecision(9);   // enough to round-trip the float halo properties
+        
+        // take halos until the cumulative cost reaches this shard's boundary, leaving at 
+        // least one halo for each remaining shard
+        double shardCost = 0;
+        int shardHalos = 0;
+        double boundary = totalCost * (k+1) / numShards;
+        while(next < numHalos and (k == numShards-1 or shardHalos == 0 or 
+              (cumCost + cost[order[next]]/2 < boundary and numHalos - next > numShards - k - 1))){
+            
+            int h = order[next++];
+            shard_file << halo_tags[h];
+            for(int i = 0; i < numProps; ++i){ shard_file << " " << halo_props[numProps*h + i]; }
+            for(int i = 0; i < 3; ++i){ shard_file << " " << halo_pos[3*h + i]; }
+            shard_file << "\n";
+
+            cumCost += cost[h];
+            shardCost += cost[h];
+            shardHalos++;
+        }
+        maxShardCost = max(maxShardCost, shardCost);
+        summary_file << k << ", " << shardHalos << ", " << shardCost << "\n";
+    }
+
+    cout << "Wrote shard_0.txt ... shard_" << numShards-1 << ".txt to " << out_dir << endl;
+    cout << "Largest shard cost is " << maxShardCost / (totalCost / numShards) << 
+            "x the mean (see shards.csv)" << endl;
+}
+
+
+//======================================================================================
+
+
+//////////////////////////////////////////////////////
+//
+//                  step cache
+//
+//////////////////////////////////////////////////////
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t h = 14695981039346656037ULL){
+    // The 64-bit FNV-1a hash of size bytes at data, continuing from h
+
+    const unsigned char *bytes = (const unsigned char*)data;
+    for(size_t k = 0; k < size; ++k){
+        h ^= bytes[k];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+
+//======================================================================================
+
+
+static string stepCacheKey(string dir_name, const Step_manifest &manifest, int i, 
+                           const Column_schema &schema, bool needVel, 
+                           const Cutout_options &opts, int numranks, int myrank){
+    // Describes everything that determines the redistributed, sorted particles held 
+    // by this rank for one step of a halo cutout run, other than the halos themselves:
+    // the lightcone step (with its header size and modification time, which are 
+    // current, see buildStepManifest()), the number of ranks, the columns exchanged, 
+    // and any id filter. A step cache entry is only reused if its key matches exactly
+    
+    uint64_t idHash = 0;
+    if(opts.useIdFilter){ 
+        idHash = fnv1a(opts.idFilter.ids.data(), opts.idFilter.ids.size()*sizeof(ID_T)); 
+    }
+
+    ostringstream key;
+    key << "lc_cutout step cache\n";
+    key << "lightcone " << dir_name << "\n";
+    key << "header " << manifest.headers[i] << " " << manifest.headerSize[i] << " " << 
+           manifest.headerMtime[i] << "\n";
+    key << "ranks " << myrank << " " << numranks << " " << sizeof(particle_pos) << "\n";
+    key << "columns";
+    for(int c = 0; c < schema.extra.size(); ++c){ 
+        if(schema.extra[c].exchange){ key << " " << schema.extra[c].name; }
+    }
+    if(needVel){ key << " (v_los)"; }
+    key << "\n";
+    key << "ids " << (opts.useIdFilter ? opts.idFilter.ids.size() : 0) << " " << idHash << "\n";
+    return key.str();
+}
+
+
+//======================================================================================
+
+
+static string stepCacheFile(string cache_dir, const string &key, string step, int myrank){
+    // The file name of this rank's step cache entry with the given key
+    
+    ostringstream file_name;
+    file_name << cache_dir << "lccache_" << hex << fnv1a(key.data(), key.size()) << dec << 
+                 "." << step << "." << myrank << ".bin";
+    return file_name.str();
+}
+
+
+//======================================================================================
+
+
+static bool loadStepCache(string file_name, const string &key, Column_schema &schema, 
+                          vector<particle_pos> &particles, vector<char> &rows){
+    // Loads a step cache entry written by saveStepCache(), if it exists and its key
+    // matches, restoring the column types and row layout of the schema along with
+    // the particles and rows
+    //
+    // Params:
+    // :param file_name: the cache entry, from stepCacheFile()
+    // :param key: the expected key, from stepCacheKey()
+    // :param schema: the schema of the run, to be completed from the entry
+    // :param particles: to be filled with the sorted particles
+    // :param rows: to be filled with the exchanged extra columns of each particle
+    // :return: true if the entry was loaded
+    
+    ifstream cache(file_name.c_str(), ios::in | ios::binary);
+    if(!cache.good()){ return false; }
+
+    uint64_t keySize;
+    cache.read((char*)&keySize, sizeof(keySize));
+    if(!cache.good() or keySize != key.size()){ return false; }
+    string cachedKey(keySize, ' ');
+    cache.read(&cachedKey[0], keySize);
+    if(!cache.good() or cachedKey != key){ return false; }
+
+    int numExtra = schema.extra.size();
+    vector<int> layout(4*numExtra + 1);
+    uint64_t Np;
+    cache.read((char*)layout.data(), layout.size()*sizeof(int));
+    cache.read((char*)&Np, sizeof(Np));
+    if(!cache.good()){ return false; }
+    
+    for(int c = 0; c < numExtra; ++c){
+        schema.extra[c].size = layout[4*c];
+        schema.extra[c].isFloat = layout[4*c+1];
+        schema.extra[c].isSigned = layout[4*c+2];
+        schema.extra[c].rowOffset = layout[4*c+3];
+    }
+    schema.rowSize = layout[4*numExtra];
+
+    particles.resize(Np);
+    rows.resize(Np * schema.rowSize);
+    cache.read((char*)particles.data(), Np*sizeof(particle_pos));
+    cache.read(rows.data(), rows.size());
+    return !cache.fail();
+}
+
+
+//======================================================================================
+
+
+static void saveStepCache(string file_name, const string &key, const Column_schema &schema, 
+                          const vector<particle_pos> &particles, const vector<char> &rows){
+    // Writes this rank's sorted particles for one step to a step cache entry, as read 
+    // by loadStepCache(). The entry is written to a temporary file, and renamed into
+    // place once complete, so that an interrupted job never leaves a partial entry
+
+    int numExtra = schema.extra.size();
+    vector<int> layout(4*numExtra + 1);
+    for(int c = 0; c < numExtra; ++c){
+        layout[4*c] = schema.extra[c].size;
+        layout[4*c+1] = schema.extra[c].isFloat;
+        layout[4*c+2] = schema.extra[c].isSigned;
+        layout[4*c+3] = schema.extra[c].rowOffset;
+    }
+    layout[4*numExtra] = schema.rowSize;
+    uint64_t keySize = key.size();
+    uint64_t Np = particles.size();
+    
+    string tmp_name = file_name + ".tmp";
+    ofstream cache(tmp_name.c_str(), ios::out | ios::binary);
+    cache.write((char*)&keySize, sizeof(keySize));
+    cache.write(key.data(), keySize);
+    cache.write((char*)layout.data(), layout.size()*sizeof(int));
+    cache.write((char*)&Np, sizeof(Np));
+    cache.write((char*)particles.data(), Np*sizeof(particle_pos));
+    cache.write(rows.data(), rows.size());
+    cache.close();
+    
+    if(cache.fail() or rename(tmp_name.c_str(), file_name.c_str()) != 0){
+        cout << "Couldn't write step cache entry " << file_name << endl;
+        remove(tmp_name.c_str());
+    }
+}
+
+
+//======================================================================================
+
+
+//////////////////////////////////////////////////////
+//
+//        lightcone stores and parent cutouts
+//
+//////////////////////////////////////////////////////
+
+static void writeStoreInfo(string file_name, int nside, const Column_schema &schema){
+    // Writes the nside and column types of a lightcone store (see buildLCStore()) as 
+    // text, one column per line, as "column {name} {size} {isFloat} {isSigned}", 
+    // to be read by readInfoFile()
+
+    ofstream info(file_name.c_str());
+    info << "# lc_cutout lightcone store\n";
+    info << "nside " << nside << "\n";
+    const char *posNames[4] = {"x", "y", "z", "a"};
+    for(int k = 0; k < 4; ++k){ info << "column " << posNames[k] << " " << sizeof(POSVEL_T) << " 1 1\n"; }
+    info << "column id " << sizeof(ID_T) << " 0 1\n";
+    for(int c = 0; c < schema.extra.size(); ++c){
+        const Column_info &col = schema.extra[c];
+        info << "column " << col.name << " " << col.size << " " << col.isFloat << " " << 
+                col.isSigned << "\n";
+    }
+}
+
+
+//======================================================================================
+
+
+static void writeCutoutInfo(string file_name, const vector<float> &theta_cut, 
+                            const vector<float> &phi_cut, const Column_schema &schema){
+    // Writes the angular bounds (in arcsec) and column types of a cutout made with 
+    // custom theta-phi bounds (use case 1), in the format of writeStoreInfo(), so that
+    // halo cutouts can later be cut from it (see --fromCutout in main.cpp). The columns
+    // are those written, as given by the completed column schema of the cutout
+
+    ofstream info(file_name.c_str());
+    info << "# lc_cutout cutout, first octant only, bounds in arcsec\n";
+    info << "theta " << theta_cut[0] << " " << theta_cut[1] << "\n";
+    info << "phi " << phi_cut[0] << " " << phi_cut[1] << "\n";
+    for(int c = 0; c < NUM_CORE; ++c){
+        if(!schema.writeCore[c]){ continue; }
+        if(c == CORE_ID){ info << "column id " << sizeof(ID_T) << " 0 1\n"; }
+        else{ info << "column " << coreColumnName(c) << " " << sizeof(POSVEL_T) << " 1 1\n"; }
+    }
+    for(int c = 0; c < schema.extra.size(); ++c){
+        const Column_info &col = schema.extra[c];
+        info << "column " << col.name << " " << col.size << " " << col.isFloat << " " << 
+                col.isSigned << "\n";
+    }
+}
+
+
+//======================================================================================
+
+
+static void readInfoFile(string file_name, vector<Column_info> &columns, 
+                         map<string, vector<double> > &values){
+    // Reads the description of a lightcone store or cutout, as written by 
+    // writeStoreInfo() or writeCutoutInfo(). Lines "column {name} {size} {isFloat} 
+    // {isSigned}" give the columns present, and any other line "{key} {values...}" is
+    // returned in values, by key. Aborts if the file can't be read
+
+    ifstream info(file_name.c_str());
+    if(!info.good()){
+        cout << "\nCan't read " << file_name << endl;
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    
+    columns.clear();
+    values.clear();
+    string line;
+    while(getline(info, line)){
+        istringstream fields(line);
+        string key;
+        if(!(fields >> key) or key[0] == '#'){ continue; }
+        if(key == "column"){
+            Column_info col;
+            fields >> col.name >> col.size >> col.isFloat >> col.isSigned;
+            col.exchange = true;
+            col.rowOffset = 0;
+            columns.push_back(col);
+        }else{
+            double value;
+            while(fields >> value){ values[key].push_back(value); }
+        }
+    }
+}
+
+
+//======================================================================================
+
+
+static void readStoreColumn(string file_name, int size, const vector<int64_t> &runStart, 
+                            const vector<int64_t> &runEnd, char *dst){
+    // Reads runs of elements, each of size bytes, from one column file of a lightcone 
+    // store or cutout with pread(), one read per run, to consecutive positions at dst. Aborts if
+    // the file can't be read
+
+    int fd = open(file_name.c_str(), O_RDONLY);
+    bool ok = (fd >= 0);
+    for(int k = 0; ok and k < runStart.size(); ++k){
+        size_t left = (size_t)(runEnd[k] - runStart[k]) * size;
+        off_t pos = (off_t)runStart[k] * size;
+        while(ok and left > 0){
+            ssize_t got = pread(fd, dst, left, pos);
+            ok = (got > 0);
+            if(ok){
+                dst += got;
+                pos += got;
+                left -= got;
+            }
+        }
+    }
+    if(fd >= 0){ close(fd); }
+    if(!ok){
+        cout << "\nCan't read lightcone store column " << file_name << endl;
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+}
+
+
+//======================================================================================
+
+
+static void readStoreStep(string store_subdir, int step, const Column_schema &schema, 
+                          const vector<int64_t> &tiles, int myrank, int numranks, 
+                          Buffers_read &r, size_t &Np){
+    // Reads this rank's share of the given tiles of one step of a lightcone store (see 
+    // buildLCStore()), such as those intersecting the cutout footprints. Rank 0 looks 
+    // up where each tile begins and ends in the tile index, and the tiles are dealt out
+    // to the ranks in contiguous runs of about equal particle counts, so that the ranks 
+    // are balanced without any exchange. Each rank then reads its runs of each column,
+    // with adjacent tiles read together. Only the core (x, y, z, a, id) and extra 
+    // columns are filled. Must be called by all ranks.
+    //
+    // Params:
+    // :param store_subdir: the store directory of the step
+    // :param step: the lightcone step
+    // :param schema: the column schema of the run, as completed from the store info
+    // :param tiles: the tiles to read, in ascending order
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :param r: the read buffers to fill
+    // :param Np: to be set to the number of particles read
+    // :return: none
+
+    int numTiles = tiles.size();
+    ostringstream file_name_suffix;
+    file_name_suffix << "." << step << ".bin";
+    string suf = file_name_suffix.str();
+    
+    // [begin, end) particle offsets of each tile
+    vector<int64_t> bounds(2*numTiles);
+    if(myrank == 0){
+        string index_name = store_subdir + "tiles" + suf;
+        int fd = open(index_name.c_str(), O_RDONLY);
+        bool ok = (fd >= 0);
+        for(int k = 0; ok and k < numTiles; ++k){
+            ok = pread(fd, &bounds[2*k], 2*sizeof(int64_t), tiles[k]*sizeof(int64_t)) == 2*sizeof(int64_t);
+        }
+        if(fd >= 0){ close(fd); }
+        if(!ok){
+            cout << "\nCan't read lightcone store tile index " << index_name << endl;
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+    }
+    MPI_Bcast(bounds.data(), 2*numTiles, MPI_INT64_T, 0, MPI_COMM_WORLD);
+
+    // a tile goes to the rank whose even share of the particles contains its first one
+    int64_t total = 0;
+    for(int k = 0; k < numTiles; ++k){ total += bounds[2*k+1] - bounds[2*k]; }
+    int64_t shareBegin = total * myrank / numranks;
+    int64_t shareEnd = total * (myrank+1) / numranks;
+    
+    vector<int64_t> runStart;
+    vector<int64_t> runEnd;
+    int64_t passed = 0;
+    Np = 0;
+    for(int k = 0; k < numTiles; ++k){
+        int64_t tileNp = bounds[2*k+1] - bounds[2*k];
+        if(tileNp > 0 and passed >= shareBegin and passed < shareEnd){
+            if(runEnd.size() > 0 and runEnd.back() == bounds[2*k]){ runEnd.back() = bounds[2*k+1]; }
+            else{
+                runStart.push_back(bounds[2*k]);
+                runEnd.push_back(bounds[2*k+1]);
+            }
+            Np += tileNp;
+        }
+        passed += tileNp;
+    }
+
+    int numExtra = schema.extra.size();
+    r.x.resize(Np);
+    r.y.resize(Np);
+    r.z.resize(Np);
+    r.a.resize(Np);
+    r.id.resize(Np);
+    r.extra.resize(numExtra);
+    readStoreColumn(store_subdir + "x" + suf, sizeof(POSVEL_T), runStart, runEnd, (char*)r.x.data());
+    readStoreColumn(store_subdir + "y" + suf, sizeof(POSVEL_T), runStart, runEnd, (char*)r.y.data());
+    readStoreColumn(store_subdir + "z" + suf, sizeof(POSVEL_T), runStart, runEnd, (char*)r.z.data());
+    readStoreColumn(store_subdir + "a" + suf, sizeof(POSVEL_T), runStart, runEnd, (char*)r.a.data());
+    readStoreColumn(store_subdir + "id" + suf, sizeof(ID_T), runStart, runEnd, (char*)r.id.data());
+    for(int c = 0; c < numExtra; ++c){
+        const Column_info &col = schema.extra[c];
+        r.extra[c].resize(Np*col.size);
+        readStoreColumn(store_subdir + col.name + suf, col.size, runStart, runEnd, r.extra[c].data());
+    }
+}
+
+
+//======================================================================================
+
+
+static void readCutoutStep(string cutout_subdir, int step, const Column_schema &schema, 
+                           int myrank, int numranks, Buffers_read &r, size_t &Np){
+    // Reads this rank's even share of one step of a cutout made with custom theta-phi 
+    // bounds (see writeCutoutInfo()), to be cut again. Each rank reads a contiguous 
+    // range of each column file, so that the ranks are balanced without any exchange. 
+    // The scale factor is recovered from the redshift column. Only the core (x, y, z, 
+    // a, id) and extra columns are filled. 
+    //
+    // Params:
+    // :param cutout_subdir: the cutout directory of the step
+    // :param step: the lightcone step
+    // :param schema: the column schema of the run, as completed from the cutout info
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :param r: the read buffers to fill
+    // :param Np: to be set to the number of particles read
+    // :return: none
+
+    ostringstream file_name_suffix;
+    file_name_suffix << "." << step << ".bin";
+    string suf = file_name_suffix.str();
+    
+    struct stat st;
+    if(stat((cutout_subdir + "x" + suf).c_str(), &st) != 0){
+        if(myrank == 0){ cout << "\nCan't find cutout " << cutout_subdir << "x" << suf << endl; }
+        MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    int64_t total = st.st_size / sizeof(POSVEL_T);
+    vector<int64_t> runStart(1, total * myrank / numranks);
+    vector<int64_t> runEnd(1, total * (myrank+1) / numranks);
+    Np = runEnd[0] - runStart[0];
+    
+    int numExtra = schema.extra.size();
+    r.x.resize(Np);
+    r.y.resize(Np);
+    r.z.resize(Np);
+    r.a.resize(Np);
+    r.id.resize(Np);
+    r.extra.resize(numExtra);
+    readStoreColumn(cutout_subdir + "x" + suf, sizeof(POSVEL_T), runStart, runEnd, (char*)r.x.data());
+    readStoreColumn(cutout_subdir + "y" + suf, sizeof(POSVEL_T), runStart, runEnd, (char*)r.y.data());
+    readStoreColumn(cutout_subdir + "z" + suf, sizeof(POSVEL_T), runStart, runEnd, (char*)r.z.data());
+    readStoreColumn(cutout_subdir + "redshift" + suf, sizeof(POSVEL_T), runStart, runEnd, (char*)r.a.data());
+    readStoreColumn(cutout_subdir + "id" + suf, sizeof(ID_T), runStart, runEnd, (char*)r.id.data());
+    for(size_t n = 0; n < Np; ++n){ r.a[n] = 1.0 / (1.0 + r.a[n]); }
+    for(int c = 0; c < numExtra; ++c){
+        const Column_info &col = schema.extra[c];
+        r.extra[c].resize(Np*col.size);
+        readStoreColumn(cutout_subdir + col.name + suf, col.size, runStart, runEnd, r.extra[c].data());
+    }
+}
+
+
+//======================================================================================
+
+
+void buildLCStore(vector<string> step_strings, int myrank, int numranks, bool verbose, 
+                  bool timeit, bool overwrite, bool positionOnly, const Cutout_options &opts){
+    // Converts each step of the lightcone into a sky-tiled columnar store, from which 
+    // halo cutouts can later be served (see --fromStore in main.cpp) by reading only the
+    // tiles which intersect their footprints, rather than reading, redistributing, and 
+    // sorting every step in every run. The tiles are the nested HEALPix pixels at nside
+    // opts.storeNside. The particles of each step are written to 
+    // {outDir}/{prefix}Store{step}/ in tile order, and in ascending theta within each 
+    // tile, as one file per column ({column}.{step}.bin), along with a tile index, 
+    // tiles.{step}.bin, of 12*nside^2+1 int64 particle offsets, at which each tile 
+    // begins (and the last one ends). The nside and column types are written to 
+    // {outDir}/store.txt. The columns stored are x, y, z, a, and id, plus those selected
+    // as for a cutout (see selectColumns() in util.cpp). The tiles are dealt out to the
+    // ranks in contiguous ranges of balanced particle counts, as found from a histogram
+    // of the particles over coarse tiles (of nside at most STORE_BALANCE_NSIDE), so that 
+    // partial-sky lightcones are spread over all ranks, and each rank only holds the 
+    // tile counts of its own range.
+    //
+    // Params:
+    // :param step_strings: the steps to store
+    // :param myrank: this rank's identifier
+    // :param numranks: the number of ranks
+    // :param verbose: whether or not to print extra verbose output
+    // :param timeit: whether or not to print timing
+    // :param overwrite: whether or not to overwrite existing store steps
+    // :param positionOnly: whether or not --posOnly was passed
+    // :param opts: the run options, with the step manifest and storeNside
+    // :return: none
+
+    const Step_manifest &manifest = opts.manifest;
+    int nside = opts.storeNside;
+    int64_t numTiles = 12*(int64_t)nside*nside;
+    
+    Column_schema schema;
+    selectColumns(opts.columns, positionOnly, false, schema);
+    int numExtra = schema.extra.size();
+    MPI_Datatype particles_mpi_pos = createParticles_pos();
+    
+    unsigned Method = GenericIO::FileIOPOSIX;
+    const char *EnvStr = getenv("GENERICIO_USE_MPIIO");
+    if(EnvStr && string(EnvStr) == "1"){
+        Method = GenericIO::FileIOMPI;  
+    }
+    
+    double start;
+    double stop;
+
+    for(int i = 0; i < step_strings.size(); ++i){
+        
+        int step = atoi(step_strings[i].c_str());
+        if(step == 499){ continue; }
+        if(myrank == 0){
+            cout << "\n=================================================" << endl;
+            cout << "============== Storing step "<< step_strings[i] <<" ==============\n" << endl; 
+        }
+        
+        int error = 0;
+        ostringstream step_subdir;
+        step_subdir << opts.outDir << manifest.subdirPrefix << "Store" << step_strings[i];
+        if(myrank == 0){ 
+            error = prepStepSubdir(step_subdir.str(), overwrite, true, verbose);
+        }
+        MPI_Bcast(&error, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if(error == 1){ 
+            MPI_Finalize();
+            exit(EXIT_FAILURE);
+        }
+        else if(error == 2){ continue; }
+        
+        MPI_Barrier(MPI_COMM_WORLD);
+        start = MPI_Wtime();
+        
+        Buffers_read r;
+        size_t Np = 0;
+        readGIOStep(MPI_COMM_WORLD, manifest.headers[i], Method, schema, myrank, r, Np);
+        
+        // tiles are dealt out to the ranks in contiguous ranges, so that the ranks 
+        // hold consecutive segments of the store. The ranges are balanced by the number
+        // of particles in each coarse tile, over all ranks (in the nested scheme, each 
+        // coarse tile is a contiguous range of tilesPerCoarse tiles)
+        int coarseNside = min(nside, STORE_BALANCE_NSIDE);
+        int64_t numCoarse = 12*(int64_t)coarseNside*coarseNside;
+        int64_t tilesPerCoarse = numTiles / numCoarse;
+        
+        vector<int64_t> readPix(Np);
+        vector<int64_t> coarseCount(numCoarse, 0);
+        #pragma omp parallel for schedule(static)
+        for(size_t n = 0; n < Np; ++n){ readPix[n] = vec2pix_nest(nside, r.x[n], r.y[n], r.z[n]); }
+        for(size_t n = 0; n < Np; ++n){ coarseCount[readPix[n] / tilesPerCoarse]++; }
+        MPI_Allreduce(MPI_IN_PLACE, coarseCount.data(), numCoarse, MPI_INT64_T, MPI_SUM, 
+                      MPI_COMM_WORLD);
+        
+        // each coarse tile goes to the rank whose share of the particles holds its middle
+        int64_t totalCount = max(accumulate(coarseCount.begin(), coarseCount.end(), (int64_t)0), 
+                                 (int64_t)1);
+        vector<int> coarseRank(numCoarse);
+        int64_t tileStart = -1;
+        int64_t tileEnd = 0;
+        int64_t before = 0;
+        for(int64_t c = 0; c < numCoarse; ++c){
+            coarseRank[c] = min((int64_t)numranks-1, 
+                                (before + coarseCount[c]/2) * numranks / totalCount);
+            before += coarseCount[c];
+            if(coarseRank[c] == myrank){
+                if(tileStart < 0){ tileStart = c * tilesPerCoarse; }
+                tileEnd = (c+1) * tilesPerCoarse;
+            }
+        }
+        if(tileStart < 0){
+            // no tiles for this rank; its (empty) range sits before the next rank's
+            int64_t c = upper_bound(coarseRank.begin(), coarseRank.end(), myrank) - coarseRank.begin();
+            tileStart = tileEnd = c * tilesPerCoarse;
+        }
+        vector<int64_t>().swap(coarseCount);
+        
+        vector<int> tileRank(Np);
+        vector<int> send_count;
+        vector<int> recv_count(numranks);
+        vector<int> send_offset;
+        vector<int> recv_offset(numranks, 0);
+        vector<int> slots;
+        #pragma omp parallel for schedule(static)
+        for(size_t n = 0; n < Np; ++n){ tileRank[n] = coarseRank[readPix[n] / tilesPerCoarse]; }
+        vector<int64_t>().swap(readPix);
+        exchangeSlots(tileRank, numranks, send_count, send_offset, slots);
+        MPI_Alltoall(&send_count[0], 1, MPI_INT, &recv_count[0], 1, MPI_INT, MPI_COMM_WORLD);
+        for(int ri = 1; ri < numranks; ++ri){
+            recv_offset[ri] = recv_offset[ri-1] + recv_count[ri-1];
+        }
+
+        // pack and exchange, as in the redistribution of processLC()
+        vector<particle_pos> send_particles_pos(Np);
+        vector<char> send_rows(Np * schema.rowSize);
+        #pragma omp parallel for schedule(static)
+        for(size_t n = 0; n < Np; ++n){
+            int slot = slots[n];
+            particle_pos p = {r.x[n], r.y[n], r.z[n], 0, 0, 0, r.a[n], r.id[n], tileRank[n], 0};
+            toSpherical(p.x, p.y, p.z, p.d, p.theta, p.phi);
+            send_particles_pos[slot] = p;
+            for(int c = 0; c < numExtra; ++c){
+                const Column_info &col = schema.extra[c];
+                memcpy(&send_rows[(size_t)slot*schema.rowSize + col.rowOffset], 
+                       &r.extra[c][n*col.size], col.size);
+            }
+        }
+        r = Buffers_read();
+        vector<int>().swap(tileRank);
+
+        Np = recv_offset.back() + recv_count.back();
+        vector<particle_pos> recv_particles_pos(Np);
+        vector<char> recv_rows(Np * schema.rowSize);
+        MPI_Alltoallv(&send_particles_pos[0], &send_count[0], &send_offset[0], particles_mpi_pos,
+                      &recv_particles_pos[0], &recv_count[0], &recv_offset[0], particles_mpi_pos, 
+                      MPI_COMM_WORLD);
+        if(schema.rowSize > 0){
+            MPI_Datatype particles_mpi_row = createParticles_row(schema.rowSize);
+            MPI_Alltoallv(send_rows.data(), &send_count[0], &send_offset[0], particles_mpi_row,
+                          recv_rows.data(), &recv_count[0], &recv_offset[0], particles_mpi_row, 
+                          MPI_COMM_WORLD);
+            MPI_Type_free(&particles_mpi_row);
+        }
+        vector<particle_pos>().swap(send_particles_pos);
+        vector<char>().swap(send_rows);
+
+        // order by tile, then theta
+        vector<int64_t> pix(Np);
+        vector<int64_t> tileCount(tileEnd - tileStart, 0);
+        for(size_t n = 0; n < Np; ++n){
+            pix[n] = vec2pix_nest(nside, recv_particles_pos[n].x, recv_particles_pos[n].y, 
+                                  recv_particles_pos[n].z);
+            tileCount[pix[n] - tileStart]++;
+        }
+        vector<int> order(Np);
+        std::iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](int n, int m){
+            return pix[n] < pix[m] or 
+                   (pix[n] == pix[m] and recv_particles_pos[n].theta < recv_particles_pos[m].theta); });
+        
+        // write the columns, each rank at the offset of its first tile
+        int64_t rankOffset = 0;
+        int64_t myNp = Np;
+        MPI_Exscan(&myNp, &rankOffset, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+        if(myrank == 0){ rankOffset = 0; }
+        
+        string pre = step_subdir.str() + "/";
+        ostringstream file_name_suffix;
+        file_name_suffix << "." << step << ".bin";
+        string suf = file_name_suffix.str();
+
+        const char *posNames[4] = {"x", "y", "z", "a"};
+        vector<POSVEL_T> posCol(Np);
+        for(int k = 0; k < 4; ++k){
+            for(size_t n = 0; n < Np; ++n){
+                const particle_pos &p = recv_particles_pos[order[n]];
+                posCol[n] = (k == 0) ? p.x : (k == 1) ? p.y : (k == 2) ? p.z : p.a;
+            }
+            writeColumn(pre + posNames[k] + suf, posCol.data(), Np, MPI_FLOAT, 
+                        sizeof(POSVEL_T) * rankOffset);
+        }
+        vector<POSVEL_T>().swap(posCol);
+        
+        vector<ID_T> idCol(Np);
+        for(size_t n = 0; n < Np; ++n){ idCol[n] = recv_particles_pos[order[n]].id; }
+        writeColumn(pre + "id" + suf, idCol.data(), Np, MPI_INT64_T, sizeof(ID_T) * rankOffset);
+        vector<ID_T>().swap(idCol);
+        
+        for(int c = 0; c < numExtra; ++c){
+            const Column_info &col = schema.extra[c];
+            vector<char> extraCol(Np * col.size);
+            for(size_t n = 0; n < Np; ++n){
+                memcpy(&extraCol[n*col.size], 
+                       &recv_rows[(size_t)order[n]*schema.rowSize + col.rowOffset], col.size);
+            }
+            writeColumn(pre + col.name + suf, extraCol.data(), extraCol.size(), MPI_BYTE, 
+                        (MPI_Offset)col.size * rankOffset);
+        }
+
+        // the tile index, of which each rank writes the offsets of its own tiles (and 
+        // the last rank, the end of the last tile)
+        bool lastRank = (myrank == numranks-1);
+        vector<int64_t> tileOffset(tileCount.size() + (lastRank ? 1 : 0));
+        int64_t offset = rankOffset;
+        int64_t numOccupied[2] = {0, (int64_t)Np};
+        for(size_t t = 0; t < tileCount.size(); ++t){
+            tileOffset[t] = offset;
+            offset += tileCount[t];
+            if(tileCount[t] > 0){ numOccupied[0]++; }
+        }
+        if(lastRank){ tileOffset.back() = offset; }
+        writeColumn(pre + "tiles" + suf, tileOffset.data(), tileOffset.size(), MPI_INT64_T, 
+                    sizeof(int64_t) * tileStart);
+        
+        int64_t totalOccupied[2];
+        MPI_Reduce(numOccupied, totalOccupied, 2, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        if(myrank == 0){
+            writeStoreInfo(opts.outDir + "store.txt", nside, schema);
+            cout << "Stored " << totalOccupied[1] << " particles in " << totalOccupied[0] << 
+                    " non-empty tiles" << endl;
+        }
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        stop = MPI_Wtime();
+        if(myrank == 0 and timeit == true){ cout << "Store time: " << stop - start << " s" << endl; }
+    }
+    MPI_Type_free(&particles_mpi_pos);
+}
+
+
+//======================================================================================
+
+
 //////////////////////////////////////////////////////
 //
 //                Cutout function
@@ -14,7 +2563,8 @@ using namespace gio;
 
 void processLC(string dir_name, string out_dir, vector<string> step_strings, 
                vector<float> theta_cut, vector<float> phi_cut, int myrank, int numranks,
-               bool verbose, bool timeit, bool overwrite, bool positionOnly){
+               bool verbose, bool timeit, bool overwrite, bool positionOnly,
+               const Cutout_options &opts){
 
     ///////////////////////////////////////////////////////////////
     //
@@ -22,35 +2572,16 @@ void processLC(string dir_name, string out_dir, vector<string> step_strings,
     //
     ///////////////////////////////////////////////////////////////
 
-    // find all lc sub directories for each step in step_strings
-    string subdirPrefix;
-    int prefixSize;
-    if(myrank == 0){ 
-        cout << "\nReading directory: " << dir_name << endl;
-        
-        vector<string> subdirs;
-        getLCSubdirs(dir_name, subdirs);
-        
-        cout << "Found subdirs:" << endl;
-        for (vector<string>::const_iterator i = subdirs.begin(); i != subdirs.end(); ++i){
-            cout << *i << ' ';
-        }
-        cout << endl;
-
-        // find the prefix (chars before the step number) in the subdirectory names.
-        // It is assumed that all subdirs have the same prefix.
-        for(string::size_type j = 0; j < subdirs[0].size(); ++j){
-            if( isdigit(subdirs[0][j]) > 0){
-                subdirPrefix = subdirs[0].substr(0, j);
-                break;
-            }
-        }
-        cout << "Subdir prefix is: " << subdirPrefix << endl;
-        prefixSize = subdirPrefix.size();
-    }
-    MPI_Bcast(&prefixSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    if(myrank != 0){ subdirPrefix.resize(prefixSize); }
-    MPI_Bcast(const_cast<char*>(subdirPrefix.data()), prefixSize, MPI_CHAR, 0, MPI_COMM_WORLD);
+    // the step subdirectories and header files were found once, in main.cpp
+    const Step_manifest &manifest = opts.manifest;
+    string subdirPrefix = manifest.subdirPrefix;
+    
+    // the columns to be read and written, as for a halo cutout (see selectColumns() in
+    // util.cpp). Their types are completed from the header of each step as it's read
+    Column_schema schema;
+    selectColumns(opts.columns, positionOnly, false, schema);
+    int numExtra = schema.extra.size();
+    bool infoWritten = false;
 
     ///////////////////////////////////////////////////////////////
     //
@@ -76,19 +2607,8 @@ void processLC(string dir_name, string out_dir, vector<string> step_strings,
         if(myrank == 0){
             cout<< "\n---------- Working on step "<< step_strings[i] <<"----------" << endl; 
         }
-        string file_name;
-        int fname_size;
         ostringstream file_name_stream;
-        file_name_stream << dir_name << subdirPrefix << step_strings[i]; 
-        if(myrank == 0){
-            getLCFile(file_name_stream.str(), file_name);
-            fname_size = file_name.size();
-        } 
-        
-        MPI_Bcast(&fname_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
-        if(myrank != 0){ file_name.resize(fname_size); }
-        MPI_Bcast(const_cast<char*>(file_name.data()), fname_size, MPI_CHAR, 0, MPI_COMM_WORLD);
-        file_name_stream << "/" << file_name; 
+        file_name_stream << manifest.headers[i]; 
 
         // setup gio
         size_t Np = 0;
@@ -98,58 +2618,29 @@ void processLC(string dir_name, string out_dir, vector<string> step_strings,
             Method = GenericIO::FileIOMPI;  
         }
 
-        // create gio reader, open lightcone file header in new scope
-        {
-            if(myrank == 0){ cout << "Opening file: " << file_name_stream.str() << endl; }
-            GenericIO GIO(MPI_COMM_WORLD, file_name_stream.str(), Method);
-            GIO.openAndReadHeader(GenericIO::MismatchRedistribute);
+        if(myrank == 0){ cout << "Opening file: " << file_name_stream.str() << endl; }
+        readGIOStep(MPI_COMM_WORLD, file_name_stream.str(), Method, schema, myrank, r, Np);
+        if(myrank == 0){
+            cout << "Number of elements in lc step at rank " << myrank << ": " << Np << endl; 
+        }
 
-            MPI_Barrier(MPI_COMM_WORLD);
-            Np = GIO.readNumElems();
-            if(myrank == 0){
-                cout << "Number of elements in lc step at rank " << myrank << ": " << 
-                Np << endl; 
-            }
-
-            // resize buffers   
-            r.x.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.y.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.z.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.vx.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.vy.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.vz.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.a.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.id.resize(Np + GIO.requestedExtraSpace()/sizeof(ID_T));
-            r.rotation.resize(Np + GIO.requestedExtraSpace()/sizeof(int));
-            r.replication.resize(Np + GIO.requestedExtraSpace()/sizeof(int32_t));
-
-            // do reading
-            GIO.addVariable("x", r.x, true); 
-            GIO.addVariable("y", r.y, true); 
-            GIO.addVariable("z", r.z, true); 
-            GIO.addVariable("vx", r.vx, true); 
-            GIO.addVariable("vy", r.vy, true); 
-            GIO.addVariable("vz", r.vz, true); 
-            GIO.addVariable("a", r.a, true); 
-            GIO.addVariable("id", r.id, true); 
-            GIO.addVariable("rotation", r.rotation, true); 
-            GIO.addVariable("replication", r.replication, true);
-
-            GIO.readData(); 
-        }
-
-        // resize again to remove reader extra space
-        r.x.resize(Np);
-        r.y.resize(Np);
-        r.z.resize(Np);
-        r.vx.resize(Np);
-        r.vy.resize(Np);
-        r.vz.resize(Np);
-        r.a.resize(Np);
-        r.id.resize(Np);
-        r.rotation.resize(Np);
-        r.replication.resize(Np);
-        if(myrank == 0){ cout<<"done resizing"<<endl; }
+        // record the bounds and columns of the cutout, so that it can be cut again
+        if(myrank == 0 and !infoWritten){ 
+            writeCutoutInfo(out_dir + "cutout.txt", theta_cut, phi_cut, schema); 
+        }
+        infoWritten = true;
+
+        // bin the full step into a HEALPix count map, if requested
+        if(opts.healpixNside > 0){
+            vector<int64_t> countMap;
+            accumulateCountMap(r.x, r.y, r.z, Np, opts.healpixNside, countMap);
+            writeCountMap(opts.outDir, step, opts.healpixNside, countMap, myrank);
+        }
+
+        // restrict to the requested particle ids, if any
+        if(opts.useIdFilter){
+            Np = filterReadBuffers(r, Np, opts.idFilter);
+        }
 
         ///////////////////////////////////////////////////////////////
         //
@@ -183,88 +2674,6 @@ void processLC(string dir_name, string out_dir, vector<string> step_strings,
             if(myrank == 0){ cout << "Created subdir: " << step_subdir.str() << endl; }
         }
 
-        // create binary files for cutout output
-        MPI_File id_file;
-        MPI_File redshift_file;
-        MPI_File x_file;
-        MPI_File y_file;
-        MPI_File z_file;
-        MPI_File vx_file;
-        MPI_File vy_file;
-        MPI_File vz_file;
-        MPI_File rotation_file;
-        MPI_File replication_file;
-        MPI_File theta_file;
-        MPI_File phi_file;
-
-        MPI_Request id_req;
-        MPI_Request redshift_req;
-        MPI_Request x_req;
-        MPI_Request y_req;
-        MPI_Request z_req;
-        MPI_Request vx_req;
-        MPI_Request vy_req;
-        MPI_Request vz_req;
-        MPI_Request rotation_req;
-        MPI_Request replication_req;
-        MPI_Request theta_req;
-        MPI_Request phi_req;
-        
-        ostringstream id_file_name;
-        ostringstream redshift_file_name;
-        ostringstream x_file_name;
-        ostringstream y_file_name;
-        ostringstream z_file_name;
-        ostringstream vx_file_name;
-        ostringstream vy_file_name;
-        ostringstream vz_file_name;
-        ostringstream rotation_file_name;
-        ostringstream replication_file_name;
-        ostringstream theta_file_name;
-        ostringstream phi_file_name; 
-
-        id_file_name << step_subdir.str() << "/id." << step << ".bin";
-        redshift_file_name << step_subdir.str() << "/redshift." << step << ".bin";
-        x_file_name << step_subdir.str() << "/x."<< step <<".bin";
-        y_file_name << step_subdir.str() << "/y."<< step <<".bin";
-        z_file_name << step_subdir.str() << "/z."<< step <<".bin";
-        vx_file_name << step_subdir.str() << "/vx."<< step <<".bin";
-        vy_file_name << step_subdir.str() << "/vy."<< step <<".bin";
-        vz_file_name << step_subdir.str() << "/vz."<< step <<".bin";
-        rotation_file_name << step_subdir.str() << "/rotation."<< step <<".bin";
-        replication_file_name << step_subdir.str() << "/replication."<< step <<".bin";
-        theta_file_name << step_subdir.str() << "/theta." << step << ".bin";
-        phi_file_name << step_subdir.str() << "/phi." << step << ".bin";
-
-        if(myrank == 0){ cout<<"starting to open files"<<endl; }
-
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(id_file_name.str().c_str()), 
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &id_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(x_file_name.str().c_str()), 
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &x_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(y_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &y_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(z_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &z_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(vx_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &vx_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(vy_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &vy_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(vz_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &vz_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(redshift_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &redshift_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(rotation_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &rotation_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(replication_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &replication_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(theta_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &theta_file);
-        MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(phi_file_name.str().c_str()),
-                MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &phi_file);
-        
-        if(myrank == 0){ cout<<"done opening files"<<endl; }
-
         ///////////////////////////////////////////////////////////////
         //
         //                         Do cutting
@@ -273,41 +2682,58 @@ void processLC(string dir_name, string out_dir, vector<string> step_strings,
 
         if(myrank == 0){ cout << "Converting positions..." << endl; }
 
+        vector<int> sel;
         for (int n=0; n<Np; ++n) {
 
             // limit cutout to first octant for speed
             if (r.x[n] > 0.0 && r.y[n] > 0.0 && r.z[n] > 0.0){
 
                 // spherical coordinate transformation
-                float d = (float)sqrt(r.x[n]*r.x[n] + r.y[n]*r.y[n] + r.z[n]*r.z[n]);
-                float theta = acos(r.z[n]/d) * 180.0 / PI * ARCSEC;
-                float phi = atan(r.y[n]/r.x[n]) * 180.0 / PI * ARCSEC;
+                POSVEL_T dist;
+                float theta;
+                float phi;
+                toSpherical(r.x[n], r.y[n], r.z[n], dist, theta, phi);
 
-                // do cut and write
+                // do cut
                 if (theta > theta_cut[0] && theta < theta_cut[1] && 
                         phi > phi_cut[0] && phi < phi_cut[1] ) {
-
-                    // get redshift from scale factor
-                    float zz = aToZ(r.a[n]);  
-
-                    // spherical corrdinate transform of positions
-                    w.theta.push_back(theta);
-                    w.phi.push_back(phi);
-
-                    // other columns
-                    w.x.push_back(r.x[n]);
-                    w.y.push_back(r.y[n]);
-                    w.z.push_back(r.z[n]);
-                    w.vx.push_back(r.vx[n]);
-                    w.vy.push_back(r.vy[n]);
-                    w.vz.push_back(r.vz[n]);
-                    w.redshift.push_back(zz);
-                    w.id.push_back(r.id[n]);
-                    w.rotation.push_back(r.rotation[n]);
-                    w.replication.push_back(r.replication[n]);
+                    sel.push_back(n);
+                    if(schema.writeCore[CORE_THETA]){ w.theta.push_back(theta); }
+                    if(schema.writeCore[CORE_PHI]){ w.phi.push_back(phi); }
                 }
             }
         }
+        
+        // gather the selected columns of the particles found
+        size_t k = sel.size();
+        if(schema.writeCore[CORE_X]){
+            w.x.resize(k);
+            for(size_t j = 0; j < k; ++j){ w.x[j] = r.x[sel[j]]; }
+        }
+        if(schema.writeCore[CORE_Y]){
+            w.y.resize(k);
+            for(size_t j = 0; j < k; ++j){ w.y[j] = r.y[sel[j]]; }
+        }
+        if(schema.writeCore[CORE_Z]){
+            w.z.resize(k);
+            for(size_t j = 0; j < k; ++j){ w.z[j] = r.z[sel[j]]; }
+        }
+        if(schema.writeCore[CORE_REDSHIFT]){
+            w.redshift.resize(k);
+            for(size_t j = 0; j < k; ++j){ w.redshift[j] = aToZ(r.a[sel[j]]); }
+        }
+        if(schema.writeCore[CORE_ID]){
+            w.id.resize(k);
+            for(size_t j = 0; j < k; ++j){ w.id[j] = r.id[sel[j]]; }
+        }
+        w.extra.resize(numExtra);
+        for(int c = 0; c < numExtra; ++c){
+            const Column_info &col = schema.extra[c];
+            w.extra[c].resize(k * col.size);
+            for(size_t j = 0; j < k; ++j){
+                memcpy(&w.extra[c][j*col.size], &r.extra[c][(size_t)sel[j]*col.size], col.size);
+            }
+        }
         MPI_Barrier(MPI_COMM_WORLD);
 
         ///////////////////////////////////////////////////////////////
@@ -322,10 +2748,9 @@ void processLC(string dir_name, string out_dir, vector<string> step_strings,
         w.np_count.clear();
         w.np_count.resize(numranks);
         w.np_offset.clear();
-        w.np_offset[0] = 0;
-        
+        w.np_offset.push_back(0);
 
-        int cutout_size = int(w.redshift.size());
+        int cutout_size = int(sel.size());
         
         // get number of elements in each ranks portion of cutout
         MPI_Allgather(&cutout_size, 1, MPI_INT, &w.np_count[0], 1, MPI_INT, 
@@ -355,76 +2780,41 @@ void processLC(string dir_name, string out_dir, vector<string> step_strings,
         MPI_Offset offset_posvel = sizeof(POSVEL_T) * w.np_offset[myrank];
         MPI_Offset offset_id = sizeof(ID_T) * w.np_offset[myrank];
         MPI_Offset offset_float = sizeof(float) * w.np_offset[myrank];
-        MPI_Offset offset_int = sizeof(int) * w.np_offset[myrank];
-        MPI_Offset offset_int32 = sizeof(int32_t) * w.np_offset[myrank];
-
-        // write
-        MPI_File_seek(id_file, offset_id, MPI_SEEK_SET);
-        MPI_File_iwrite(id_file, &w.id[0], w.id.size(), MPI_INT64_T, &id_req);
-        MPI_Wait(&id_req, MPI_STATUS_IGNORE);
-
-        MPI_File_seek(x_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(x_file, &w.x[0], w.x.size(), MPI_FLOAT, &x_req);
-        MPI_Wait(&x_req, MPI_STATUS_IGNORE);
-
-        MPI_File_seek(y_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(y_file, &w.y[0], w.y.size(), MPI_FLOAT, &y_req);
-        MPI_Wait(&y_req, MPI_STATUS_IGNORE);
-        
-        MPI_File_seek(z_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(z_file, &w.z[0], w.z.size(), MPI_FLOAT, &z_req);
-        MPI_Wait(&z_req, MPI_STATUS_IGNORE);
-
-        MPI_File_seek(vx_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(vx_file, &w.vx[0], w.vx.size(), MPI_FLOAT, &vx_req);
-        MPI_Wait(&vx_req, MPI_STATUS_IGNORE);
-
-        MPI_File_seek(vy_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(vy_file, &w.vy[0], w.vy.size(), MPI_FLOAT, &vy_req);
-        MPI_Wait(&vy_req, MPI_STATUS_IGNORE);
-        
-        MPI_File_seek(vz_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(vz_file, &w.vz[0], w.vz.size(), MPI_FLOAT, &vz_req);
-        MPI_Wait(&vz_req, MPI_STATUS_IGNORE);
-        
-        MPI_File_seek(theta_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(theta_file, &w.theta[0], w.theta.size(), MPI_FLOAT, &theta_req);
-        MPI_Wait(&theta_req, MPI_STATUS_IGNORE);
-        
-        MPI_File_seek(phi_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(phi_file, &w.phi[0], w.phi.size(), MPI_FLOAT, &phi_req);
-        MPI_Wait(&phi_req, MPI_STATUS_IGNORE);
-        
-        MPI_File_seek(redshift_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(redshift_file, &w.redshift[0], w.redshift.size(), MPI_FLOAT, &redshift_req);
-        MPI_Wait(&redshift_req, MPI_STATUS_IGNORE);
-        
-        MPI_File_seek(id_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(id_file, &w.id[0], w.id.size(), MPI_FLOAT, &id_req);
-        MPI_Wait(&id_req, MPI_STATUS_IGNORE);
-        
-        MPI_File_seek(rotation_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(rotation_file, &w.rotation[0], w.rotation.size(), 
-                        MPI_FLOAT, &rotation_req);
-        MPI_Wait(&rotation_req, MPI_STATUS_IGNORE);
-        
-        MPI_File_seek(replication_file, offset_posvel, MPI_SEEK_SET);
-        MPI_File_iwrite(replication_file, &w.replication[0], w.replication.size(), 
-                        MPI_FLOAT, &replication_req);
-        MPI_Wait(&replication_req, MPI_STATUS_IGNORE);
-
-        MPI_File_close(&id_file);
-        MPI_File_close(&x_file);
-        MPI_File_close(&y_file);
-        MPI_File_close(&z_file);
-        MPI_File_close(&vx_file);
-        MPI_File_close(&vy_file);
-        MPI_File_close(&vz_file);
-        MPI_File_close(&redshift_file);
-        MPI_File_close(&theta_file);
-        MPI_File_close(&phi_file);
-        MPI_File_close(&rotation_file);
-        MPI_File_close(&replication_file);
+        string pre = step_subdir.str() + "/";
+        ostringstream file_name_suffix;
+        file_name_suffix << "." << step << ".bin";
+        string suf = file_name_suffix.str();
+
+        // write selected core columns...
+        if(schema.writeCore[CORE_ID]){
+            writeColumn(pre + "id" + suf, &w.id[0], w.id.size(), MPI_INT64_T, offset_id);
+        }
+        if(schema.writeCore[CORE_X]){
+            writeColumn(pre + "x" + suf, &w.x[0], w.x.size(), MPI_FLOAT, offset_posvel);
+        }
+        if(schema.writeCore[CORE_Y]){
+            writeColumn(pre + "y" + suf, &w.y[0], w.y.size(), MPI_FLOAT, offset_posvel);
+        }
+        if(schema.writeCore[CORE_Z]){
+            writeColumn(pre + "z" + suf, &w.z[0], w.z.size(), MPI_FLOAT, offset_posvel);
+        }
+        if(schema.writeCore[CORE_THETA]){
+            writeColumn(pre + "theta" + suf, &w.theta[0], w.theta.size(), MPI_FLOAT, offset_float);
+        }
+        if(schema.writeCore[CORE_PHI]){
+            writeColumn(pre + "phi" + suf, &w.phi[0], w.phi.size(), MPI_FLOAT, offset_float);
+        }
+        if(schema.writeCore[CORE_REDSHIFT]){
+            writeColumn(pre + "redshift" + suf, &w.redshift[0], w.redshift.size(), MPI_FLOAT, 
+                        offset_posvel);
+        }
+        
+        // and non-core columns, as raw bytes of their native type
+        for(int c = 0; c < numExtra; ++c){
+            const Column_info &col = schema.extra[c];
+            writeColumn(pre + col.name + suf, w.extra[c].data(), w.extra[c].size(), MPI_BYTE, 
+                        (MPI_Offset)col.size * w.np_offset[myrank]);
+        }
     }
 }
 
@@ -438,9 +2828,10 @@ void processLC(string dir_name, string out_dir, vector<string> step_strings,
 //////////////////////////////////////////////////////
 
 void processLC(string dir_name, vector<string> out_dirs, vector<string> step_strings, 
-               vector<float> halo_pos, vector<float> halo_props, float boxLength, int myrank, 
-               int numranks, bool verbose, bool timeit, bool overwrite, bool positionOnly, 
-               bool forceWriteProps, bool propsOnly){
+               vector<float> halo_pos, vector<float> halo_props, vector<string> halo_tags,
+               float boxLength, int myrank, int numranks, bool verbose, bool timeit, 
+               bool overwrite, bool positionOnly, bool forceWriteProps, bool propsOnly, 
+               const Cutout_options &opts){
 
 
     ///////////////////////////////////////////////////////////////
@@ -449,28 +2840,10 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
     //
     ///////////////////////////////////////////////////////////////
 
-    // find all lc sub directories for each step in step_strings
-    if(myrank == 0){ cout << "\nReading directory: " << dir_name << endl; }
-    vector<string> subdirs;
-    getLCSubdirs(dir_name, subdirs);
-    if(myrank==0){ 
-        cout << "Found subdirs:" << endl;
-        for (vector<string>::const_iterator i = subdirs.begin(); i != subdirs.end(); ++i){
-            cout << *i << ' ';
-        }
-        cout << endl;
-    }
-
-    // find the prefix (chars before the step number) in the subdirectory names.
-    // It is assumed that all subdirs have the same prefix.
-    string subdirPrefix;
-    for(string::size_type j = 0; j < subdirs[0].size(); ++j){
-        if( isdigit(subdirs[0][j]) > 0){
-            subdirPrefix = subdirs[0].substr(0, j);
-            break;
-        }
-    }
-    if(myrank == 0){ cout << "Subdir prefix is: " << subdirPrefix << endl; }
+    // the step subdirectories and header files were found once, in main.cpp (and 
+    // are appended to as the simulation writes new steps, with --watch)
+    Step_manifest manifest = opts.manifest;
+    string subdirPrefix = manifest.subdirPrefix;
 
 
     ///////////////////////////////////////////////////////////////
@@ -483,261 +2856,79 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         cout<< "\n\n---------- Setting up for coordinate rotation ----------" << endl; 
     }
 
-    // do coordinate rotation to center each input halo at (r, 90, 0) in spherical coords...
-    // halo_pos is a vector of halo positions, each having three components
-    // k is a vector of vectors (the rotation axis per target halo)
-    // B is a vector (the rotation angle per target halo)
-    // theta is a vector of vectors (the altitude angular bounds per target halo)
-    // phi is a vector of vectors (the azimuthal angular bounds per target halo)
-    
+    // do coordinate rotation to center each input halo at (r, 90, 0) in spherical coords,
+    // and find the angular bounds of each cutout (see computeHaloGeometry() above)
     int numHalos = halo_pos.size()/3;
     bool printHalo;
+    float halfBoxLength = ((boxLength/2.0) / 60) * PI/180.0;
+
+    Halo_geometry geo;
+    // (for volume cutouts, the rough bounds enclose the sphere about each halo)
+    bool volumeCut = (opts.volumeRadius > 0);
+    float volumeEnclosing = opts.volumeRadius * (opts.volumeBox ? sqrt(3.0) : 1.0);
+    computeHaloGeometry(halo_pos, boxLength, volumeEnclosing, myrank, numranks, geo);
+    const float *theta_cut = geo.theta_cut;
+    const float *phi_cut = geo.phi_cut;
+    const vector<float> &theta_cut_rough = geo.theta_rough;
+    const vector<float> &phi_cut_rough = geo.phi_rough;
+
+    // halo_props has either (redshift, step, sod_mass, sod_radius, sod_concentration, 
+    // sod_concentration_error) or (redshift, step, fof_mass) per halo
+    int numProps = numHalos > 0 ? halo_props.size() / numHalos : 0;
+    if(numHalos > 0 and numProps != 3 and numProps != 6){
+        cout << "Something went wrong... " << numProps << " properties found per halo" << 
+                " in input vectors. Is massDef correct? Please contact developer." << endl;
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    } 
     
-    // rotation axis k and angle B per halo
-    vector<vector<float> > k(numHalos);
-    vector<float> B(numHalos);
-
-    // cross-product matrix K and rotation matrix R per halo
-    vector<vector<vector<float> > > K(numHalos);
-    vector<vector<vector<float> > > R(numHalos);
-    vector<vector<vector<float> > > R_inv(numHalos);
-    
-    // constant (equitorial) angular bounds per halo and
-    // rough constant (rotated) angular bounds per halo
-    vector<vector<float> > theta_cut(numHalos);
-    vector<vector<float> > phi_cut(numHalos);
-    vector<vector<float> > theta_cut_rough(numHalos);
-    vector<vector<float> > phi_cut_rough(numHalos);
-
-    for(int h=0; h<halo_pos.size(); h+=3){ 
-        
-        int haloIdx = h/3;
-        printHalo = (numHalos < 20) | (haloIdx%100==0) ? 1:0;
-        
-        // get next three values in halo_pos
-        float tmp_pos[] = {halo_pos[h], halo_pos[h+1], halo_pos[h+2]};
-        vector<float> this_halo_pos(tmp_pos, tmp_pos+3);
-
-        // get next three or four values in halo_props 
-        // (redshift, step, sod_mass, sod_radius, sod_concentration, sod_concentration_error) or 
-        // (redshift, step, fof_mass) 
-        // last 3 elements of tmp_props will be garbage if numProps == 3 (massDef == 'fof'),
-        // but that's okay. 
-        int numProps = halo_props.size() / numHalos;
-        float tmp_props[] = {halo_props[numProps*haloIdx], halo_props[numProps*haloIdx+1], 
-                             halo_props[numProps*haloIdx+2], halo_props[numProps*haloIdx+3],
-                             halo_props[numProps*haloIdx+4], halo_props[numProps*haloIdx+5]};
-        if(numProps != 3 and numProps != 6){
-            cout << "Something went wrong... " << numProps << " properties found per halo" << 
-                    " in input vectors. Is massDef correct? Please contact developer." << endl;
-            MPI_Finalize();
-            exit(EXIT_FAILURE);
-        } 
-        vector<float> this_halo_props(tmp_props, tmp_props+numProps);
-        
-        // find distance magnitude (new rotated halo position)
-        float halo_r = (float)sqrt(this_halo_pos[0]*this_halo_pos[0] + 
-                                   this_halo_pos[1]*this_halo_pos[1] + 
-                                   this_halo_pos[2]*this_halo_pos[2]);
-        
-        // get the halo-centric angular bounds of the cutout...
-        // calculate dtheta and dphi in radians gven boxlength in arcmin
-        float halfBoxLength = ((boxLength/2.0) / 60) * PI/180.0;
-        float dtheta = halfBoxLength;
-        float dphi = dtheta;
-
-        // calculate theta_cut and phi_cut, in arcsec, given the specified boxLength
-        theta_cut[haloIdx].push_back( (PI/2 - dtheta) * 180.0/PI * ARCSEC );
-        theta_cut[haloIdx].push_back( (PI/2 + dtheta) * 180.0/PI * ARCSEC );
-        phi_cut[haloIdx].push_back( (0 - dphi) * 180.0/PI * ARCSEC );
-        phi_cut[haloIdx].push_back( (0 + dphi) * 180.0/PI * ARCSEC );
-        
-        if(myrank == 0 and printHalo){
+    if(myrank == 0){
+        cout << "theta bounds set to: ";
+        cout << theta_cut[0]/ARCSEC << "deg -> " << theta_cut[1]/ARCSEC <<"deg"<< endl;
+        cout << "phi bounds set to: ";
+        cout << phi_cut[0]/ARCSEC << "deg -> " << phi_cut[1]/ARCSEC <<"deg" << endl;
+        
+        for(int haloIdx = 0; haloIdx < numHalos; ++haloIdx){
+            printHalo = (numHalos < 20) | (haloIdx%100==0) ? 1:0;
+            if(!printHalo){ continue; }
+            
+            const float *R = &geo.R[9*haloIdx];
             cout << "\n--- Target halo " << haloIdx << " ---" << endl; 
-            cout << "theta bounds set to: ";
-            cout << theta_cut[haloIdx][0]/ARCSEC << "deg -> " << theta_cut[haloIdx][1]/ARCSEC <<"deg"<< endl;
-            cout << "phi bounds set to: ";
-            cout << phi_cut[haloIdx][0]/ARCSEC << "deg -> " << phi_cut[haloIdx][1]/ARCSEC <<"deg" << endl;
             cout << "theta-phi bounds result in box width of " << 
-                    tan(dtheta) * halo_r * 2 << 
-                    " Mpc/h at distance to halo of " << halo_r << " Mpc/h" << endl << 
-                    "        " << "= " << dtheta*2*180.0/PI << "deg x " << dphi*2*180.0/PI << 
-                    "deg field of view" << endl;
-        } 
-        
-        // Now let's rotate the angular bounds to their true position in the sky
-        // Using the Rodrigues rotation formula...
-        float tmp_rot_pos[] = {halo_r, 0, 0};
-        vector<float> rotated_pos(tmp_rot_pos, tmp_rot_pos+3);
-        if(myrank == 0 and printHalo){
-            cout << "\nFinding axis of rotation to move (" << 
-                    this_halo_pos[0]<< ", " << this_halo_pos[1]<< ", " << this_halo_pos[2]<< ") to (" <<
-                    rotated_pos[0] << ", " << rotated_pos[1] << ", " << rotated_pos[2] <<
-                    ")" << endl; 
-        }
-
-        // get angle and axis of rotation
-        normCross(this_halo_pos, rotated_pos, k[haloIdx]);
-        B[haloIdx] = vecPairAngle(this_halo_pos, rotated_pos);
-        if(myrank == 0 and printHalo){
-            cout << "Rotation is " << B[haloIdx]*(180/PI) << "deg about axis k = (" << 
-                    k[haloIdx][0]<< ", " << k[haloIdx][1] << ", " << k[haloIdx][2] << ")" << endl;
-        }
-        
-        // get rotation matrix R
-        cross_prod_matrix(k[haloIdx], K[haloIdx]);
-        rotation_matrix(K[haloIdx], B[haloIdx], R[haloIdx]);
-
-        // invert rotation matrix R
-        R_inv[haloIdx] = invert_3x3(R[haloIdx]);
-         
-        // verbose output
-        if(myrank == 0 and verbose == true and printHalo){
-            cout << "\nRotation Matrix is " << endl << 
-                    "{ " << R[haloIdx][0][0] << ", " << R[haloIdx][0][1] << ", " << 
-                            R[haloIdx][0][2] << "}" << endl <<
-                    "{ " << R[haloIdx][1][0] << ", " << R[haloIdx][1][1] << ", " << 
-                            R[haloIdx][1][2] << "}" << endl <<
-                    "{ " << R[haloIdx][2][0] << ", " << R[haloIdx][2][1] << ", " << 
-                            R[haloIdx][2][2] << "}" << endl;
-        }
-        if(myrank == 0 and verbose == true and printHalo){
-            cout << "Inverted Rotation Matrix is " << endl << 
-                    "{ " << R_inv[haloIdx][0][0] << ", " << R_inv[haloIdx][0][1] << ", " << 
-                            R_inv[haloIdx][0][2] << "}" << endl <<
-                    "{ " << R_inv[haloIdx][1][0] << ", " << R_inv[haloIdx][1][1] << ", " << 
-                            R_inv[haloIdx][1][2] << "}" << endl <<
-                    "{ " << R_inv[haloIdx][2][0] << ", " << R_inv[haloIdx][2][1] << ", " << 
-                            R_inv[haloIdx][2][2] << "}" << endl;
-        }
-
-        // now, we have defined theta_cut and phi_cut above in such a way that it 
-        // encapsulates a field of angular size boxLength for the target halo
-        // *if it were lying on the equator*. With the cutout sized correctly, we can now
-        // "point it" at the true halo posiiton to get the real non-constant angular bounds.
-        // We do this by defining four unit vectors (A, B, C, D) directed toward the 
-        // corners of the bounded fov on the equator, and rotate them according to the 
-        // inverted rotation matrix defined above:
-        //                                          C
-        //                                        _--_ 
-        //    B-----------C                     _-    -_  
-        //    |           |    R_inv          _-        -_   
-        //    |           |  -------->>   B _-            -_ D
-        //    |   fov     |                  -_   fov    _-
-        //    |           |                    -_      _-
-        //    A-----------D                      -_  _-  <--- boxLength
-        //          ^                              --
-        //          |__ boxLength                  A
-        //
-      
-        // get theta and phi bounds in radians 
-        vector<float> theta_cut_rad;
-        theta_cut_rad.push_back( (theta_cut[haloIdx][0] / ARCSEC) * PI/180.0); 
-        theta_cut_rad.push_back( (theta_cut[haloIdx][1] / ARCSEC) * PI/180.0); 
-        vector<float> phi_cut_rad;
-        phi_cut_rad.push_back( (phi_cut[haloIdx][0] / ARCSEC) * PI/180.0); 
-        phi_cut_rad.push_back( (phi_cut[haloIdx][1] / ARCSEC) * PI/180.0); 
-        
-        float fov_corner_A[] = { sin(theta_cut_rad[1]) * cos(phi_cut_rad[1]), 
-                                 sin(theta_cut_rad[1]) * sin(phi_cut_rad[1]), 
-                                 cos(theta_cut_rad[1]) };
-        vector<float> A(fov_corner_A, fov_corner_A+3);
-        vector<float> A_rot;  
-
-        float fov_corner_B[] = { sin(theta_cut_rad[0]) * cos(phi_cut_rad[1]), 
-                                 sin(theta_cut_rad[0]) * sin(phi_cut_rad[1]), 
-                                 cos(theta_cut_rad[0]) };
-        vector<float> B(fov_corner_B, fov_corner_B+3);
-        vector<float> B_rot;  
-
-        float fov_corner_C[] = { sin(theta_cut_rad[0]) * cos(phi_cut_rad[0]), 
-                                 sin(theta_cut_rad[0]) * sin(phi_cut_rad[0]), 
-                                 cos(theta_cut_rad[0]) };
-        vector<float> C(fov_corner_C, fov_corner_C+3);
-        vector<float> C_rot;  
-        
-        float fov_corner_D[] = { sin(theta_cut_rad[1]) * cos(phi_cut_rad[0]), 
-                                 sin(theta_cut_rad[1]) * sin(phi_cut_rad[0]), 
-                                 cos(theta_cut_rad[1]) };
-        vector<float> D(fov_corner_D, fov_corner_D+3);
-        vector<float> D_rot;  
-        
-        A_rot = matVecMul(R_inv[haloIdx], A);
-        B_rot = matVecMul(R_inv[haloIdx], B); 
-        C_rot = matVecMul(R_inv[haloIdx], C); 
-        D_rot = matVecMul(R_inv[haloIdx], D); 
-
-        if(myrank == 0 and verbose == true and printHalo){ 
-                               cout << "\nRotated cartesian vectors pointing toward FOV corners are" << endl <<
-                               "A = {" << A_rot[0] << ", " << A_rot[1] << ", " << A_rot[2] << "}" << endl <<
-                               "B = {" << B_rot[0] << ", " << B_rot[1] << ", " << B_rot[2] << "}" << endl <<
-                               "C = {" << C_rot[0] << ", " << C_rot[1] << ", " << C_rot[2] << "}" << endl <<
-                               "D = {" << D_rot[0] << ", " << D_rot[1] << ", " << D_rot[2] << "}" << endl;
-        }
-
-        // convert vectors A,B,C,D to 2-dimensional spherical coordinate 
-        // vectors {theta, phi} in arcsec 
-        vector<float> A_sph;
-        A_sph.push_back( acos(A_rot[2]/1) * 180.0/PI * ARCSEC);
-        A_sph.push_back( atan(A_rot[1]/A_rot[0]) * 180.0/PI * ARCSEC);
-        
-        vector<float> B_sph;
-        B_sph.push_back( acos(B_rot[2]/1) * 180.0/PI * ARCSEC);
-        B_sph.push_back( atan(B_rot[1]/B_rot[0]) * 180.0/PI * ARCSEC);
-        
-        vector<float> C_sph;
-        C_sph.push_back( acos(C_rot[2]/1) * 180.0/PI * ARCSEC);
-        C_sph.push_back( atan(C_rot[1]/C_rot[0]) * 180.0/PI * ARCSEC);
-        
-        vector<float> D_sph;
-        D_sph.push_back( acos(D_rot[2]/1) * 180.0/PI * ARCSEC);
-        D_sph.push_back( atan(D_rot[1]/D_rot[0]) * 180.0/PI * ARCSEC);
-        
-        if(myrank == 0 and verbose == true and printHalo){ 
-                               cout << "\nAngular positions of the FOV corners in degrees are" << endl <<
-                               "A = {" << A_sph[0]/ARCSEC << ", " << A_sph[1]/ARCSEC <<
-                                          "}" << endl <<
-                               "B = {" << B_sph[0]/ARCSEC << ", " << B_sph[1]/ARCSEC <<
-                                          "}" << endl <<
-                               "C = {" << C_sph[0]/ARCSEC << ", " << C_sph[1]/ARCSEC <<
-                                          "}" << endl <<
-                               "D = {" << D_sph[0]/ARCSEC << ", " << D_sph[1]/ARCSEC <<
-                                          "}" << endl;
-        }
-
-        // define rough-cut bounds, in arcsec, to be used to quickly remove particles that certainly 
-        // are not in the field of view. After a cut is done in this way, we can treat the remaining 
-        // particles more carefully. We do this by simply cutting on the max and min theta and phi 
-        // values among the vectors A,B,and C, with a buffer of constant size 10 arcmin (where typical
-        // cluster cutouts at modest redshifts come out to have a width of order 1 degree)
-
-        float ang_buffer = 600; // buffer in arcsec
-
-        float tmp_thetas[] = {A_sph[0], B_sph[0], C_sph[0], D_sph[0]};
-        vector<float> theta_corners(tmp_thetas, tmp_thetas+4);
-        theta_cut_rough[haloIdx].push_back( *min_element(theta_corners.begin(), theta_corners.end()) - ang_buffer );
-        theta_cut_rough[haloIdx].push_back( *max_element(theta_corners.begin(), theta_corners.end()) + ang_buffer ); 
-        
-        float tmp_phis[] = {A_sph[1], B_sph[1], C_sph[1], D_sph[1]};
-        vector<float> phi_corners(tmp_phis, tmp_phis+4);
-        phi_cut_rough[haloIdx].push_back( *min_element(phi_corners.begin(), phi_corners.end()) - ang_buffer );
-        phi_cut_rough[haloIdx].push_back( *max_element(phi_corners.begin(), phi_corners.end()) + ang_buffer ); 
-        
-        if(myrank == 0 and printHalo){
+                    tan(halfBoxLength) * geo.halo_r[haloIdx] * 2 << 
+                    " Mpc/h at distance to halo of " << geo.halo_r[haloIdx] << " Mpc/h" << endl << 
+                    "        " << "= " << halfBoxLength*2*180.0/PI << "deg x " << 
+                    halfBoxLength*2*180.0/PI << "deg field of view" << endl;
+            if(verbose == true){
+                cout << "\nRotation Matrix is " << endl << 
+                        "{ " << R[0] << ", " << R[1] << ", " << R[2] << "}" << endl <<
+                        "{ " << R[3] << ", " << R[4] << ", " << R[5] << "}" << endl <<
+                        "{ " << R[6] << ", " << R[7] << ", " << R[8] << "}" << endl;
+            }
             cout << "\nrough theta bounds set to: ";
-            cout << theta_cut_rough[haloIdx][0]/ARCSEC << "deg -> " << 
-                    theta_cut_rough[haloIdx][1]/ARCSEC <<"deg"<< endl;
+            cout << theta_cut_rough[2*haloIdx]/ARCSEC << "deg -> " << 
+                    theta_cut_rough[2*haloIdx+1]/ARCSEC <<"deg"<< endl;
             cout << "rough phi bounds set to: ";
-            cout << phi_cut_rough[haloIdx][0]/ARCSEC << "deg -> " << 
-                    phi_cut_rough[haloIdx][1]/ARCSEC <<"deg" << endl;
+            cout << phi_cut_rough[2*haloIdx]/ARCSEC << "deg -> " << 
+                    phi_cut_rough[2*haloIdx+1]/ARCSEC <<"deg" << endl;
         }
+    }
 
-        // Write out a csv file to this halo's cutout directory to contain halo properties, 
-        // cutout specifications, and run meta data. By default, skip this step if that property
-        // file already exists. 
-        // If the code had been updated to change the content of that file, 
-        // and you want old outputs to be overwritten, then just change forceWrite to true.
-        if(myrank == 0){ 
+    // Write out the properties of all halos to one catalog, if requested
+    if(opts.propsCatalog and opts.planFraction == 0){
+        writePropertiesCatalog(opts.outDir, out_dirs, halo_pos, halo_props, geo, halfBoxLength, 
+                               myrank, numranks);
+    }
+
+    // Write out a csv file to each halo's cutout directory to contain halo properties, 
+    // cutout specifications, and run meta data. By default, skip this step if that property
+    // file already exists. 
+    // If the code had been updated to change the content of that file, 
+    // and you want old outputs to be overwritten, then just change forceWrite to true.
+    if(myrank == 0 and (!opts.propsCatalog or opts.propsCSV) and opts.planFraction == 0){ 
+        for(int haloIdx = 0; haloIdx < numHalos; ++haloIdx){
+            printHalo = (numHalos < 20) | (haloIdx%100==0) ? 1:0;
+            
             ofstream props_file;
             ostringstream props_file_name; 
             props_file_name << out_dirs[haloIdx]<< "/properties.csv";
@@ -754,17 +2945,18 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
                 props_file << ", " << "halo_lc_x" << ", " << "halo_lc_y" << ", " << "halo_lc_z" << ", "
                            << "boxRadius_Mpc" << ", " << "boxRadius_arcsec" << "\n";
 
-                for(int i=0; i<this_halo_props.size(); ++i)
-                    props_file << this_halo_props[i] << ", ";
-                for(int i=0; i<this_halo_pos.size(); ++i)
-                    props_file << this_halo_pos[i] << ", ";
-                props_file << atan(halfBoxLength) * halo_r << ", " << halfBoxLength * 180.0/PI * ARCSEC << "\n";
+                for(int i=0; i<numProps; ++i)
+                    props_file << halo_props[numProps*haloIdx + i] << ", ";
+                for(int i=0; i<3; ++i)
+                    props_file << halo_pos[3*haloIdx + i] << ", ";
+                props_file << atan(halfBoxLength) * geo.halo_r[haloIdx] << ", " << 
+                              halfBoxLength * 180.0/PI * ARCSEC << "\n";
                  
                 props_file.close();
-                if(printHalo){ cout << "wrote halo info to properties.csv" << endl; }
+                if(printHalo){ cout << "wrote halo " << haloIdx << " info to properties.csv" << endl; }
             
             }else{ 
-                if(printHalo){ cout << "properties.csv already exists; skipping write" << endl; }
+                if(printHalo){ cout << "halo " << haloIdx << " properties.csv already exists; skipping write" << endl; }
             }
         }
     }
@@ -787,9 +2979,117 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
     int step;
  
     MPI_Datatype particles_mpi_pos = createParticles_pos();
-    MPI_Datatype particles_mpi_vel = createParticles_vel();
+
+    // decide which columns to read, exchange, and write. Velocities are needed for 
+    // the line-of-sight velocity even if they aren't to be written, in which case 
+    // they are read, but not redistributed
+    bool needVel = find(opts.derivedCols.begin(), opts.derivedCols.end(), (int)DERIVED_V_LOS) != 
+                   opts.derivedCols.end();
+    int numDerived = opts.derivedCols.size();
+    
+    Column_schema schema;
+    selectColumns(opts.columns, positionOnly, needVel, schema);
+    int numExtra = schema.extra.size();
+    
+    if(myrank == 0){
+        cout << "\nColumns to write: ";
+        for(int c = 0; c < NUM_CORE; ++c){ if(schema.writeCore[c]){ cout << coreColumnName(c) << " "; } }
+        for(int c = 0; c < numExtra; ++c){ if(schema.extra[c].exchange){ cout << schema.extra[c].name << " "; } }
+        for(int c = 0; c < numDerived; ++c){ cout << derivedColumnName(opts.derivedCols[c]) << " "; }
+        cout << endl;
+    }
+
+    // if this is a dry run, estimate the cost of the run and stop here
+    // (or partition the halos into balanced shards, which is based on that estimate)
+    if(opts.planFraction > 0){
+        vector<double> haloMembers;
+        planCutout(manifest, geo, schema, numDerived, opts.planFraction, opts.outDir, 
+                   myrank, numranks, haloMembers);
+        if(opts.numShards > 0){
+            int numSteps = step_strings.size() - count(step_strings.begin(), step_strings.end(), "499");
+            shardHalos(halo_tags, halo_pos, halo_props, haloMembers, numSteps, opts.numShards, 
+                       opts.outDir, myrank);
+        }
+        return;
+    }
+
+    // if requested, find groups of halos with overlapping rough footprints. Each group
+    // of more than one halo gets a shared output directory, to which its members' 
+    // particles are written once, along with a membership bitmask, rather than to
+    // the members' own directories. Bit m of the mask is set if the particle belongs 
+    // to the m-th halo in the group, as listed in the group's members.csv
+    vector<int> haloGroup(numHalos, -1);
+    vector<vector<int> > groupMembers;
+    vector<string> groupDirs;
+    vector<vector<float> > group_theta_rough;
+
+    if(opts.dedupOverlaps){
+        vector<int> groupOf;
+        int numGroups = groupOverlappingFootprints(theta_cut_rough, phi_cut_rough, 
+                                                   MAX_GROUP_SIZE, groupOf);
+        vector<vector<int> > allGroups(numGroups);
+        for(int h = 0; h < numHalos; ++h){ allGroups[groupOf[h]].push_back(h); }
+        
+        for(int g = 0; g < numGroups; ++g){
+            if(allGroups[g].size() < 2){ continue; }
+            
+            int gg = groupMembers.size();
+            groupMembers.push_back(allGroups[g]);
+            
+            ostringstream group_dir;
+            group_dir << opts.outDir << "group_" << gg << "/";
+            groupDirs.push_back(group_dir.str());
+
+            // the group is searched over the union of its members' rough theta bounds
+            vector<float> bounds(2);
+            bounds[0] = theta_cut_rough[2*allGroups[g][0]];
+            bounds[1] = theta_cut_rough[2*allGroups[g][0]+1];
+            for(int m = 0; m < allGroups[g].size(); ++m){
+                int h = allGroups[g][m];
+                haloGroup[h] = gg;
+                bounds[0] = min(bounds[0], theta_cut_rough[2*h]);
+                bounds[1] = max(bounds[1], theta_cut_rough[2*h+1]);
+            }
+            group_theta_rough.push_back(bounds);
+        }
+
+        // create group directories, and record membership from both sides
+        if(myrank == 0){
+            int numGrouped = count_if(haloGroup.begin(), haloGroup.end(), [](int g){return g >= 0;});
+            cout << "\nFound " << groupMembers.size() << " groups of overlapping footprints, " << 
+                    "containing " << numGrouped << " of " << numHalos << " halos" << endl;
+            
+            for(int g = 0; g < groupMembers.size(); ++g){
+                mkdir(groupDirs[g].c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IXOTH);
+                
+                ofstream members_file((groupDirs[g] + "members.csv").c_str());
+                members_file << "#bit, halo_idx, halo_dir\n";
+                for(int m = 0; m < groupMembers[g].size(); ++m){
+                    int h = groupMembers[g][m];
+                    members_file << m << ", " << h << ", " << out_dirs[h] << "\n";
+                    
+                    ofstream group_file((out_dirs[h] + "group.csv").c_str());
+                    group_file << "#group_dir, bit\n" << groupDirs[g] << ", " << m << "\n";
+                }
+            }
+
+            bool haloFrameCols = schema.writeCore[CORE_THETA] or schema.writeCore[CORE_PHI];
+            for(int c = 0; c < numDerived; ++c){
+                if(opts.derivedCols[c] != DERIVED_V_LOS and opts.derivedCols[c] != DERIVED_D){ 
+                    haloFrameCols = true; 
+                }
+            }
+            if(groupMembers.size() > 0 and haloFrameCols){
+                cout << "Halo-frame columns (theta, phi, and derived x_rot, y_rot, z_rot, x_tan, " <<
+                        "y_tan) are not written for grouped halos; x, y, z are always written " <<
+                        "to group stores instead" << endl;
+            }
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
 
     vector<double> read_times;
+    vector<double> map_times;
     vector<double> redist_times;
     vector<double> sort_times;
     vector<double> cutout_times; 
@@ -798,7 +3098,120 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
     double stop;
     double duration;
     
-    for (int i=0; i<step_strings.size(); ++i){
+    // the ranks which read the input (all of them, by default)
+    bool isReader;
+    MPI_Comm reader_comm = makeReaderComm(opts.readersPerNode, opts.totalReaders, myrank, 
+                                          numranks, isReader);
+    
+    // the union of all rough cutout footprints, outside of which particles are dropped 
+    // right after reading. Not applied if HEALPix maps need every particle, or if the 
+    // sorted particles are to be cached for later runs, which may have other halos
+    bool useMask = (opts.healpixNside == 0 and opts.cacheDir.empty());
+    Footprint_mask mask;
+    if(useMask){ buildFootprintMask(geo.theta_rough, geo.phi_rough, mask); }
+    
+    // a preview reads only every blockStride-th block of each step, and records the 
+    // fraction of each step read in preview.csv
+    int blockStride = max(1, opts.previewStride);
+    if(blockStride > 1 and myrank == 0){
+        ofstream preview_file((opts.outDir + "preview.csv").c_str());
+        preview_file << "#step, block_stride, particles_read, particles_in_step, fraction_read\n";
+    }
+    
+    // the step cache is node-local, so each rank makes sure that it exists
+    if(!opts.cacheDir.empty()){ mkdir(opts.cacheDir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IXOTH); }
+    
+    // if cutting out from a lightcone store, find the store tiles which intersect 
+    // the mask, once for all steps (see buildLCStore())
+    vector<Column_info> storeColumns;
+    vector<int64_t> storeTiles;
+    if(!opts.storeDir.empty()){
+        map<string, vector<double> > storeInfo;
+        readInfoFile(opts.storeDir + "store.txt", storeColumns, storeInfo);
+        int storeNside = storeInfo["nside"].size() > 0 ? (int)storeInfo["nside"][0] : 0;
+        if(!valid_nside(storeNside)){
+            if(myrank == 0){ cout << "\nNo valid nside in " << opts.storeDir << "store.txt" << endl; }
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+        
+        int numStoreTiles = 0;
+        if(myrank == 0){
+            footprintTiles(mask, storeNside, storeTiles);
+            numStoreTiles = storeTiles.size();
+            cout << "\nReading " << numStoreTiles << " of " << 12*(int64_t)storeNside*storeNside << 
+                    " tiles of the lightcone store at nside " << storeNside << endl;
+        }
+        MPI_Bcast(&numStoreTiles, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        storeTiles.resize(numStoreTiles);
+        MPI_Bcast(storeTiles.data(), numStoreTiles, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    }
+    
+    // if cutting out from a parent cutout, check that every halo's rough footprint lies 
+    // within the parent's bounds, and within the first octant, to which the parent
+    // is limited (see use case 1 above). The rough phi bounds are folded by atan(y/x),
+    // so that a halo at x<0, y<0 could pass the bounds check alone; the halo itself 
+    // must also be at x>0, y>0, z>0. Its footprint, which is contiguous about the halo,
+    // is then within the octant if its rough bounds are within [0, 90] deg, as it can't
+    // cross the x=0 plane without its folded phi bounds spanning -90 to 90 deg
+    vector<Column_info> parentColumns;
+    if(!opts.cutoutDir.empty()){
+        map<string, vector<double> > parentInfo;
+        readInfoFile(opts.cutoutDir + "cutout.txt", parentColumns, parentInfo);
+        if(parentInfo["theta"].size() != 2 or parentInfo["phi"].size() != 2){
+            if(myrank == 0){ cout << "\nNo theta and phi bounds in " << opts.cutoutDir << "cutout.txt" << endl; }
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+        
+        // the parent must hold the columns always read from it (see readCutoutStep())
+        const char *parentCore[5] = {"x", "y", "z", "redshift", "id"};
+        for(int k = 0; k < 5; ++k){
+            int v = 0;
+            while(v < parentColumns.size() and parentColumns[v].name != parentCore[k]){ ++v; }
+            if(v == parentColumns.size()){
+                if(myrank == 0){ 
+                    cout << "\nParent cutout " << opts.cutoutDir << " has no " << parentCore[k] << 
+                            " column; it must be cut with x, y, z, redshift, and id" << endl; 
+                }
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+        }
+        double parentTheta[2] = {max(parentInfo["theta"][0], 0.0), min(parentInfo["theta"][1], 90*ARCSEC)};
+        double parentPhi[2] = {max(parentInfo["phi"][0], 0.0), min(parentInfo["phi"][1], 90*ARCSEC)};
+        
+        int numOutside = 0;
+        for(int h = 0; h < numHalos; ++h){
+            bool inOctant = halo_pos[3*h] > 0 and halo_pos[3*h+1] > 0 and halo_pos[3*h+2] > 0;
+            if(inOctant and theta_cut_rough[2*h] >= parentTheta[0] and theta_cut_rough[2*h+1] <= parentTheta[1] and
+               phi_cut_rough[2*h] >= parentPhi[0] and phi_cut_rough[2*h+1] <= parentPhi[1]){ continue; }
+            if(myrank == 0 and numOutside < 20){ 
+                cout << "\nHalo " << h << " footprint is not within the parent cutout " << opts.cutoutDir; 
+            }
+            numOutside++;
+        }
+        if(numOutside > 0){
+            if(myrank == 0){ cout << "\n" << numOutside << " of " << numHalos << " halos outside of parent" << endl; }
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+    }
+    
+    // the cutout kernel, specialized for the shape of the cutouts, and for whether 
+    // the particles' rotated positions are written (see selectHaloParticles())
+    bool needRotation = schema.writeCore[CORE_THETA] or schema.writeCore[CORE_PHI];
+    for(int c = 0; c < numDerived; ++c){
+        if(opts.derivedCols[c] != DERIVED_V_LOS and opts.derivedCols[c] != DERIVED_D){ 
+            needRotation = true; 
+        }
+    }
+    Select_kernel selectKernel = chooseSelectKernel(
+        !volumeCut ? SHAPE_FIELD : (opts.volumeBox ? SHAPE_BOX : SHAPE_SPHERE), needRotation);
+
+    for (int i=0; ; ++i){
+        
+        // when out of steps, wait for the simulation to write more if watching
+        if(i == step_strings.size()){
+            if(opts.watchPoll == 0 or !waitForSteps(dir_name, opts, manifest, myrank)){ break; }
+            step_strings = manifest.steps;
+        }
    
         // time read in 
         MPI_Barrier(MPI_COMM_WORLD);
@@ -811,30 +3224,14 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         step =atoi(step_strings[i].c_str());
         if(step == 499){ continue;}
 
-        // find header file
-        string file_name;
-        int fname_size;
-        ostringstream file_name_stream;
-        file_name_stream << dir_name << subdirPrefix << step_strings[i]; 
-        
+        // header file, from the step manifest
         if(myrank == 0){
             cout << "\n=================================================" << endl;
             cout << "============== Working on step "<< step_strings[i] <<" ==============\n" << endl; 
-           
-            if(myrank == 0){ cout << "getting lc file..." << endl; } 
-            
-            getLCFile(file_name_stream.str(), file_name);
-            fname_size = file_name.size();
+            cout << manifest.numElems[i] << " particles in " << manifest.numBlocks[i] << " blocks" << endl;
         } 
-            
-        MPI_Barrier(MPI_COMM_WORLD); 
-        if(myrank == 0){ cout << "brodcasting file name..." << endl; } 
-        MPI_Barrier(MPI_COMM_WORLD); 
-        
-        MPI_Bcast(&fname_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
-        if(myrank != 0){ file_name.resize(fname_size); }
-        MPI_Bcast(const_cast<char*>(file_name.data()), fname_size, MPI_CHAR, 0, MPI_COMM_WORLD);
-        file_name_stream << "/" << file_name; 
+        ostringstream file_name_stream;
+        file_name_stream << manifest.headers[i]; 
         
 
         ///////////////////////////////////////////////////////////////
@@ -859,80 +3256,131 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         if(myrank == 0){ cout << "done setting up gio..." << endl; } 
         MPI_Barrier(MPI_COMM_WORLD); 
 
-        // create gio reader, open lightcone file header in new scope
-        {
-            MPI_Barrier(MPI_COMM_WORLD); 
-            if(myrank == 0){ cout << "Opening file: " << file_name_stream.str() << endl; }
-            MPI_Barrier(MPI_COMM_WORLD); 
+        // Only reader ranks open the file (see makeReaderComm()); the rest start out 
+        // empty, and receive their share of the data in the redistribution below
+        MPI_Barrier(MPI_COMM_WORLD); 
+        if(myrank == 0){ cout << "Opening file: " << file_name_stream.str() << endl; }
+        MPI_Barrier(MPI_COMM_WORLD); 
+        
+        // if requested, try loading this rank's sorted particles from the step cache, as 
+        // left by an earlier run over the same step (see stepCacheKey()). The step is 
+        // only skipped if every rank finds its entry; otherwise, it is read as usual, 
+        // and the cache rewritten once sorted
+        bool cached = false;
+        string cache_key;
+        string cache_file;
+        vector<particle_pos> cached_particles_pos;
+        vector<char> cached_rows;
+        if(!opts.cacheDir.empty()){
+            cache_key = stepCacheKey(dir_name, manifest, i, schema, needVel, opts, numranks, myrank);
+            cache_file = stepCacheFile(opts.cacheDir, cache_key, step_strings[i], myrank);
+            int hit = loadStepCache(cache_file, cache_key, schema, cached_particles_pos, cached_rows);
+            MPI_Allreduce(MPI_IN_PLACE, &hit, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+            cached = hit;
+            if(!cached){
+                vector<particle_pos>().swap(cached_particles_pos);
+                vector<char>().swap(cached_rows);
+            }
+            if(myrank == 0){ cout << (cached ? "Loaded step from cache" : "Step not in cache") << endl; }
+        }
+        
+        // if requested, try reading from memory-mapped pages, applying the footprint
+        // mask as particles are read. If any reader can't, the step is read with 
+        // GenericIO instead
+        bool mapped = false;
+        size_t Np_read = 0;
+        if(opts.mmapInput and !cached){
+            int ok = 1;
+            if(isReader){
+                int readerRank, numReaders;
+                MPI_Comm_rank(reader_comm, &readerRank);
+                MPI_Comm_size(reader_comm, &numReaders);
+                ok = readMappedStep(file_name_stream.str(), schema, useMask ? &mask : NULL, 
+                                    blockStride, readerRank, numReaders, myrank, r, Np, Np_read);
+            }
+            MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+            mapped = ok;
             
-            GenericIO GIO(MPI_COMM_WORLD, file_name_stream.str(), Method);
-            GIO.openAndReadHeader(GenericIO::MismatchRedistribute);
-
-            MPI_Barrier(MPI_COMM_WORLD);
-            Np = GIO.readNumElems();
-           
-            // resize buffers   
-            r.x.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.y.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.z.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.a.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-            r.id.resize(Np + GIO.requestedExtraSpace()/sizeof(ID_T));
-            if(!positionOnly){
-                r.vx.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-                r.vy.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-                r.vz.resize(Np + GIO.requestedExtraSpace()/sizeof(POSVEL_T));
-                r.rotation.resize(Np + GIO.requestedExtraSpace()/sizeof(int));
-                r.replication.resize(Np + GIO.requestedExtraSpace()/sizeof(int32_t));
-            }
-
-            // do reading
-            GIO.addVariable("x", r.x, true); 
-            GIO.addVariable("y", r.y, true); 
-            GIO.addVariable("z", r.z, true); 
-            GIO.addVariable("a", r.a, true); 
-            GIO.addVariable("id", r.id, true); 
-            if(!positionOnly){
-                GIO.addVariable("vx", r.vx, true); 
-                GIO.addVariable("vy", r.vy, true); 
-                GIO.addVariable("vz", r.vz, true); 
-                GIO.addVariable("rotation", r.rotation, true); 
-                GIO.addVariable("replication", r.replication, true);
-            }
-
-            GIO.readData(); 
-        }
-
-        // resize again to remove reader extra space
-        r.x.resize(Np);
-        r.y.resize(Np);
-        r.z.resize(Np);
-        r.a.resize(Np);
-        r.id.resize(Np);
-        if(!positionOnly){
-            r.vx.resize(Np);
-            r.vy.resize(Np);
-            r.vz.resize(Np);
-            r.rotation.resize(Np);
-            r.replication.resize(Np);
-        }
-        if(myrank == 0){ cout<<"done resizing"<<endl; }
-        
-        // calc d, theta, and phi per particle
-        r.d.resize(Np);
-        r.theta.resize(Np);
-        r.phi.resize(Np);    
-        for (int n=0; n<Np; ++n) {
-            // spherical coordinate transformation
-            r.d[n] = (float)sqrt( r.x[n]*r.x[n] + r.y[n]*r.y[n] + r.z[n]*r.z[n]);
-            r.theta[n] = acos(r.z[n]/r.d[n]) * 180.0 / PI * ARCSEC;
+            // the particle count can only be checked if every block was read
+            if(mapped){
+                if(blockStride == 1){
+                    size_t totalNp_read;
+                    MPI_Allreduce(&Np_read, &totalNp_read, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+                    if(totalNp_read != manifest.numElems[i]){
+                        if(myrank == 0){ 
+                            cout << "\nMapped read found " << totalNp_read << " of " << 
+                                    manifest.numElems[i] << " particles in " << 
+                                    file_name_stream.str() << endl; 
+                        }
+                        MPI_Abort(MPI_COMM_WORLD, 0);
+                    }
+                }
+            }else{
+                if(myrank == 0){ cout << "Input can't be memory-mapped; reading with GenericIO" << endl; }
+                r = Buffers_read();
+                Np = 0;
+            }
+        }
+        
+        // if requested, read one block at a time, applying the footprint mask as each
+        // block is read. Previews, which only read some of the blocks, are always read 
+        // this way, unless mapped
+        bool streamed = ((opts.streamInput or blockStride > 1) and !mapped and !cached);
+        if(isReader and streamed){
+            int readerRank, numReaders;
+            MPI_Comm_rank(reader_comm, &readerRank);
+            MPI_Comm_size(reader_comm, &numReaders);
+            readStreamedStep(file_name_stream.str(), Method, schema, useMask ? &mask : NULL, 
+                             blockStride, readerRank, numReaders, myrank, r, Np, Np_read);
+        }
+        
+        // or, if a store was given, read the tiles of the store which intersect the 
+        // footprints, already balanced across all ranks
+        bool stored = !opts.storeDir.empty();
+        if(stored){
+            ostringstream store_subdir;
+            store_subdir << opts.storeDir << subdirPrefix << "Store" << step_strings[i] << "/";
+            resolveColumnSchema(storeColumns, schema, myrank);
+            readStoreStep(store_subdir.str(), step, schema, storeTiles, myrank, numranks, r, Np);
+        }
+        
+        // or, if a parent cutout was given, read an even share of it on every rank
+        bool recut = !opts.cutoutDir.empty();
+        if(recut){
+            ostringstream parent_subdir;
+            parent_subdir << opts.cutoutDir << subdirPrefix << "Cutout" << step_strings[i] << "/";
+            resolveColumnSchema(parentColumns, schema, myrank);
+            readCutoutStep(parent_subdir.str(), step, schema, myrank, numranks, r, Np);
+        }
+        bool balanced = (stored or recut or cached);
+        
+        // otherwise, read the whole step with GenericIO
+        if(isReader and !mapped and !streamed and !balanced){
+            readGIOStep(reader_comm, file_name_stream.str(), Method, schema, myrank, r, Np);
+        }
+        if(reader_comm != MPI_COMM_WORLD){ bcastColumnSchema(schema); }
+
+        if(!mapped and !streamed){
+            // resize again to remove reader extra space
+            r.x.resize(Np);
+            r.y.resize(Np);
+            r.z.resize(Np);
+            r.a.resize(Np);
+            r.id.resize(Np);
+            r.extra.resize(numExtra);
+            for(int c = 0; c < numExtra; ++c){
+                r.extra[c].resize(Np*schema.extra[c].size);
+            }
+            if(myrank == 0){ cout<<"done resizing"<<endl; }
             
-            // prevent NaNs on y-z plane
-            if(r.x[n] == 0 && r.y[n] > 0)
-                r.phi[n] = 90.0 * ARCSEC;
-            else if(r.x[n] == 0 && r.y[n] < 0)
-                r.phi[n] = -90.0 * ARCSEC;
-            else
-                r.phi[n] = atan(r.y[n]/r.x[n]) * 180.0 / PI * ARCSEC;
+            // calc d, theta, and phi per particle
+            r.d.resize(Np);
+            r.theta.resize(Np);
+            r.phi.resize(Np);    
+            for (int n=0; n<Np; ++n) {
+                toSpherical(r.x[n], r.y[n], r.z[n], r.d[n], r.theta[n], r.phi[n]);
+            }
+            Np_read = Np;
         }
 
         MPI_Barrier(MPI_COMM_WORLD);
@@ -942,6 +3390,63 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         if(myrank == 0 and timeit == true){ cout << "Read time: " << duration << " s" << endl; }
         read_times.push_back(duration);
         
+        if(blockStride > 1){
+            size_t totalNp_read;
+            MPI_Reduce(&Np_read, &totalNp_read, 1, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+            if(myrank == 0){
+                double fraction = (double)totalNp_read / max(manifest.numElems[i], (int64_t)1);
+                cout << "Preview read " << totalNp_read << " of " << manifest.numElems[i] << 
+                        " particles (" << fraction << " of the step)" << endl;
+                ofstream preview_file((opts.outDir + "preview.csv").c_str(), ios::app);
+                preview_file << step << ", " << blockStride << ", " << totalNp_read << ", " << 
+                                manifest.numElems[i] << ", " << fraction << "\n";
+            }
+        }
+
+        // while every particle in the step is in memory, bin them into a full-sky
+        // HEALPix count map, if requested. This is timed separately from the read
+        if(opts.healpixNside > 0){
+            MPI_Barrier(MPI_COMM_WORLD);
+            start = MPI_Wtime();
+            
+            vector<int64_t> countMap;
+            accumulateCountMap(r.x, r.y, r.z, Np, opts.healpixNside, countMap);
+            writeCountMap(opts.outDir, step, opts.healpixNside, countMap, myrank);
+            
+            MPI_Barrier(MPI_COMM_WORLD);
+            stop = MPI_Wtime();
+            duration = stop - start;
+            if(myrank == 0 and timeit == true){ cout << "HEALPix map time: " << duration << " s" << endl; }
+            map_times.push_back(duration);
+        }
+
+        // drop particles outside of every cutout footprint, if not done while reading
+        if(useMask){
+            if(!mapped and !streamed){ Np = filterReadBuffers(r, Np, mask); }
+            
+            size_t Np_kept[2] = {Np_read, Np};
+            size_t totalNp_kept[2];
+            MPI_Reduce(Np_kept, totalNp_kept, 2, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+            if(myrank == 0){ 
+                cout << "Kept " << totalNp_kept[1] << " of " << totalNp_kept[0] << 
+                        " particles within the cutout footprints" << endl; 
+            }
+        }
+
+        // restrict to the requested particle ids, if any, before anything is redistributed
+        if(opts.useIdFilter){
+            size_t Np_before = Np;
+            Np = filterReadBuffers(r, Np, opts.idFilter);
+            
+            size_t Np_kept[2] = {Np_before, Np};
+            size_t totalNp_kept[2];
+            MPI_Reduce(Np_kept, totalNp_kept, 2, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+            if(myrank == 0){ 
+                cout << "Kept " << totalNp_kept[1] << " of " << totalNp_kept[0] << 
+                        " particles matching the id list" << endl; 
+            }
+        }
+        
 
         ///////////////////////////////////////////////////////////////
         //
@@ -977,8 +3482,10 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
 
         if(myrank == 0){
             cout << "Total number of particles is " << totalNp << endl;
-            cout << "Redistributing particles to all from " << numranks - num_readNone << 
-                    " of " << numranks << " ranks" << endl;
+            if(!balanced){
+                cout << "Redistributing particles to all from " << numranks - num_readNone << 
+                        " of " << numranks << " ranks" << endl;
+            }
         }   
          
         vector<int> even_redistribute;
@@ -986,71 +3493,98 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         vector<int> redist_recv_count(numranks);
         vector<int> redist_send_offset(numranks);
         vector<int> redist_recv_offset(numranks);
+        vector<int> redist_slot;
         
-        // compute number of particles to send to each other rank
-        comp_rank_scatter(Np, even_redistribute, numranks);
-        for(int ri = 0; ri < numranks; ++ri){
-            redist_send_count[ri] = count(&even_redistribute[0], &even_redistribute[Np], ri);
-        }
+        // compute number of particles to send to each other rank, and where each goes in 
+        // the send buffers (see exchangeSlots() in util.cpp). Particles read from a store 
+        // or parent cutout are already balanced, and stay where they are
+        if(balanced){ even_redistribute.assign(Np, myrank); }
+        else{ comp_rank_scatter(Np, even_redistribute, numranks); }
+        exchangeSlots(even_redistribute, numranks, redist_send_count, redist_send_offset, 
+                      redist_slot);
         
         // get number of particles to recieve from every other rank
         MPI_Alltoall(&redist_send_count[0], 1, MPI_INT, &redist_recv_count[0], 1, MPI_INT, MPI_COMM_WORLD);
 
-        // compute sending+recieving offsets to/from each other rank
+        // compute recieving offsets from each other rank
         for(int ri=1; ri < numranks; ++ri){
-            redist_send_offset[ri] = redist_send_offset[ri-1] + redist_send_count[ri-1];
             redist_recv_offset[ri] = redist_recv_offset[ri-1] + redist_recv_count[ri-1];
         }
 
-        // pack GIO data vectors into particle structs to be distributed by alltoallv
-        // ("particle_pos" and "particle_vel" structs defined in util.h) 
-        vector<particle_pos> send_particles_pos;
-        vector<particle_vel> send_particles_vel;
+        // pack GIO data vectors into particle structs, and the exchanged non-core columns
+        // into rows of raw bytes, to be distributed by alltoallv ("particle_pos" struct and 
+        // "Column_schema" defined in util.h). Each particle is placed directly into the 
+        // segment of the send buffers for its destination rank, as given by
+        // even_redistribute, so that the send+offset pairs give the expected result, and 
+        // the n-th row always belongs to the n-th particle struct. Particles are packed by
+        // all OpenMP threads, as their slots are known in advance
+        vector<particle_pos> send_particles_pos(Np);
+        vector<char> send_rows((size_t)Np * schema.rowSize);
         vector<particle_pos> recv_particles_pos;
-        vector<particle_vel> recv_particles_vel;
-     
+        vector<char> recv_rows;
+        
+        int ivx = findColumn(schema, "vx");
+        int ivy = findColumn(schema, "vy");
+        int ivz = findColumn(schema, "vz");
+        
+        #pragma omp parallel for schedule(static)
         for(int n = 0; n < Np; ++n){
             
+            int slot = redist_slot[n];
+            
+            // line-of-sight velocity, computed here so that it can be carried 
+            // without the full velocity vector
+            POSVEL_T v_los = 0;
+            if(needVel and r.d[n] > 0){
+                double vx = columnValue(schema.extra[ivx], &r.extra[ivx][(size_t)n*schema.extra[ivx].size]);
+                double vy = columnValue(schema.extra[ivy], &r.extra[ivy][(size_t)n*schema.extra[ivy].size]);
+                double vz = columnValue(schema.extra[ivz], &r.extra[ivz][(size_t)n*schema.extra[ivz].size]);
+                v_los = (r.x[n]*vx + r.y[n]*vy + r.z[n]*vz) / r.d[n];
+            }
+            
             particle_pos nextParticle_pos = {r.x[n], r.y[n], r.z[n], r.d[n], r.theta[n], 
-                                             r.phi[n], r.a[n], r.id[n], even_redistribute[n]};
-            send_particles_pos.push_back(nextParticle_pos);
+                                             r.phi[n], r.a[n], r.id[n], even_redistribute[n], 
+                                             v_los};
+            send_particles_pos[slot] = nextParticle_pos;
             
-            if(!positionOnly){
-                particle_vel nextParticle_vel = {r.vx[n], r.vy[n], r.vz[n], 
-                                                 r.rotation[n], r.replication[n], 
-                                                 even_redistribute[n]};
-                send_particles_vel.push_back(nextParticle_vel);
-            }
-        }
-
-        recv_particles_pos.resize(redist_recv_offset.back() + redist_recv_count.back());
-        if(!positionOnly)
-            recv_particles_vel.resize(redist_recv_offset.back() + redist_recv_count.back());
-
-        // now we need to sort our particle data by it's destination rank. As an example;
-        // if Np = 12 and numranks = 4, then the above call to comp_rank_scatter will result in
-        // even_redistribute = {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3}, 
-        // which indicates the receiving rank of each particle at position i. In the most recent
-        // loop above, we filled the particle struct "myrank" field with the contents of 
-        // even_redistribute. So, we can sort the particle objects by that field, in order for our
-        // send+offset pair to give the expected result 
-        sort(send_particles_pos.begin(), send_particles_pos.end(), comp_rank<particle_pos>);
-        if(!positionOnly)
-            sort(send_particles_vel.begin(), send_particles_vel.end(), comp_rank<particle_vel>);
-
-        // OK, all read, now to redsitribute the particles evely-ish across ranks
-        MPI_Alltoallv(&send_particles_pos[0], &redist_send_count[0], &redist_send_offset[0], particles_mpi_pos,
-                      &recv_particles_pos[0], &redist_recv_count[0], &redist_recv_offset[0], particles_mpi_pos, 
-                      MPI_COMM_WORLD);
-        if(!positionOnly)
-            MPI_Alltoallv(&send_particles_vel[0], &redist_send_count[0], &redist_send_offset[0], particles_mpi_vel,
-                          &recv_particles_vel[0], &redist_recv_count[0], &redist_recv_offset[0], particles_mpi_vel, 
+            for(int c = 0; c < numExtra; ++c){
+                const Column_info &col = schema.extra[c];
+                if(!col.exchange){ continue; }
+                memcpy(&send_rows[(size_t)slot*schema.rowSize + col.rowOffset], 
+                       &r.extra[c][(size_t)n*col.size], col.size);
+            }
+        }
+        
+        // the raw read buffers are no longer needed
+        r = Buffers_read();
+
+        if(cached){
+            recv_particles_pos.swap(cached_particles_pos);
+            recv_rows.swap(cached_rows);
+        }else if(balanced){
+            recv_particles_pos.swap(send_particles_pos);
+            recv_rows.swap(send_rows);
+        }else{
+            recv_particles_pos.resize(redist_recv_offset.back() + redist_recv_count.back());
+            recv_rows.resize((size_t)recv_particles_pos.size() * schema.rowSize);
+
+            // OK, all read, now to redsitribute the particles evely-ish across ranks
+            MPI_Alltoallv(&send_particles_pos[0], &redist_send_count[0], &redist_send_offset[0], particles_mpi_pos,
+                          &recv_particles_pos[0], &redist_recv_count[0], &redist_recv_offset[0], particles_mpi_pos, 
                           MPI_COMM_WORLD);
+            if(schema.rowSize > 0){
+                MPI_Datatype particles_mpi_row = createParticles_row(schema.rowSize);
+                MPI_Alltoallv(send_rows.data(), &redist_send_count[0], &redist_send_offset[0], particles_mpi_row,
+                              recv_rows.data(), &redist_recv_count[0], &redist_recv_offset[0], particles_mpi_row, 
+                              MPI_COMM_WORLD);
+                MPI_Type_free(&particles_mpi_row);
+            }
+        }
         
         // particles now redistributed; find new Np to verify all particles accounted for
-        send_particles_pos.clear();
-        send_particles_vel.clear();
-        Np = redist_recv_offset.back() + redist_recv_count.back(); 
+        vector<particle_pos>().swap(send_particles_pos);
+        vector<char>().swap(send_rows);
+        Np = recv_particles_pos.size(); 
          
         vector<size_t> Np_recv_per_rank(numranks); 
         MPI_Allgather(&Np, 1, MPI_INT64_T, &Np_recv_per_rank[0], 1, MPI_INT64_T, 
@@ -1087,15 +3621,44 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         MPI_Barrier(MPI_COMM_WORLD);
         start = MPI_Wtime();
         
-        // arg sort to map new ordering to recv_particles_vel 
-        vector<int> theta_argSort(Np);
-        int idx=0;
-        std::iota(theta_argSort.begin(), theta_argSort.end(), idx++);
-        stable_sort(theta_argSort.begin(), theta_argSort.end(), 
-             [&](int n, int m){return recv_particles_pos[n].theta < recv_particles_pos[m].theta;} );
+        // The sort only serves that binary search for each halo's rough theta bounds. With 
+        // few halos for the particles held (such as a single halo from -h), scanning all
+        // of them per halo, split over the threads (see selectParallel()), costs less 
+        // than sorting them, and volume cutouts search a 3D index instead, so the sort 
+        // is skipped, unless the sorted particles are cached
+        bool scanned = opts.cacheDir.empty() and 
+                       (volumeCut or numHalos < log2(max(totalNp / numranks, (size_t)2)));
+        if(myrank == 0 and scanned and !volumeCut){ 
+            cout << "Scanning all particles for " << numHalos << " halo(s), rather than sorting" << endl; 
+        }
+        
+        // arg sort by theta, then apply that ordering to both the particle structs and 
+        // the rows of non-core columns, so that they stay aligned. Cached particles 
+        // are already sorted
+        if(!cached and !scanned){
+            vector<int> theta_argSort(Np);
+            std::iota(theta_argSort.begin(), theta_argSort.end(), 0);
+            stable_sort(theta_argSort.begin(), theta_argSort.end(), 
+                 [&](int n, int m){return recv_particles_pos[n].theta < recv_particles_pos[m].theta;} );
         
-        // sort recv_particles_pos such that theta is in ascending order
-        stable_sort(recv_particles_pos.begin(), recv_particles_pos.end(), comp_by_theta);
+            vector<particle_pos> sorted_particles_pos(Np);
+            #pragma omp parallel for schedule(static)
+            for(int n = 0; n < Np; ++n){
+                sorted_particles_pos[n] = recv_particles_pos[theta_argSort[n]];
+            }
+            recv_particles_pos.swap(sorted_particles_pos);
+            vector<particle_pos>().swap(sorted_particles_pos);
+
+            if(schema.rowSize > 0){
+                vector<char> sorted_rows(recv_rows.size());
+                #pragma omp parallel for schedule(static)
+                for(int n = 0; n < Np; ++n){
+                    memcpy(&sorted_rows[(size_t)n*schema.rowSize], 
+                           &recv_rows[(size_t)theta_argSort[n]*schema.rowSize], schema.rowSize);
+                }
+                recv_rows.swap(sorted_rows);
+            }
+        }
         
         MPI_Barrier(MPI_COMM_WORLD);
         stop = MPI_Wtime(); 
@@ -1103,6 +3666,228 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         if(myrank == 0 and timeit == true){ cout << "Particle sort time: " << duration << " s" << endl; }
         sort_times.push_back(duration);
         
+        if(!opts.cacheDir.empty() and !cached){
+            saveStepCache(cache_file, cache_key, schema, recv_particles_pos, recv_rows);
+        }
+
+        // find the sky coverage of this step, on all ranks, and the halos whose rough
+        // footprints don't touch it (e.g. outside of an octant or survey patch). These 
+        // can't hold any particles, so skip the search, directory preparation, and 
+        // collective writes below
+        Footprint_mask occupancy;
+        buildOccupancyMask(recv_particles_pos, occupancy);
+        MPI_Allreduce(MPI_IN_PLACE, &occupancy.cells[0], occupancy.cells.size(), MPI_UINT8_T, 
+                      MPI_BOR, MPI_COMM_WORLD);
+        
+        vector<char> haloCovered(numHalos);
+        int numUncovered = 0;
+        for(int h = 0; h < numHalos; ++h){
+            haloCovered[h] = footprintOverlaps(occupancy, theta_cut_rough[2*h], theta_cut_rough[2*h+1],
+                                               phi_cut_rough[2*h], phi_cut_rough[2*h+1]);
+            if(!haloCovered[h]){ numUncovered++; }
+        }
+        if(myrank == 0 and numUncovered > 0){
+            cout << "Skipping " << numUncovered << " of " << numHalos << 
+                    " halos outside of the step's sky coverage" << endl;
+            if(opts.markEmpty){
+                ofstream empty((opts.outDir + "empty_halos.csv").c_str(), ios::app);
+                for(int h = 0; h < numHalos; ++h){
+                    if(!haloCovered[h]){ empty << step_strings[i] << ", " << out_dirs[h] << "\n"; }
+                }
+            }
+        }
+
+        // all of this ranks recieved particles were sorted by their "theta" attribute, so
+        // the particles within the rough theta bounds of each halo and group are found by
+        // binary search. Do those searches for all of them at once, through a compact 
+        // index of the theta keys, rather than over the particles themselves per halo.
+        // If the sort was skipped, every halo and group ranges over all particles
+        vector<int> haloRanges;
+        vector<int> groupRanges;
+        if(scanned){
+            for(int h = 0; h < numHalos; ++h){
+                haloRanges.push_back(0);
+                haloRanges.push_back(Np);
+            }
+            for(int g = 0; g < group_theta_rough.size(); ++g){
+                groupRanges.push_back(0);
+                groupRanges.push_back(Np);
+            }
+        }else{
+            Theta_index thetaIndex;
+            buildThetaIndex(recv_particles_pos, thetaIndex);
+            thetaRanges(thetaIndex, theta_cut_rough, haloRanges);
+            
+            vector<float> group_bounds;
+            for(int g = 0; g < group_theta_rough.size(); ++g){ 
+                group_bounds.insert(group_bounds.end(), group_theta_rough[g].begin(), 
+                                    group_theta_rough[g].begin() + 2);
+            }
+            thetaRanges(thetaIndex, group_bounds, groupRanges);
+        }
+        
+        // for volume cutouts, index the particles in 3D instead, on cells the size of the
+        // cutouts, so that each halo's candidates are found in a few runs of cells
+        Cell_index cellIndex;
+        if(volumeCut){ buildCellIndex(recv_particles_pos, opts.volumeRadius, cellIndex); }
+        
+
+        ///////////////////////////////////////////////////////////////
+        //
+        //         Loop over groups of overlapping target halos
+        //
+        ///////////////////////////////////////////////////////////////
+
+        // Each group is cut out in one pass over the union of its members' rough theta 
+        // bounds. Every particle inside any member's field of view is written once to 
+        // the group store, with only those columns which don't depend on the frame of
+        // a particular halo, and a bitmask of the members that contain it
+        for(int g = 0; g < groupMembers.size(); ++g){
+            
+            int error = 0;
+            const vector<int> &members = groupMembers[g];
+            int numMembers = members.size();
+            
+            int numCovered = 0;
+            for(int m = 0; m < numMembers; ++m){ numCovered += haloCovered[members[m]]; }
+            if(numCovered == 0){ continue; }
+            printHalo = (groupMembers.size() < 20) | (g%100==0) ? 1:0;
+            if(myrank == 0 and printHalo){
+                cout<< "\n---------- cutout at halo group "<< g << " (" << numMembers << 
+                       " halos) ----------" << endl; 
+            }
+
+            Buffers_write w;
+            w.derived.resize(numDerived);
+            w.extra.resize(numExtra);
+            vector<uint64_t> membership;
+
+            ostringstream step_subdir;
+            step_subdir << groupDirs[g] << subdirPrefix << "Cutout" << step_strings[i];
+            if(myrank == 0){ 
+                error = prepStepSubdir(step_subdir.str(), overwrite, printHalo, verbose);
+            }
+            MPI_Bcast(&error, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            if(error == 1){ 
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+            }
+            else if(error == 2){ continue; }
+            
+            // time cutout computation 
+            MPI_Barrier(MPI_COMM_WORLD);
+            start = MPI_Wtime();
+            
+            int cutout_size = 0;
+
+            int minN = groupRanges[2*g];
+            int maxN = groupRanges[2*g+1];
+            
+            for (int n=minN; n<maxN; ++n) {
+                
+                float theta = recv_particles_pos[n].theta;
+                float phi = recv_particles_pos[n].phi;
+                
+                // find which members' fields of view contain this particle
+                uint64_t mask = 0;
+                for(int m = 0; m < numMembers; ++m){
+                    int haloIdx = members[m];
+                    if(theta < theta_cut_rough[2*haloIdx] or theta > theta_cut_rough[2*haloIdx+1] or
+                       phi <= phi_cut_rough[2*haloIdx] or phi >= phi_cut_rough[2*haloIdx+1]){ continue; }
+                    
+                    float v_rot[3];
+                    float v_theta;
+                    float v_phi;
+                    if(inHaloCutout(recv_particles_pos[n], &geo.R[9*haloIdx], theta_cut, phi_cut, 
+                                    v_rot, v_theta, v_phi)){
+                        mask |= (uint64_t)1 << m;
+                    }
+                }
+                if(mask == 0){ continue; }
+                
+                membership.push_back(mask);
+                w.x.push_back(recv_particles_pos[n].x);
+                w.y.push_back(recv_particles_pos[n].y);
+                w.z.push_back(recv_particles_pos[n].z);
+                w.id.push_back(recv_particles_pos[n].id);
+                if(schema.writeCore[CORE_REDSHIFT]){ w.redshift.push_back(aToZ(recv_particles_pos[n].a)); }
+                
+                for(int c = 0; c < numExtra; ++c){
+                    const Column_info &col = schema.extra[c];
+                    if(!col.exchange){ continue; }
+                    const char *val = &recv_rows[(size_t)n*schema.rowSize + col.rowOffset];
+                    w.extra[c].insert(w.extra[c].end(), val, val + col.size);
+                }
+                for(int c = 0; c < numDerived; ++c){
+                    if(opts.derivedCols[c] == DERIVED_V_LOS){ w.derived[c].push_back(recv_particles_pos[n].v_los); }
+                    else if(opts.derivedCols[c] == DERIVED_D){ w.derived[c].push_back(recv_particles_pos[n].d); }
+                }
+                cutout_size++;
+            }
+            
+            MPI_Barrier(MPI_COMM_WORLD);
+            stop = MPI_Wtime();
+            duration = stop - start;
+            if(myrank == 0 and timeit==true and printHalo){
+                cout << "cutout computation time: " << duration << " s" << endl; 
+            }
+            cutout_times.push_back(duration);
+            
+            // time write out 
+            MPI_Barrier(MPI_COMM_WORLD);
+            start = MPI_Wtime();
+            
+            w.np_count.resize(numranks);
+            w.np_offset.resize(numranks);
+            MPI_Allgather(&cutout_size, 1, MPI_INT, &w.np_count[0], 1, MPI_INT, MPI_COMM_WORLD);
+            for(int j=1; j < numranks; ++j){
+                w.np_offset[j] = w.np_offset[j-1] + w.np_count[j-1];
+            }
+            if(myrank == 0 and printHalo){
+                int totalMembers = accumulate(w.np_count.begin(), w.np_count.end(), 0);
+                cout << totalMembers << " unique particles found in group fields of view" << endl;
+                cout << "Writing files..." << endl;
+            }
+            
+            MPI_Offset offset_posvel = sizeof(POSVEL_T) * w.np_offset[myrank];
+            MPI_Offset offset_id = sizeof(ID_T) * w.np_offset[myrank];
+            MPI_Offset offset_float = sizeof(float) * w.np_offset[myrank];
+            string pre = step_subdir.str() + "/";
+            ostringstream file_name_suffix;
+            file_name_suffix << "." << step << ".bin";
+            string suf = file_name_suffix.str();
+
+            writeColumn(pre + "membership" + suf, &membership[0], membership.size(), MPI_UINT64_T, 
+                        sizeof(uint64_t) * w.np_offset[myrank]);
+            writeColumn(pre + "id" + suf, &w.id[0], w.id.size(), MPI_INT64_T, offset_id);
+            writeColumn(pre + "x" + suf, &w.x[0], w.x.size(), MPI_FLOAT, offset_posvel);
+            writeColumn(pre + "y" + suf, &w.y[0], w.y.size(), MPI_FLOAT, offset_posvel);
+            writeColumn(pre + "z" + suf, &w.z[0], w.z.size(), MPI_FLOAT, offset_posvel);
+            if(schema.writeCore[CORE_REDSHIFT]){
+                writeColumn(pre + "redshift" + suf, &w.redshift[0], w.redshift.size(), MPI_FLOAT, 
+                            offset_posvel);
+            }
+            for(int c = 0; c < numExtra; ++c){
+                const Column_info &col = schema.extra[c];
+                if(!col.exchange){ continue; }
+                writeColumn(pre + col.name + suf, w.extra[c].data(), w.extra[c].size(), MPI_BYTE, 
+                            (MPI_Offset)col.size * w.np_offset[myrank]);
+            }
+            for(int c = 0; c < numDerived; ++c){
+                if(opts.derivedCols[c] != DERIVED_V_LOS and opts.derivedCols[c] != DERIVED_D){ continue; }
+                writeColumn(pre + derivedColumnName(opts.derivedCols[c]) + suf, &w.derived[c][0], 
+                            w.derived[c].size(), MPI_FLOAT, offset_float);
+            }
+            
+            MPI_Barrier(MPI_COMM_WORLD);
+            stop = MPI_Wtime();
+            duration = stop - start;
+            if(myrank == 0 and timeit == true and printHalo){ 
+                cout << "write time: " << duration << " s" << endl; 
+            }
+            write_times.push_back(duration);
+        }
+
 
         ///////////////////////////////////////////////////////////////
         //
@@ -1115,6 +3900,13 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
             
             int error = 0; 
             int haloIdx = h/3;
+
+            // halos in a group of overlapping footprints were cut out above
+            if(haloGroup[haloIdx] >= 0){ continue; }
+            
+            // as are halos outside of the step's coverage, which would be empty
+            if(!haloCovered[haloIdx]){ continue; }
+
             printHalo = (numHalos < 20) | (haloIdx%100==0) ? 1:0;
             if(myrank == 0 and printHalo){
                 cout<< "\n---------- cutout at halo "<< h/3 <<"----------" << endl; 
@@ -1129,6 +3921,11 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
             
             // instances of buffer struct at file header for output data
             Buffers_write w;
+            w.derived.resize(numDerived);
+            w.extra.resize(numExtra);
+            
+            // distance to the halo, which lies at (halo_r, 0, 0) after rotation
+            float halo_r = geo.halo_r[haloIdx];
 
             // open cutout subdirectory for this step...
             // if step subdir already exists, make sure it's empty, because overwriting
@@ -1151,32 +3948,11 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
             else if(error == 2){ continue; }
 
 
-            // create binary files for cutout output
-            MPI_File id_file, x_file, y_file, z_file, vx_file, vy_file, vz_file,
-                     redshift_file, theta_file, phi_file,
-                     rotation_file, replication_file;
-            
-            MPI_Request id_req, x_req, y_req, z_req, vx_req, vy_req, vz_req,
-                        redshift_req, theta_req, phi_req,
-                        rotation_req, replication_req;
-            
-            ostringstream id_file_name, x_file_name, y_file_name, z_file_name, 
-                          vx_file_name, vy_file_name, vz_file_name,
-                          redshift_file_name, theta_file_name, phi_file_name,
-                          rotation_file_name, replication_file_name;
-
-            id_file_name << step_subdir.str() << "/id." << step << ".bin";
-            redshift_file_name << step_subdir.str() << "/redshift." << step << ".bin";
-            x_file_name << step_subdir.str() << "/x."<< step <<".bin";
-            y_file_name << step_subdir.str() << "/y."<< step <<".bin";
-            z_file_name << step_subdir.str() << "/z."<< step <<".bin";
-            vx_file_name << step_subdir.str() << "/vx."<< step <<".bin";
-            vy_file_name << step_subdir.str() << "/vy."<< step <<".bin";
-            vz_file_name << step_subdir.str() << "/vz."<< step <<".bin";
-            rotation_file_name << step_subdir.str() << "/rotation."<< step <<".bin";
-            replication_file_name << step_subdir.str() << "/replication."<< step <<".bin";
-            theta_file_name << step_subdir.str() << "/theta." << step << ".bin";
-            phi_file_name << step_subdir.str() << "/phi." << step << ".bin";
+            // output file names are {column}.{step}.bin
+            ostringstream file_name_prefix;
+            file_name_prefix << step_subdir.str() << "/";
+            ostringstream file_name_suffix;
+            file_name_suffix << "." << step << ".bin";
 
             
             ///////////////////////////////////////////////////////////////
@@ -1191,122 +3967,36 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         
             // let's also time the computation per-rank
             clock_t thisRank_start = clock();
-            clock_t thisRank_end;
 
             if(myrank == 0 and printHalo){
                 cout << "converting positions..." << endl;
             }
             
-            int cutout_size = 0;
-            
-            // define vectors joining fov corners to particle (see comments/diagram above)
-            vector<float> AM(2);
-            vector<float> BM(2);
-        
-            // all of this ranks recieved particles were sorted, after read-in, by their 
-            // "theta" attribute. So, we can do a binary search for our rough theta bounds
-            // to limit our search to an annulus around the sky parallel to the equator...
-            particle_pos left_dummy;
-            left_dummy.theta = theta_cut_rough[haloIdx][0];
-            particle_pos right_dummy;
-            right_dummy.theta = theta_cut_rough[haloIdx][1];
-            
-            auto leftCut_iter = std::lower_bound(recv_particles_pos.begin(), recv_particles_pos.end(), 
-                                                 left_dummy, comp_by_theta);
-            auto rightCut_iter = std::upper_bound(recv_particles_pos.begin(), recv_particles_pos.end(), 
-                                                  right_dummy, comp_by_theta);
+            // the particles within our rough theta bounds, as found by the binary search
+            // above, limit our search to an annulus around the sky parallel to the equator...
+            int minN = haloRanges[2*haloIdx];
+            int maxN = haloRanges[2*haloIdx+1];
             
-            int minN = std::distance(recv_particles_pos.begin(), leftCut_iter);
-            int maxN = std::distance(recv_particles_pos.begin(), rightCut_iter);
+            // ...or, for volume cutouts, to the particles in the cells about the halo
+            vector<int> candidates;
+            if(volumeCut){ 
+                queryCellIndex(cellIndex, &halo_pos[h], opts.volumeRadius, candidates); 
+                sort(candidates.begin(), candidates.end());
+            }
+            int numCandidates = volumeCut ? candidates.size() : maxN - minN;
                             
-            auto posIdx_iter = std::find(theta_argSort.begin(), theta_argSort.end(), 0);
-            int posIdx = std::distance(theta_argSort.begin(), posIdx_iter);
+            // find the particles in the cutout (rotating them into the halo's frame, to
+            // return cluster-centric angular coordinates), and fill the output columns
+            Halo_selection sel;
+            selectParallel(selectKernel, recv_particles_pos, candidates.data(), minN, 
+                           numCandidates, &theta_cut_rough[2*haloIdx], &phi_cut_rough[2*haloIdx], 
+                           &geo.R[9*haloIdx], theta_cut, phi_cut, &halo_pos[h], 
+                           opts.volumeRadius, sel);
+            gatherHaloColumns(recv_particles_pos, recv_rows, schema, opts.derivedCols, halo_r, 
+                              sel, w);
+            int cutout_size = sel.n.size();
+            clock_t thisRank_end = clock();
             
-            // Now, brute force search on phi to finish rough cut out
-            for (int n=minN; n<maxN; ++n) {
-                
-                float d = recv_particles_pos[n].d; 
-                float theta = recv_particles_pos[n].theta;
-                float phi = recv_particles_pos[n].phi;
-
-                if (phi > phi_cut_rough[haloIdx][0] && phi < phi_cut_rough[haloIdx][1]) {
-                 
-                    // of the particles surviving the rough cut, let's do a proper rotation 
-                    // on them to find the true cutout memership, and return cluster-centric 
-                    // angular coordinates
-                    
-                    // do coordinate rotation center halo at (r, 90, 0)
-                    // B and k are the angle and axis of rotation, respectively,
-                    // calculated near the beginning of this function
-                    float tmp_v[] = {recv_particles_pos[n].x, recv_particles_pos[n].y, recv_particles_pos[n].z};
-                    vector<float> v(tmp_v, tmp_v+3);
-                    vector<float> v_rot;
-                    v_rot = matVecMul(R[haloIdx], v);
-
-                    // spherical coordinate transformation
-                    d = (float)sqrt(v_rot[0]*v_rot[0] + v_rot[1]*v_rot[1] + 
-                                    v_rot[2]*v_rot[2]);
-                    float v_theta = acos(v_rot[2]/d) * 180.0 / PI * ARCSEC;
-                    float v_phi;
-
-                    // prevent NaNs on y-z plane
-                    if(v_rot[0] == 0 && v_rot[1] > 0)
-                        v_phi = 90.0 * ARCSEC;
-                    else if(v_rot[0] == 0 && v_rot[1] < 0)
-                        v_phi = -90.0 * ARCSEC;
-                    else
-                        v_phi = atan(v_rot[1]/v_rot[0]) * 180.0 / PI * ARCSEC; 
-                 
-                    // do final cut
-                    if (v_theta > theta_cut[haloIdx][0] && v_theta < theta_cut[haloIdx][1] && 
-                        v_phi > phi_cut[haloIdx][0] && v_phi < phi_cut[haloIdx][1] ) {
-
-                        // get redshift from scale factor
-                        float zz = aToZ(recv_particles_pos[n].a);
-                        
-                        // spherical corrdinate transform of rotated positions
-                        w.theta.push_back(v_theta);
-                        w.phi.push_back(v_phi);
-
-                        // other columns
-                        w.x.push_back(recv_particles_pos[n].x);
-                        w.y.push_back(recv_particles_pos[n].y);
-                        w.z.push_back(recv_particles_pos[n].z);
-                        w.redshift.push_back(zz);
-                        w.id.push_back(recv_particles_pos[n].id);
-                        if(!positionOnly){
-                            
-                            // get index of matching entry in recv_particles_vel
-                            auto velIdx_iter = std::find(theta_argSort.begin(), theta_argSort.end(), n);
-                            int velIdx = std::distance(theta_argSort.begin(), velIdx_iter);
-                            
-                            w.vx.push_back(recv_particles_vel[theta_argSort[velIdx]].vx);
-                            w.vy.push_back(recv_particles_vel[theta_argSort[velIdx]].vy);
-                            w.vz.push_back(recv_particles_vel[theta_argSort[velIdx]].vz);
-                            w.rotation.push_back(recv_particles_vel[theta_argSort[velIdx]].rotation);
-                            w.replication.push_back(recv_particles_vel[theta_argSort[velIdx]].replication);
-                        }
-                        cutout_size++;
-                        thisRank_end = clock();
-
-                        /*
-                        // DEBUG
-                        // print out individual particle info
-
-                        if(myrank == 1){
-                            cout << endl << "Particle " << recv_particles_pos[n].id << ":   " << endl << 
-                            "x: " << recv_particles_pos[n].x << endl << 
-                            "y: " << recv_particles_pos[n].y << endl << 
-                            "z: " << recv_particles_pos[n].z << endl <<
-                            "a: " << recv_particles_pos[n].a << endl <<
-                            "rs: " << zz << endl <<
-                            "theta: " << v_theta << endl << 
-                            "phi: " << v_phi << endl; 
-                        }
-                        */
-                    }
-                }
-            }
             MPI_Barrier(MPI_COMM_WORLD);
             
             stop = MPI_Wtime();
@@ -1404,101 +4094,45 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
             MPI_Offset offset_posvel = sizeof(POSVEL_T) * w.np_offset[myrank];
             MPI_Offset offset_id = sizeof(ID_T) * w.np_offset[myrank];
             MPI_Offset offset_float = sizeof(float) * w.np_offset[myrank];
-            MPI_Offset offset_int = sizeof(int) * w.np_offset[myrank];
-            MPI_Offset offset_int32 = sizeof(int32_t) * w.np_offset[myrank];
-
-            // write... 
-            MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(id_file_name.str().c_str()), 
-                    MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &id_file);
-            MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(x_file_name.str().c_str()), 
-                    MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &x_file);
-            MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(y_file_name.str().c_str()),
-                    MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &y_file);
-            MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(z_file_name.str().c_str()),
-                    MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &z_file);
-            MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(theta_file_name.str().c_str()),
-                    MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &theta_file);
-            MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(phi_file_name.str().c_str()),
-                    MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &phi_file);
-            MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(redshift_file_name.str().c_str()),
-                    MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &redshift_file);
-            
-            MPI_File_seek(id_file, offset_id, MPI_SEEK_SET);
-            MPI_File_iwrite(id_file, &w.id[0], w.id.size(), MPI_INT64_T, &id_req);
-            MPI_Wait(&id_req, MPI_STATUS_IGNORE);
-
-            MPI_File_seek(x_file, offset_posvel, MPI_SEEK_SET);
-            MPI_File_iwrite(x_file, &w.x[0], w.x.size(), MPI_FLOAT, &x_req);
-            MPI_Wait(&x_req, MPI_STATUS_IGNORE);
+            string pre = file_name_prefix.str();
+            string suf = file_name_suffix.str();
 
-            MPI_File_seek(y_file, offset_posvel, MPI_SEEK_SET);
-            MPI_File_iwrite(y_file, &w.y[0], w.y.size(), MPI_FLOAT, &y_req);
-            MPI_Wait(&y_req, MPI_STATUS_IGNORE);
-            
-            MPI_File_seek(z_file, offset_posvel, MPI_SEEK_SET);
-            MPI_File_iwrite(z_file, &w.z[0], w.z.size(), MPI_FLOAT, &z_req);
-            MPI_Wait(&z_req, MPI_STATUS_IGNORE);
-            
-            MPI_File_seek(theta_file, offset_posvel, MPI_SEEK_SET);
-            MPI_File_iwrite(theta_file, &w.theta[0], w.theta.size(), MPI_FLOAT, &theta_req);
-            MPI_Wait(&theta_req, MPI_STATUS_IGNORE);
-            
-            MPI_File_seek(phi_file, offset_posvel, MPI_SEEK_SET);
-            MPI_File_iwrite(phi_file, &w.phi[0], w.phi.size(), MPI_FLOAT, &phi_req);
-            MPI_Wait(&phi_req, MPI_STATUS_IGNORE);
-            
-            MPI_File_seek(redshift_file, offset_posvel, MPI_SEEK_SET);
-            MPI_File_iwrite(redshift_file, &w.redshift[0], w.redshift.size(), MPI_FLOAT, &redshift_req);
-            MPI_Wait(&redshift_req, MPI_STATUS_IGNORE);
-            
-            MPI_File_close(&id_file);
-            MPI_File_close(&x_file);
-            MPI_File_close(&y_file);
-            MPI_File_close(&z_file);
-            MPI_File_close(&theta_file);
-            MPI_File_close(&phi_file);
-            MPI_File_close(&redshift_file);
+            // write selected core columns... 
+            if(schema.writeCore[CORE_ID]){
+                writeColumn(pre + "id" + suf, &w.id[0], w.id.size(), MPI_INT64_T, offset_id);
+            }
+            if(schema.writeCore[CORE_X]){
+                writeColumn(pre + "x" + suf, &w.x[0], w.x.size(), MPI_FLOAT, offset_posvel);
+            }
+            if(schema.writeCore[CORE_Y]){
+                writeColumn(pre + "y" + suf, &w.y[0], w.y.size(), MPI_FLOAT, offset_posvel);
+            }
+            if(schema.writeCore[CORE_Z]){
+                writeColumn(pre + "z" + suf, &w.z[0], w.z.size(), MPI_FLOAT, offset_posvel);
+            }
+            if(schema.writeCore[CORE_THETA]){
+                writeColumn(pre + "theta" + suf, &w.theta[0], w.theta.size(), MPI_FLOAT, offset_float);
+            }
+            if(schema.writeCore[CORE_PHI]){
+                writeColumn(pre + "phi" + suf, &w.phi[0], w.phi.size(), MPI_FLOAT, offset_float);
+            }
+            if(schema.writeCore[CORE_REDSHIFT]){
+                writeColumn(pre + "redshift" + suf, &w.redshift[0], w.redshift.size(), MPI_FLOAT, 
+                            offset_posvel);
+            }
             
-            if(!positionOnly){
-                
-                MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(vx_file_name.str().c_str()),
-                        MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &vx_file);
-                MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(vy_file_name.str().c_str()),
-                        MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &vy_file);
-                MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(vz_file_name.str().c_str()),
-                        MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &vz_file);
-                MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(rotation_file_name.str().c_str()),
-                        MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &rotation_file);
-                MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(replication_file_name.str().c_str()),
-                        MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &replication_file);
-                
-                MPI_File_seek(vx_file, offset_posvel, MPI_SEEK_SET);
-                MPI_File_iwrite(vx_file, &w.vx[0], w.vx.size(), MPI_FLOAT, &vx_req);
-                MPI_Wait(&vx_req, MPI_STATUS_IGNORE);
+            // non-core columns, as raw bytes of their native type...
+            for(int c = 0; c < numExtra; ++c){
+                const Column_info &col = schema.extra[c];
+                if(!col.exchange){ continue; }
+                writeColumn(pre + col.name + suf, w.extra[c].data(), w.extra[c].size(), MPI_BYTE, 
+                            (MPI_Offset)col.size * w.np_offset[myrank]);
+            }
 
-                MPI_File_seek(vy_file, offset_posvel, MPI_SEEK_SET);
-                MPI_File_iwrite(vy_file, &w.vy[0], w.vy.size(), MPI_FLOAT, &vy_req);
-                MPI_Wait(&vy_req, MPI_STATUS_IGNORE);
-                
-                MPI_File_seek(vz_file, offset_posvel, MPI_SEEK_SET);
-                MPI_File_iwrite(vz_file, &w.vz[0], w.vz.size(), MPI_FLOAT, &vz_req);
-                MPI_Wait(&vz_req, MPI_STATUS_IGNORE);
-                
-                MPI_File_seek(rotation_file, offset_posvel, MPI_SEEK_SET);
-                MPI_File_iwrite(rotation_file, &w.rotation[0], w.rotation.size(), 
-                                MPI_FLOAT, &rotation_req);
-                MPI_Wait(&rotation_req, MPI_STATUS_IGNORE);
-                
-                MPI_File_seek(replication_file, offset_posvel, MPI_SEEK_SET);
-                MPI_File_iwrite(replication_file, &w.replication[0], w.replication.size(), 
-                                MPI_FLOAT, &replication_req);
-                MPI_Wait(&replication_req, MPI_STATUS_IGNORE);
-                
-                MPI_File_close(&vx_file);
-                MPI_File_close(&vy_file);
-                MPI_File_close(&vz_file);
-                MPI_File_close(&rotation_file);
-                MPI_File_close(&replication_file);
+            // and derived columns
+            for(int c = 0; c < numDerived; ++c){
+                writeColumn(pre + derivedColumnName(opts.derivedCols[c]) + suf, &w.derived[c][0], 
+                            w.derived[c].size(), MPI_FLOAT, offset_float);
             }
         
             MPI_Barrier(MPI_COMM_WORLD);
@@ -1510,7 +4144,12 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
             }
             write_times.push_back(duration);
         }
-
+        
+        // record the step as done, so that a restarted watch skips it
+        if(opts.watchPoll > 0 and myrank == 0){
+            ofstream progress((opts.outDir + "watch_progress.csv").c_str(), ios::app);
+            progress << step_strings[i] << ", " << time(NULL) << "\n";
+        }
     }
     
     if(myrank == 0 and timeit == true){
@@ -1524,6 +4163,15 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         }
         cout << "]" << endl;
         
+        if(opts.healpixNside > 0){
+            cout << "map_times = np.array([";
+            for(int hh = 0; hh < map_times.size(); ++hh){
+                cout << map_times[hh];
+                if(hh < map_times.size()-1){ cout << ", "; }
+            }
+            cout << "]" << endl;
+        }
+        
         cout << "redist_times = np.array([";
         for(int hh = 0; hh < redist_times.size(); ++hh){
             cout << redist_times[hh];
@@ -1552,4 +4200,6 @@ void processLC(string dir_name, vector<string> out_dirs, vector<string> step_str
         }
         cout << "]" << endl;
     }
+    
+    if(reader_comm != MPI_COMM_WORLD and reader_comm != MPI_COMM_NULL){ MPI_Comm_free(&reader_comm); }
 }
@@ -19,6 +19,10 @@
 #include <dirent.h>
 #include <errno.h>
 #include <vector>
+#include <map>
+#include <time.h>
+#include <poll.h>
+#include <sys/inotify.h>
 
 #include "util.h"
 
@@ -38,13 +42,28 @@
 using namespace std;
 using namespace gio;
 
+void readHaloCatalog(string fileName, vector<float> &haloPos, vector<string> &haloTags,
+                     vector<float> &haloProps, string massDef, float minMass,
+                     const vector<string> &columnMap, int myrank, int numranks);
+
+void buildStepManifest(string dir_name, int maxStep, int minStep, string cacheFile, 
+                       Step_manifest &manifest, int myrank);
+
+bool waitForSteps(string dir_name, const Cutout_options &opts, Step_manifest &manifest, 
+                  int myrank);
+
+void buildLCStore(vector<string> step_strings, int myrank, int numranks, bool verbose, 
+                  bool timeit, bool overwrite, bool positionOnly, const Cutout_options &opts);
+
 void processLC(string dir_name, string out_dir, vector<string> step_strings, 
                vector<float> theta_bounds, vector<float> phi_bounds, int myrank, int numranks, 
-               bool verbose, bool timeit, bool overwrite, bool positionOnly);
+               bool verbose, bool timeit, bool overwrite, bool positionOnly,
+               const Cutout_options &opts);
 
 void processLC(string dir_name, vector<string> out_dirs, vector<string> step_strings, 
-               vector<float> halo_pos, vector<float> halo_props, float boxLength, int myrank,
-               int numranks, bool verbose, bool timeit, bool overwrite, bool positionOnly, 
-               bool forceWriteProps, bool propsOnly);
+               vector<float> halo_pos, vector<float> halo_props, vector<string> halo_tags,
+               float boxLength, int myrank, int numranks, bool verbose, bool timeit, 
+               bool overwrite, bool positionOnly, bool forceWriteProps, bool propsOnly, 
+               const Cutout_options &opts);
 
 #endif
@@ -20,10 +20,10 @@ MPI_Datatype createParticles_pos(){
     // :return: a struct of custom MPI type "particles_mpi"
 
     MPI_Datatype particles_mpi;
-    MPI_Datatype type[9] = {MPI_FLOAT, MPI_FLOAT, MPI_FLOAT, MPI_FLOAT, MPI_FLOAT,
-                            MPI_FLOAT, MPI_FLOAT, MPI_INT64_T, MPI_INT};
-    int blocklen[9] = {1,1,1,1,1,1,1,1};
-    MPI_Aint disp[9] = {
+    MPI_Datatype type[10] = {MPI_FLOAT, MPI_FLOAT, MPI_FLOAT, MPI_FLOAT, MPI_FLOAT,
+                             MPI_FLOAT, MPI_FLOAT, MPI_INT64_T, MPI_INT, MPI_FLOAT};
+    int blocklen[10] = {1,1,1,1,1,1,1,1,1,1};
+    MPI_Aint disp[10] = {
                          offsetof(particle_pos, x),
                          offsetof(particle_pos, y),
                          offsetof(particle_pos, z),
@@ -32,38 +32,29 @@ MPI_Datatype createParticles_pos(){
                          offsetof(particle_pos, phi),
                          offsetof(particle_pos, a),
                          offsetof(particle_pos, id),
-                         offsetof(particle_pos, myrank)
+                         offsetof(particle_pos, myrank),
+                         offsetof(particle_pos, v_los)
                         };
-    MPI_Type_struct(9, blocklen, disp, type, &particles_mpi);
+    MPI_Type_struct(10, blocklen, disp, type, &particles_mpi);
     MPI_Type_commit(&particles_mpi);
     return particles_mpi;
 }
 
 
-MPI_Datatype createParticles_vel(){
-    // This function creates and returns an MPI struct type which has a field per 
-    // "secondary" particle quantity (velocity, rotation and replication info). 
-    // One particle shall be represented by one "particles_mpi" object, which is 
-    // based upon the "particle_vel" struct in util.h
+MPI_Datatype createParticles_row(int rowSize){
+    // This function creates and returns an MPI type for one particle's worth of 
+    // the exchanged non-core columns (velocities, rotation and replication info, 
+    // or anything else requested with --columns), which are packed as raw bytes 
+    // into rows of length rowSize, as laid out in a Column_schema
     //
     // Params:
-    // :return: a struct of custom MPI type "particles_mpi"
+    // :param rowSize: the number of bytes per particle
+    // :return: a contiguous MPI type of rowSize bytes
 
-    MPI_Datatype particles_mpi;
-    MPI_Datatype type[6] = {MPI_FLOAT, MPI_FLOAT, MPI_FLOAT, 
-                             MPI_INT, MPI_INT32_T, MPI_INT};
-    int blocklen[6] = {1,1,1,1,1,1};
-    MPI_Aint disp[6] = {
-                         offsetof(particle_vel, vx),
-                         offsetof(particle_vel, vy),
-                         offsetof(particle_vel, vz),
-                         offsetof(particle_vel, rotation),
-                         offsetof(particle_vel, replication),
-                         offsetof(particle_vel, myrank)
-                        };
-    MPI_Type_struct(6, blocklen, disp, type, &particles_mpi);
-    MPI_Type_commit(&particles_mpi);
-    return particles_mpi;
+    MPI_Datatype row_mpi;
+    MPI_Type_contiguous(rowSize, MPI_BYTE, &row_mpi);
+    MPI_Type_commit(&row_mpi);
+    return row_mpi;
 }
 
 
@@ -88,6 +79,61 @@ void comp_rank_scatter(size_t Np, vector<int> &idxRemap, int numranks){
 //======================================================================================
 
 
+void exchangeSlots(const vector<int> &dest, int numranks, vector<int> &send_count, 
+                   vector<int> &send_offset, vector<int> &slots){
+    // Finds where each particle goes in the send buffers of an alltoallv exchange, given
+    // its destination rank, such that each rank's particles are contiguous and in their
+    // original order. OpenMP threads count the destinations of contiguous chunks of the
+    // particles, and a prefix sum over those counts gives each thread its own fill 
+    // position in every rank's segment, so that the buffers can then be packed in 
+    // parallel with no shared cursors
+    //
+    // Params:
+    // :param dest: the destination rank of each particle
+    // :param numranks: the number of ranks
+    // :param send_count: to be filled with the number of particles sent to each rank
+    // :param send_offset: to be filled with the offset of each rank's segment
+    // :param slots: to be filled with the send buffer position of each particle
+    // :return: none
+
+    size_t Np = dest.size();
+    int numChunks = omp_get_max_threads();
+    vector<int> chunkCount((size_t)numChunks * numranks, 0);
+    slots.resize(Np);
+    
+    #pragma omp parallel for schedule(static, 1)
+    for(int t = 0; t < numChunks; ++t){
+        int *count = &chunkCount[(size_t)t*numranks];
+        for(size_t n = Np*t/numChunks; n < Np*(t+1)/numChunks; ++n){ count[dest[n]]++; }
+    }
+
+    // prefix sum over ranks, then over chunks within each rank's segment
+    send_count.assign(numranks, 0);
+    send_offset.assign(numranks, 0);
+    for(int ri = 0; ri < numranks; ++ri){
+        for(int t = 0; t < numChunks; ++t){ send_count[ri] += chunkCount[(size_t)t*numranks + ri]; }
+        if(ri > 0){ send_offset[ri] = send_offset[ri-1] + send_count[ri-1]; }
+    }
+    for(int ri = 0; ri < numranks; ++ri){
+        int fill = send_offset[ri];
+        for(int t = 0; t < numChunks; ++t){
+            int count = chunkCount[(size_t)t*numranks + ri];
+            chunkCount[(size_t)t*numranks + ri] = fill;
+            fill += count;
+        }
+    }
+    
+    #pragma omp parallel for schedule(static, 1)
+    for(int t = 0; t < numChunks; ++t){
+        int *fill = &chunkCount[(size_t)t*numranks];
+        for(size_t n = Np*t/numChunks; n < Np*(t+1)/numChunks; ++n){ slots[n] = fill[dest[n]]++; }
+    }
+}
+
+
+//======================================================================================
+
+
 bool comp_by_theta(const particle_pos &a, const particle_pos &b){
     // Compares two particle_pos structs by their 'theta' field
     //
@@ -103,6 +149,208 @@ bool comp_by_theta(const particle_pos &a, const particle_pos &b){
 //======================================================================================
 
 
+static void fillThetaIndex(const vector<particle_pos> &particles, Theta_index &index, 
+                           int &n, int k){
+    // Fills the subtree of index rooted at k from the in-order traversal of the sorted
+    // particles, of which the first n have been placed
+    
+    if(k >= index.keys.size()){ return; }
+    fillThetaIndex(particles, index, n, 2*k);
+    index.keys[k] = particles[n].theta;
+    index.pos[k] = n++;
+    fillThetaIndex(particles, index, n, 2*k+1);
+}
+
+
+void buildThetaIndex(const vector<particle_pos> &particles, Theta_index &index){
+    // Builds an Eytzinger layout search index over the theta keys of particles which
+    // have been sorted by comp_by_theta, for thetaLowerBound(), thetaUpperBound(), and 
+    // thetaRanges(). The index holds 8 bytes per particle, rather than the full 
+    // particle_pos stride of a search over the particles themselves
+    //
+    // Params:
+    // :param particles: the particles, sorted by theta
+    // :param index: the index to fill
+    // :return: none
+
+    index.keys.resize(particles.size() + 1);
+    index.pos.resize(particles.size() + 1);
+    int n = 0;
+    fillThetaIndex(particles, index, n, 1);
+}
+
+
+//======================================================================================
+
+
+static int searchThetaIndex(const Theta_index &index, float theta, bool upper){
+    // Descends an Eytzinger index for the lower (or upper) bound of theta, prefetching
+    // the cache line holding the 16 descendants of each node four levels down. After 
+    // the descent, k encodes the path taken, and stripping its trailing right turns 
+    // (plus one) gives the node of the bound, or 0 if it is past the end
+    
+    const float *keys = &index.keys[0];
+    size_t numKeys = index.keys.size() - 1;
+    size_t k = 1;
+    while(k <= numKeys){
+        __builtin_prefetch(keys + 16*k);
+        k = 2*k + (upper ? keys[k] <= theta : keys[k] < theta);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k == 0 ? numKeys : index.pos[k];
+}
+
+
+int thetaLowerBound(const Theta_index &index, float theta){
+    // Finds the position of the first particle with theta not less than the given 
+    // value (as std::lower_bound with comp_by_theta), using an index built by 
+    // buildThetaIndex()
+    
+    return searchThetaIndex(index, theta, false);
+}
+
+
+int thetaUpperBound(const Theta_index &index, float theta){
+    // Finds the position of the first particle with theta greater than the given 
+    // value (as std::upper_bound with comp_by_theta), using an index built by 
+    // buildThetaIndex()
+    
+    return searchThetaIndex(index, theta, true);
+}
+
+
+//======================================================================================
+
+
+void thetaRanges(const Theta_index &index, const vector<float> &theta_bounds, 
+                 vector<int> &ranges){
+    // Finds the range of particles within each of many [min, max] theta bounds, such as
+    // the rough bounds of all target halos, using an index built by buildThetaIndex().
+    // The bounds are searched for in ascending order, so that consecutive searches 
+    // descend mostly the same path, and find it in cache
+    //
+    // Params:
+    // :param index: the search index
+    // :param theta_bounds: the [min, max] bounds of each query (2 per query), in arcsec
+    // :param ranges: the [first, last) particle positions for each query (2 per query)
+    // :return: none
+
+    vector<int> order(theta_bounds.size());
+    for(int q = 0; q < order.size(); ++q){ order[q] = q; }
+    sort(order.begin(), order.end(), 
+         [&theta_bounds](int a, int b){ return theta_bounds[a] < theta_bounds[b]; });
+    
+    // bounds at even positions are minima (lower bound), and at odd positions maxima
+    ranges.resize(theta_bounds.size());
+    for(int q = 0; q < order.size(); ++q){
+        int b = order[q];
+        if(b % 2 == 0){ ranges[b] = thetaLowerBound(index, theta_bounds[b]); }
+        else{ ranges[b] = thetaUpperBound(index, theta_bounds[b]); }
+    }
+}
+
+
+//======================================================================================
+
+
+static inline int64_t clampCell(int64_t i){
+    // Clamps an integer cell coordinate to the range which fits a Cell_index key
+    
+    const int64_t offset = (int64_t)1 << 20;
+    return min(max(i, -offset), offset - 1);
+}
+
+
+static inline uint64_t cellKey(int64_t ix, int64_t iy, int64_t iz){
+    // Packs integer cell coordinates, offset to be non-negative, into a Cell_index key.
+    // The coordinates must lie in [-2^20, 2^20) (see clampCell())
+    
+    const int64_t offset = (int64_t)1 << 20;
+    return ((uint64_t)(ix + offset) << 42) | ((uint64_t)(iy + offset) << 21) | (uint64_t)(iz + offset);
+}
+
+
+void buildCellIndex(const vector<particle_pos> &particles, float cellSize, Cell_index &index){
+    // Builds a 3D index of particles on a grid of cubic cells of the given size, as the 
+    // particles' cell keys in ascending order, with the particle positions in that 
+    // order. A query for all particles near a point then only touches the few runs of 
+    // keys that cover it (see queryCellIndex()). The cell size is raised, if needed, so
+    // that the cell coordinates of all particles fit the 21 bits of a key
+    //
+    // Params:
+    // :param particles: the particles
+    // :param cellSize: the cell side length, in the units of the particle positions
+    // :param index: the index to fill
+    // :return: none
+
+    size_t Np = particles.size();
+    float maxExtent = 0;
+    #pragma omp parallel for schedule(static) reduction(max:maxExtent)
+    for(size_t n = 0; n < Np; ++n){
+        maxExtent = max(maxExtent, max(fabs(particles[n].x), 
+                                       max(fabs(particles[n].y), fabs(particles[n].z))));
+    }
+    cellSize = max(cellSize, maxExtent / (float)(((int64_t)1 << 20) - 1));
+    
+    vector<pair<uint64_t, int> > keyed(Np);
+    #pragma omp parallel for schedule(static)
+    for(size_t n = 0; n < Np; ++n){
+        keyed[n].first = cellKey(clampCell((int64_t)floor(particles[n].x / cellSize)), 
+                                 clampCell((int64_t)floor(particles[n].y / cellSize)), 
+                                 clampCell((int64_t)floor(particles[n].z / cellSize)));
+        keyed[n].second = n;
+    }
+    sort(keyed.begin(), keyed.end());
+    
+    index.cellSize = cellSize;
+    index.keys.resize(Np);
+    index.order.resize(Np);
+    for(size_t n = 0; n < Np; ++n){
+        index.keys[n] = keyed[n].first;
+        index.order[n] = keyed[n].second;
+    }
+}
+
+
+//======================================================================================
+
+
+void queryCellIndex(const Cell_index &index, const float *center, float halfWidth, 
+                    vector<int> &found){
+    // Finds all particles in the cells of an index built by buildCellIndex() which 
+    // intersect a cube around a point. This is a superset of the particles within the
+    // cube (or a sphere inscribed in it), which are left to the caller to pick out
+    //
+    // Params:
+    // :param index: the cell index
+    // :param center: the center of the cube
+    // :param halfWidth: half the side length of the cube
+    // :param found: vector to fill with the positions of the particles found
+    // :return: none
+
+    int64_t lo[3], hi[3];
+    for(int i = 0; i < 3; ++i){
+        lo[i] = clampCell((int64_t)floor((center[i] - halfWidth) / index.cellSize));
+        hi[i] = clampCell((int64_t)floor((center[i] + halfWidth) / index.cellSize));
+    }
+    
+    found.clear();
+    for(int64_t ix = lo[0]; ix <= hi[0]; ++ix){
+        for(int64_t iy = lo[1]; iy <= hi[1]; ++iy){
+            vector<uint64_t>::const_iterator first = 
+                lower_bound(index.keys.begin(), index.keys.end(), cellKey(ix, iy, lo[2]));
+            vector<uint64_t>::const_iterator last = 
+                upper_bound(first, index.keys.end(), cellKey(ix, iy, hi[2]));
+            found.insert(found.end(), index.order.begin() + (first - index.keys.begin()),
+                         index.order.begin() + (last - index.keys.begin()));
+        }
+    }
+}
+
+
+//======================================================================================
+
+
 bool does_file_exist(string filename){
     // Checks if a file exists     //
     // Params:
@@ -118,10 +366,468 @@ bool does_file_exist(string filename){
 //======================================================================================
 
 
+void splitCommaList(string list, vector<string> &items){
+    // Splits a comma-delimited list given on the command line (e.g. "v_los,d") 
+    // into its items. Empty items are dropped.
+    //
+    // Params:
+    // :param list: the comma-delimited string
+    // :param items: vector to which to append the items
+    // :return: none
+
+    stringstream ss(list);
+    string item;
+    while(getline(ss, item, ',')){
+        if(item.size() > 0){ items.push_back(item); }
+    }
+}
+
+
+//======================================================================================
+
+
+static const char *derived_names[NUM_DERIVED] = {"v_los", "d", "x_rot", "y_rot", "z_rot",
+                                                 "x_tan", "y_tan"};
+
+int derivedColumnIndex(string name){
+    // Maps the name of a derived column to its Derived_col value (see util.h)
+    //
+    // Params:
+    // :param name: the column name, as given on the command line and used for 
+    //              the output file names
+    // :return: the matching Derived_col, or -1 if name is not a derived column
+    
+    for(int c = 0; c < NUM_DERIVED; ++c){
+        if(name == derived_names[c]){ return c; }
+    }
+    return -1;
+}
+
+
+string derivedColumnName(int col){
+    // Inverse of derivedColumnIndex()
+
+    return string(derived_names[col]);
+}
+
+
+//======================================================================================
+
+
+static const char *core_names[NUM_CORE] = {"id", "x", "y", "z", "redshift", "theta", "phi"};
+
+int coreColumnIndex(string name){
+    // Maps the name of a core column to its Core_col value (see util.h)
+    //
+    // Params:
+    // :param name: the column name, as given on the command line and used for 
+    //              the output file names
+    // :return: the matching Core_col, or -1 if name is not a core column
+    
+    for(int c = 0; c < NUM_CORE; ++c){
+        if(name == core_names[c]){ return c; }
+    }
+    return -1;
+}
+
+
+string coreColumnName(int col){
+    // Inverse of coreColumnIndex()
+
+    return string(core_names[col]);
+}
+
+
+//======================================================================================
+
+
+void selectColumns(const vector<string> &columns, bool positionOnly, bool needVel, 
+                   Column_schema &schema){
+    // Decides which columns are to be read, exchanged, and written in a cutout 
+    // (of either use case), or store. Core columns (see Core_col in util.h) are always read; any 
+    // other requested column is a non-core "extra" column, the type of which is 
+    // only known once a GenericIO header has been opened. 
+    //
+    // Params:
+    // :param columns: the requested output columns (excluding derived columns).
+    //                 If empty, all core columns are written, plus vx, vy, vz, 
+    //                 rotation and replication unless positionOnly is true
+    // :param positionOnly: whether or not --posOnly was passed
+    // :param needVel: whether the velocities must be read (for v_los), even if 
+    //                 they are not written
+    // :param schema: the Column_schema to fill
+    // :return: none
+
+    const char *vel_names[] = {"vx", "vy", "vz", "rotation", "replication"};
+    vector<string> extraNames;
+    schema.extra.clear();
+
+    if(columns.size() == 0){
+        for(int c = 0; c < NUM_CORE; ++c){ schema.writeCore[c] = true; }
+        if(!positionOnly){
+            extraNames.assign(vel_names, vel_names+5);
+        }
+    }
+    else{
+        for(int c = 0; c < NUM_CORE; ++c){ schema.writeCore[c] = false; }
+        for(int i = 0; i < columns.size(); ++i){
+            int core = coreColumnIndex(columns[i]);
+            if(core >= 0){
+                schema.writeCore[core] = true;
+            }
+            else if(find(extraNames.begin(), extraNames.end(), columns[i]) == extraNames.end()){
+                extraNames.push_back(columns[i]);
+            }
+        }
+    }
+    
+    for(int i = 0; i < extraNames.size(); ++i){
+        Column_info col;
+        col.name = extraNames[i];
+        col.size = 0;
+        col.isFloat = false;
+        col.isSigned = false;
+        col.exchange = true;
+        col.rowOffset = 0;
+        schema.extra.push_back(col);
+    }
+    
+    // velocities to be read but not sent anywhere
+    if(needVel){
+        for(int v = 0; v < 3; ++v){
+            if(findColumn(schema, vel_names[v]) < 0){
+                Column_info col;
+                col.name = vel_names[v];
+                col.size = 0;
+                col.isFloat = false;
+                col.isSigned = false;
+                col.exchange = false;
+                col.rowOffset = 0;
+                schema.extra.push_back(col);
+            }
+        }
+    }
+    schema.rowSize = 0;
+}
+
+
+//======================================================================================
+
+
+int findColumn(const Column_schema &schema, string name){
+    // Returns the index of the extra column called name in schema, or -1 if 
+    // it is not present
+
+    for(int c = 0; c < schema.extra.size(); ++c){
+        if(schema.extra[c].name == name){ return c; }
+    }
+    return -1;
+}
+
+
+//======================================================================================
+
+
+double columnValue(const Column_info &col, const char *data){
+    // Interprets one raw element of a non-core column according to its type
+    //
+    // Params:
+    // :param col: the column description
+    // :param data: pointer to the element
+    // :return: the value of the element, as a double
+
+    if(col.isFloat){
+        if(col.size == 4){ return *(const float*)data; }
+        return *(const double*)data;
+    }
+    if(col.isSigned){
+        switch(col.size){
+            case 1: return *(const int8_t*)data;
+            case 2: return *(const int16_t*)data;
+            case 4: return *(const int32_t*)data;
+            default: return *(const int64_t*)data;
+        }
+    }
+    switch(col.size){
+        case 1: return *(const uint8_t*)data;
+        case 2: return *(const uint16_t*)data;
+        case 4: return *(const uint32_t*)data;
+        default: return *(const uint64_t*)data;
+    }
+}
+
+
+//======================================================================================
+
+
+void writeColumn(string file_name, void *data, int count, MPI_Datatype type, 
+                 MPI_Offset offset){
+    // Collectively opens file_name and writes this rank's portion of one 
+    // output column at the given byte offset, as done for the standard 
+    // columns in processLC.cpp. Must be called by all ranks.
+    //
+    // Params:
+    // :param file_name: the output file 
+    // :param data: pointer to this rank's data
+    // :param count: number of elements of type 'type' at data
+    // :param type: the MPI type of the column
+    // :param offset: byte offset at which this rank should write
+    // :return: none
+
+    MPI_File file;
+    MPI_Request req;
+    
+    MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(file_name.c_str()), 
+            MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+    MPI_File_seek(file, offset, MPI_SEEK_SET);
+    MPI_File_iwrite(file, data, count, type, &req);
+    MPI_Wait(&req, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+}
+
+
+//======================================================================================
+
+
+static uint64_t mix64(uint64_t v){
+    // The splitmix64 finalizer, used to hash particle ids for the Bloom filter
+
+    v ^= v >> 30; v *= 0xBF58476D1CE4E5B9ULL;
+    v ^= v >> 27; v *= 0x94D049BB133111EBULL;
+    v ^= v >> 31;
+    return v;
+}
+
+
+//======================================================================================
+
+
+void readIdFile(string idFileName, Id_filter &filter, int myrank){
+    // Reads a list of particle ids on rank 0, and builds an Id_filter from them, 
+    // which is then broadcast to all ranks. The file is read as raw int64 values if 
+    // its name ends in ".bin", and as whitespace-delimited text otherwise. The Bloom 
+    // filter is sized at ~10 bits per id with 7 hashes, for a false positive rate 
+    // of about 1%, and uses double hashing of the mixed id.
+    //
+    // Params:
+    // :param idFileName: the file containing the ids
+    // :param filter: the Id_filter to fill
+    // :param myrank: this rank's identifier
+    // :return: none
+
+    filter.numHashes = 7;
+    int64_t numIds = 0;
+    int64_t numWords = 0;
+
+    if(myrank == 0){
+        if(!does_file_exist(idFileName)){
+            cout << "\nCannot access id file " << idFileName << endl;
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+        
+        bool binary = idFileName.size() > 4 and 
+                      idFileName.compare(idFileName.size()-4, 4, ".bin") == 0;
+        if(binary){
+            ifstream idFile(idFileName.c_str(), ios::binary | ios::ate);
+            filter.ids.resize(idFile.tellg() / sizeof(ID_T));
+            idFile.seekg(0);
+            idFile.read((char*)&filter.ids[0], filter.ids.size() * sizeof(ID_T));
+        }else{
+            ifstream idFile(idFileName.c_str());
+            ID_T id;
+            while(idFile >> id){ filter.ids.push_back(id); }
+        }
+
+        sort(filter.ids.begin(), filter.ids.end());
+        filter.ids.erase(unique(filter.ids.begin(), filter.ids.end()), filter.ids.end());
+        numIds = filter.ids.size();
+
+        // build the Bloom filter
+        uint64_t numBits = 64;
+        while(numBits < 10 * (uint64_t)numIds){ numBits <<= 1; }
+        filter.bloom.assign(numBits/64, 0);
+        for(int64_t n = 0; n < numIds; ++n){
+            uint64_t h1 = mix64(filter.ids[n]);
+            uint64_t h2 = mix64(h1) | 1;
+            for(int k = 0; k < filter.numHashes; ++k){
+                uint64_t bit = (h1 + k*h2) & (numBits-1);
+                filter.bloom[bit >> 6] |= (uint64_t)1 << (bit & 63);
+            }
+        }
+        numWords = filter.bloom.size();
+        cout << "Read " << numIds << " unique particle ids from " << idFileName << endl;
+    }
+
+    MPI_Bcast(&numIds, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&numWords, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    filter.ids.resize(numIds);
+    filter.bloom.resize(numWords);
+    MPI_Bcast(filter.ids.data(), numIds, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    MPI_Bcast(filter.bloom.data(), numWords, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+}
+
+
+//======================================================================================
+
+
+bool idFilterContains(const Id_filter &filter, ID_T id){
+    // Returns true if id is in the filter's id set, checking the Bloom filter
+    // first, so that most non-members never reach the binary search
+
+    uint64_t mask = filter.bloom.size()*64 - 1;
+    uint64_t h1 = mix64(id);
+    uint64_t h2 = mix64(h1) | 1;
+    for(int k = 0; k < filter.numHashes; ++k){
+        uint64_t bit = (h1 + k*h2) & mask;
+        if((filter.bloom[bit >> 6] & ((uint64_t)1 << (bit & 63))) == 0){ return false; }
+    }
+    return binary_search(filter.ids.begin(), filter.ids.end(), id);
+}
+
+
+//======================================================================================
+
+
+template <typename T>
+static void compactBuffer(vector<T> &buf, size_t Np, const vector<size_t> &keep){
+    // Keeps only the elements at the (ascending) indices keep in a read buffer, 
+    // if that buffer was read (has Np elements)
+
+    if(buf.size() != Np){ return; }
+    for(size_t k = 0; k < keep.size(); ++k){ buf[k] = buf[keep[k]]; }
+    buf.resize(keep.size());
+}
+
+
+//======================================================================================
+
+
+static size_t compactReadBuffers(Buffers_read &r, size_t Np, const vector<size_t> &keep){
+    // Keeps only the particles at the (ascending) indices keep in the read buffers, 
+    // in place. Any buffer which was not read (does not have Np elements) is
+    // left alone, so this works for either use case in processLC.cpp
+
+    compactBuffer(r.x, Np, keep);
+    compactBuffer(r.y, Np, keep);
+    compactBuffer(r.z, Np, keep);
+    compactBuffer(r.d, Np, keep);
+    compactBuffer(r.a, Np, keep);
+    compactBuffer(r.id, Np, keep);
+    compactBuffer(r.theta, Np, keep);
+    compactBuffer(r.phi, Np, keep);
+
+    // raw non-core columns
+    for(int c = 0; c < r.extra.size(); ++c){
+        if(Np == 0){ break; }
+        size_t size = r.extra[c].size() / Np;
+        for(size_t k = 0; k < keep.size(); ++k){
+            memmove(&r.extra[c][k*size], &r.extra[c][keep[k]*size], size);
+        }
+        r.extra[c].resize(keep.size() * size);
+    }
+    return keep.size();
+}
+
+
+//======================================================================================
+
+
+size_t filterReadBuffers(Buffers_read &r, size_t Np, const Id_filter &filter){
+    // Removes all particles whose ids are not in filter from the read buffers, 
+    // in place (see compactReadBuffers())
+    //
+    // Params:
+    // :param r: the read buffers, containing Np particles
+    // :param Np: the number of particles read
+    // :param filter: the Id_filter to apply
+    // :return: the number of particles kept
+
+    vector<size_t> keep;
+    for(size_t n = 0; n < Np; ++n){
+        if(idFilterContains(filter, r.id[n])){ keep.push_back(n); }
+    }
+    return compactReadBuffers(r, Np, keep);
+}
+
+
+//======================================================================================
+
+
+size_t filterReadBuffers(Buffers_read &r, size_t Np, const Footprint_mask &mask){
+    // Removes all particles outside of a footprint mask from the read buffers, 
+    // in place (see compactReadBuffers()). The theta and phi buffers must be filled
+    //
+    // Params:
+    // :param r: the read buffers, containing Np particles
+    // :param Np: the number of particles read
+    // :param mask: the Footprint_mask to apply, as built by buildFootprintMask()
+    // :return: the number of particles kept
+
+    vector<size_t> keep;
+    for(size_t n = 0; n < Np; ++n){
+        if(footprintContains(mask, r.theta[n], r.phi[n])){ keep.push_back(n); }
+    }
+    return compactReadBuffers(r, Np, keep);
+}
+
+
+//======================================================================================
+
+
+static void parseHaloRows(const char *begin, const char *end, int rowLen, 
+                          vector<float> &haloPos, vector<char> &haloTags, 
+                          vector<float> &haloProps, long &badLine){
+    // Parses the whitespace-delimited rows of a text halo catalog in [begin, end), as 
+    // described in readHaloFile(), appending the positions and properties to haloPos 
+    // and haloProps, and the tags to haloTags as NUL-terminated strings. Empty lines 
+    // and lines beginning with '#' are skipped. If a row with the wrong number of 
+    // entries is found, parsing stops, and badLine is set to its offset from begin
+    
+    const char *tok[10];
+    int tokLen[10];
+    char buf[64];
+
+    const char *c = begin;
+    while(c < end){
+        
+        // tokenize one line
+        const char *lineStart = c;
+        int numTok = 0;
+        while(c < end and *c != '\n'){
+            while(c < end and (*c == ' ' or *c == '\t' or *c == '\r')){ ++c; }
+            if(c == end or *c == '\n'){ break; }
+            const char *t = c;
+            while(c < end and *c != ' ' and *c != '\t' and *c != '\r' and *c != '\n'){ ++c; }
+            if(numTok < rowLen){ tok[numTok] = t; tokLen[numTok] = min((int)(c-t), 63); }
+            ++numTok;
+        }
+        ++c;
+        
+        if(numTok == 0 or *tok[0] == '#'){ continue; }
+        if(numTok != rowLen){
+            badLine = lineStart - begin;
+            return;
+        }
+
+        haloTags.insert(haloTags.end(), tok[0], tok[0] + tokLen[0]);
+        haloTags.push_back('\0');
+        for(int i = 1; i < rowLen; ++i){
+            memcpy(buf, tok[i], tokLen[i]);
+            buf[tokLen[i]] = '\0';
+            if(i < rowLen-3){ haloProps.push_back(strtof(buf, 0)); }
+            else{ haloPos.push_back(strtof(buf, 0)); }
+        }
+    }
+}
+
+
+//======================================================================================
+
+
 void readHaloFile(string haloFileName, vector<float> &haloPos, 
                                        vector<string> &haloTags, 
                                        vector<float> &haloProps,
-                                       string massDef){
+                                       string massDef, float minMass){
     // This function reads halo identifiers and positions from an input text file, where 
     // that file is expected to have one halo per row, each space-delimited row appearing as 
     //
@@ -144,6 +850,12 @@ void readHaloFile(string haloFileName, vector<float> &haloPos,
     //   If those quantities are not present in the input file, and the massDef arg is not set properly, 
     //   or vice-verse, everything will break!
     //  
+    // If the file name ends in ".bin", the file is instead read as packed binary rows, 
+    // each an int64 tag followed by the remaining quantities above as float32.
+    //
+    // The file is read only by rank 0, which memory-maps it and tokenizes chunks of 
+    // lines in parallel with OpenMP, and then broadcasts the result to all ranks.
+    //
     // A code module to generate such a text file for a given HACC simulation can be cloned at  
     // https://github.com/jhollowed/cosmology/blob/master/lightcone/list_lc_halos.py
     //
@@ -156,11 +868,10 @@ void readHaloFile(string haloFileName, vector<float> &haloPos,
     //                   and also radius, concentration, and concentration error if massDef="sod"
     // :param massDef: the mass definition given in the ids of the haloFile, either 
     //                 'sod', or 'fof'. Defaults to 'sod'
+    // :param minMass: halos with mass below this are skipped. Defaults to 0
     
-    ifstream haloFile(haloFileName.c_str());
-    copy(istream_iterator<string>(haloFile), 
-         istream_iterator<string>(), 
-         back_inserter(haloTags));
+    int myrank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
 
     int rowLen;
     if(massDef == "fof")
@@ -172,38 +883,157 @@ void readHaloFile(string haloFileName, vector<float> &haloPos,
                 ". Valid options are \'fof\' or \'sod\'" << endl;
         MPI_Abort(MPI_COMM_WORLD, 0);
     }
+    int numProps = rowLen - 4;
     
-    // ensure input file is as expected, more or less 
-    if(haloTags.size() % rowLen != 0){ 
-        if(massDef == "sod")
-            cout << "\nWhen massDef==\'sod\', each halo position given in input file must " <<
-                    "have 10 quantities in the space-delimited form: " <<
-                    "id redshift m200c r200c cdelta cdelta_err x y z " << endl;
-        else
-            cout << "\nWhen massDef==\'fof\', each halo position given in input file must " <<
-                    "have 7 quantities in the space-delimited form: " <<
-                    "id redshift m_fof x y z " << endl;
-        MPI_Abort(MPI_COMM_WORLD, 0);
-    } 
+    vector<char> packedTags;
+    if(myrank == 0){
+        
+        int fd = open(haloFileName.c_str(), O_RDONLY);
+        struct stat st;
+        if(fd < 0 or fstat(fd, &st) != 0 or st.st_size == 0){
+            cout << "\nCannot read halo file " << haloFileName << endl;
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+        size_t size = st.st_size;
+        const char *data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(data == MAP_FAILED){
+            cout << "\nCannot map halo file " << haloFileName << endl;
+            MPI_Abort(MPI_COMM_WORLD, 0);
+        }
+
+        bool binary = haloFileName.size() > 4 and 
+                      haloFileName.compare(haloFileName.size()-4, 4, ".bin") == 0;
+        if(binary){
+            
+            size_t rowBytes = sizeof(int64_t) + (rowLen-1)*sizeof(float);
+            if(size % rowBytes != 0){
+                cout << "\nSize of binary halo file " << haloFileName << " is not a multiple of " << 
+                        rowBytes << " bytes; is massDef correct?" << endl;
+                MPI_Abort(MPI_COMM_WORLD, 0);
+            }
+            for(size_t row = 0; row < size/rowBytes; ++row){
+                const char *rowData = data + row*rowBytes;
+                int64_t tag;
+                float vals[9];
+                memcpy(&tag, rowData, sizeof(int64_t));
+                memcpy(vals, rowData + sizeof(int64_t), (rowLen-1)*sizeof(float));
+                
+                string tagStr = to_string((long long)tag);
+                packedTags.insert(packedTags.end(), tagStr.begin(), tagStr.end());
+                packedTags.push_back('\0');
+                haloProps.insert(haloProps.end(), vals, vals + numProps);
+                haloPos.insert(haloPos.end(), vals + numProps, vals + numProps + 3);
+            }
+        }
+        else{
+            
+            // split the file into one chunk of whole lines per thread
+            int numThreads = omp_get_max_threads();
+            vector<size_t> chunkStart(numThreads+1, size);
+            chunkStart[0] = 0;
+            for(int t = 1; t < numThreads; ++t){
+                size_t c = size * t / numThreads;
+                while(c > 0 and c < size and data[c-1] != '\n'){ ++c; }
+                chunkStart[t] = max(c, chunkStart[t-1]);
+            }
+
+            vector<vector<float> > threadPos(numThreads);
+            vector<vector<float> > threadProps(numThreads);
+            vector<vector<char> > threadTags(numThreads);
+            vector<long> badLine(numThreads, -1);
+            
+            #pragma omp parallel for schedule(static, 1)
+            for(int t = 0; t < numThreads; ++t){
+                parseHaloRows(data + chunkStart[t], data + chunkStart[t+1], rowLen, 
+                              threadPos[t], threadTags[t], threadProps[t], badLine[t]);
+            }
+            
+            for(int t = 0; t < numThreads; ++t){
+                if(badLine[t] >= 0){
+                    const char *line = data + chunkStart[t] + badLine[t];
+                    if(massDef == "sod")
+                        cout << "\nWhen massDef==\'sod\', each halo position given in input file must " <<
+                                "have 10 quantities in the space-delimited form: " <<
+                                "id redshift shell m200c r200c cdelta cdelta_err x y z " << endl;
+                    else
+                        cout << "\nWhen massDef==\'fof\', each halo position given in input file must " <<
+                                "have 7 quantities in the space-delimited form: " <<
+                                "id redshift shell m_fof x y z " << endl;
+                    cout << "Found line: " << string(line, find(line, data + size, '\n')) << endl;
+                    MPI_Abort(MPI_COMM_WORLD, 0);
+                }
+                haloPos.insert(haloPos.end(), threadPos[t].begin(), threadPos[t].end());
+                haloProps.insert(haloProps.end(), threadProps[t].begin(), threadProps[t].end());
+                packedTags.insert(packedTags.end(), threadTags[t].begin(), threadTags[t].end());
+            }
+        }
+        munmap((void*)data, size);
+
+        // apply mass cut (mass is the third property in either format)
+        if(minMass > 0){
+            size_t numRead = haloPos.size()/3;
+            size_t kept = 0;
+            const char *tag = &packedTags[0];
+            vector<char> keptTags;
+            for(size_t h = 0; h < numRead; ++h){
+                size_t tagLen = strlen(tag) + 1;
+                if(haloProps[h*numProps + 2] >= minMass){
+                    copy(&haloPos[h*3], &haloPos[h*3] + 3, &haloPos[kept*3]);
+                    copy(&haloProps[h*numProps], &haloProps[h*numProps] + numProps, 
+                         &haloProps[kept*numProps]);
+                    keptTags.insert(keptTags.end(), tag, tag + tagLen);
+                    ++kept;
+                }
+                tag += tagLen;
+            }
+            haloPos.resize(kept*3);
+            haloProps.resize(kept*numProps);
+            packedTags.swap(keptTags);
+            cout << "Kept " << kept << " of " << numRead << " halos above mass " << minMass << endl;
+        }
+    }
+    
+    // broadcast packed arrays
+    int64_t sizes[3] = {(int64_t)haloPos.size(), (int64_t)haloProps.size(), (int64_t)packedTags.size()};
+    MPI_Bcast(sizes, 3, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    haloPos.resize(sizes[0]);
+    haloProps.resize(sizes[1]);
+    packedTags.resize(sizes[2]);
+    MPI_Bcast(haloPos.data(), sizes[0], MPI_FLOAT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(haloProps.data(), sizes[1], MPI_FLOAT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(packedTags.data(), sizes[2], MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    for(size_t c = 0; c < packedTags.size(); c += haloTags.back().size() + 1){
+        haloTags.push_back(string(&packedTags[c]));
+    }
+}
+
+
+//======================================================================================
+
+
+bool isGenericIOFile(string fileName){
+    // Checks, on rank 0, whether a file begins with the GenericIO magic string 
+    // ("HACC01" followed by the endianness), and broadcasts the result. Must be
+    // called by all ranks
+    //
+    // Params:
+    // :param fileName: the file to check
+    // :return: true if the file is a GenericIO file
+
+    int myrank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
     
-    for(int i=0; i<haloTags.size()/rowLen; ++i){
-        
-        // tag is every 7th or 10th element
-        haloTags[i] = haloTags[i*rowLen];
-        // redshift, shell, mass, and radius
-        haloProps.push_back( strtof(haloTags[i*rowLen+1].c_str(), 0) );
-        haloProps.push_back( strtof(haloTags[i*rowLen+2].c_str(), 0) );
-        haloProps.push_back( strtof(haloTags[i*rowLen+3].c_str(), 0) );
-        if(massDef == "sod")
-            haloProps.push_back( strtof(haloTags[i*rowLen+4].c_str(), 0) );
-            haloProps.push_back( strtof(haloTags[i*rowLen+5].c_str(), 0) );
-            haloProps.push_back( strtof(haloTags[i*rowLen+6].c_str(), 0) );
-        // x, y, z
-        haloPos.push_back( strtof(haloTags[i*rowLen+(rowLen-3)].c_str(), 0) );
-        haloPos.push_back( strtof(haloTags[i*rowLen+(rowLen-2)].c_str(), 0) );
-        haloPos.push_back( strtof(haloTags[i*rowLen+(rowLen-1)].c_str(), 0) );
+    int isGIO = 0;
+    if(myrank == 0){
+        char magic[6] = {0};
+        ifstream file(fileName.c_str(), ios::binary);
+        file.read(magic, 6);
+        isGIO = (file.gcount() == 6 and strncmp(magic, "HACC01", 6) == 0);
     }
-    haloTags.resize(haloTags.size()/rowLen);
+    MPI_Bcast(&isGIO, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return isGIO;
 }
 
 
@@ -472,6 +1302,276 @@ int prepStepSubdir(string subdir_name, bool overwrite, bool print, bool verbose)
 //======================================================================================
 
 
+//////////////////////////////////////////////////////
+//
+//           mapped GenericIO reading
+//
+//////////////////////////////////////////////////////
+
+// on-disk GenericIO layout: byte offsets of the global header fields, and the
+// sizes of fixed-size header entries (see GenericIO.cxx)
+#define GIO_HEADER_SIZE 8
+#define GIO_NVARS 48
+#define GIO_VARS_SIZE 56
+#define GIO_VARS_START 64
+#define GIO_NRANKS 72
+#define GIO_RANKS_SIZE 80
+#define GIO_RANKS_START 88
+#define GIO_GLOBAL_HEADER_SIZE 96
+#define GIO_BLOCKS_SIZE 152
+#define GIO_BLOCKS_START 160
+#define GIO_NAME_SIZE 256
+#define GIO_CRC_SIZE 8
+
+static uint64_t gioField(const char *header, size_t offset){
+    // reads one little-endian uint64 header field
+    uint64_t value;
+    memcpy(&value, header + offset, sizeof(uint64_t));
+    return value;
+}
+
+static bool readGIOHeader(string fileName, vector<char> &header){
+    // Reads the full header of a little-endian GenericIO file. Returns false if the 
+    // file can't be read, or isn't a little-endian GenericIO file
+
+    ifstream file(fileName.c_str(), ios::binary);
+    header.resize(GIO_BLOCKS_START + sizeof(uint64_t));
+    if(!file.read(&header[0], GIO_NVARS) or strncmp(&header[0], "HACC01L", 7) != 0){ return false; }
+    
+    uint64_t headerSize = gioField(&header[0], GIO_HEADER_SIZE);
+    if(headerSize < GIO_GLOBAL_HEADER_SIZE + sizeof(uint64_t) or headerSize > ((uint64_t)1 << 32)){ 
+        return false; 
+    }
+    header.resize(max((size_t)headerSize, header.size()), 0);
+    file.seekg(0);
+    return (bool)file.read(&header[0], headerSize);
+}
+
+static bool readGIOVars(const vector<char> &header, vector<Column_info> &vars){
+    // Reads the variable list from a GenericIO header, as read by readGIOHeader()
+
+    const char *h = &header[0];
+    uint64_t numVars = gioField(h, GIO_NVARS);
+    uint64_t varsSize = gioField(h, GIO_VARS_SIZE);
+    uint64_t varsStart = gioField(h, GIO_VARS_START);
+    if(varsSize < GIO_NAME_SIZE + 16 or varsStart + numVars*varsSize > header.size()){ return false; }
+
+    vars.clear();
+    for(uint64_t j = 0; j < numVars; ++j){
+        const char *vh = h + varsStart + j*varsSize;
+        uint64_t flags = gioField(vh, GIO_NAME_SIZE);
+        Column_info var;
+        var.name = string(vh, strnlen(vh, GIO_NAME_SIZE));
+        var.size = gioField(vh, GIO_NAME_SIZE + 8);
+        var.isFloat = flags & 1;
+        var.isSigned = flags & 2;
+        var.exchange = false;
+        var.rowOffset = 0;
+        vars.push_back(var);
+    }
+    return true;
+}
+
+static bool mapGIOPartition(Mapped_gio &gio, int file){
+    // Maps one data file of a Mapped_gio, and finds the offset of every variable of 
+    // every block it holds. Returns false if the file can't be mapped, or holds a 
+    // compressed or out-of-bounds block
+    
+    vector<char> header;
+    if(!readGIOHeader(gio.fileNames[file], header)){ return false; }
+    const char *h = &header[0];
+    
+    if(gioField(h, GIO_NVARS) != gio.vars.size()){ return false; }
+    uint64_t nRanks = gioField(h, GIO_NRANKS);
+    uint64_t ranksSize = gioField(h, GIO_RANKS_SIZE);
+    uint64_t ranksStart = gioField(h, GIO_RANKS_START);
+    bool hasBlocks = gioField(h, GIO_GLOBAL_HEADER_SIZE) > GIO_BLOCKS_SIZE and 
+                     gioField(h, GIO_BLOCKS_SIZE) > 0;
+    if(ranksSize < 40 or ranksStart + nRanks*ranksSize > header.size()){ return false; }
+
+    int fd = open(gio.fileNames[file].c_str(), O_RDONLY);
+    if(fd < 0){ return false; }
+    struct stat fileStat;
+    fstat(fd, &fileStat);
+    size_t mapSize = fileStat.st_size;
+    void *data = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){ return false; }
+    gio.maps[file] = (const char*)data;
+    gio.mapSizes[file] = mapSize;
+    
+    int numVars = gio.vars.size();
+    for(uint64_t i = 0; i < nRanks; ++i){
+        const char *rh = h + ranksStart + i*ranksSize;
+        uint64_t Np = gioField(rh, 24);
+        uint64_t offset = gioField(rh, 32);
+        uint64_t globalRank = (ranksSize >= 48) ? gioField(rh, 40) : i;
+
+        // the block holding this rank's data, as listed in the map file if partitioned
+        size_t b = i;
+        if(gio.blockRank.size() > 0){
+            b = find(gio.blockRank.begin(), gio.blockRank.end(), (int64_t)globalRank) - 
+                gio.blockRank.begin();
+        }
+        if(b >= gio.blockFile.size() or gio.blockFile[b] != file){ continue; }
+        
+        gio.blockNp[b] = Np;
+        for(int j = 0; j < numVars; ++j){
+            if(hasBlocks){
+                const char *bh = h + gioField(h, GIO_BLOCKS_START) + 
+                                 (i*numVars + j)*gioField(h, GIO_BLOCKS_SIZE);
+                if(bh + 48 > h + header.size() or bh[0] != 0){ return false; }  // compressed
+                offset = gioField(bh, 32);
+            }
+            if(offset + Np*gio.vars[j].size > mapSize){ return false; }
+            gio.blockVarOffset[b*numVars + j] = offset;
+            offset += Np*gio.vars[j].size + GIO_CRC_SIZE;
+        }
+    }
+    return true;
+}
+
+static void initMappedBlocks(Mapped_gio &gio){
+    // sizes the per-block and per-file tables of a Mapped_gio, once its variables, 
+    // data files, and the data file of each block are known
+
+    int numBlocks = gio.blockFile.size();
+    gio.blockNp.assign(numBlocks, 0);
+    gio.blockVarOffset.assign((size_t)numBlocks * gio.vars.size(), 0);
+    gio.maps.assign(gio.fileNames.size(), (const char*)NULL);
+    gio.mapSizes.assign(gio.fileNames.size(), 0);
+}
+
+
+//======================================================================================
+
+
+bool mapGIOFile(string fileName, Mapped_gio &gio){
+    // Opens a GenericIO file for reading directly from memory-mapped pages, as an 
+    // alternative to GenericIO::readData() for uncompressed files on a POSIX filesystem.
+    // The header (and, for files written in partitions, the map file relating blocks
+    // to the partition files fileName#<partition>) is parsed here, but no data file is
+    // mapped until one of its blocks is requested with mappedBlock(). Data is read 
+    // in place, without checking CRCs. Only little-endian files, with no compressed 
+    // blocks, are supported; for anything else, false is returned, and the caller 
+    // should fall back to GenericIO.
+    //
+    // Params:
+    // :param fileName: the GenericIO (header) file
+    // :param gio: the Mapped_gio to fill
+    // :return: true if the file can be read by mapping
+    
+    gio = Mapped_gio();
+    vector<char> header;
+    if(!readGIOHeader(fileName, header) or !readGIOVars(header, gio.vars)){ return false; }
+    int numEntries = gioField(&header[0], GIO_NRANKS);
+
+    // a partitioned file's header is a map, of one entry per block, from the 
+    // block to its writing rank and partition
+    int iRank = -1, iPartition = -1;
+    for(int j = 0; j < gio.vars.size(); ++j){
+        if(gio.vars[j].name == "$rank"){ iRank = j; }
+        if(gio.vars[j].name == "$partition"){ iPartition = j; }
+    }
+    
+    if(iRank < 0 or iPartition < 0){
+        gio.fileNames.push_back(fileName);
+        gio.blockFile.assign(numEntries, 0);
+    }
+    else{
+        // read the map itself, as an unpartitioned file
+        Mapped_gio map;
+        map.vars = gio.vars;
+        map.fileNames.push_back(fileName);
+        map.blockFile.assign(numEntries, 0);
+        initMappedBlocks(map);
+        
+        vector<int64_t> partitions;
+        for(int e = 0; e < numEntries; ++e){
+            const char *ranks = mappedBlock(map, e, iRank);
+            const char *parts = mappedBlock(map, e, iPartition);
+            if(ranks == NULL or parts == NULL){ 
+                unmapGIOFile(map);
+                return false; 
+            }
+            for(size_t n = 0; n < map.blockNp[e]; ++n){
+                gio.blockRank.push_back((int64_t)columnValue(map.vars[iRank], 
+                                                             ranks + n*map.vars[iRank].size));
+                partitions.push_back((int64_t)columnValue(map.vars[iPartition], 
+                                                          parts + n*map.vars[iPartition].size));
+            }
+        }
+        unmapGIOFile(map);
+        if(partitions.size() == 0){ return false; }
+
+        // the variables are those of the partitions
+        vector<char> partHeader;
+        ostringstream partName;
+        partName << fileName << "#" << partitions[0];
+        if(!readGIOHeader(partName.str(), partHeader) or !readGIOVars(partHeader, gio.vars)){ 
+            return false; 
+        }
+        
+        // one data file per distinct partition
+        vector<int64_t> fileParts;
+        for(int b = 0; b < partitions.size(); ++b){
+            int f = find(fileParts.begin(), fileParts.end(), partitions[b]) - fileParts.begin();
+            if(f == fileParts.size()){
+                fileParts.push_back(partitions[b]);
+                ostringstream name;
+                name << fileName << "#" << partitions[b];
+                gio.fileNames.push_back(name.str());
+            }
+            gio.blockFile.push_back(f);
+        }
+    }
+    
+    initMappedBlocks(gio);
+    gio.ok = true;
+    return true;
+}
+
+
+//======================================================================================
+
+
+const char *mappedBlock(Mapped_gio &gio, int block, int var){
+    // Returns a pointer to the data of one variable of one block of a file opened 
+    // by mapGIOFile(), mapping the data file holding that block if needed. The 
+    // number of elements is then in gio.blockNp[block]. Returns NULL if the data file 
+    // can't be mapped, or is not supported (after which gio.ok is false)
+    //
+    // Params:
+    // :param gio: the Mapped_gio
+    // :param block: the block index, as in GenericIO::readNumElems(block)
+    // :param var: the variable index, into gio.vars
+    // :return: pointer to the block's data for the variable, valid until unmapGIOFile()
+
+    int file = gio.blockFile[block];
+    if(gio.maps[file] == NULL and !mapGIOPartition(gio, file)){
+        gio.ok = false;
+        return NULL;
+    }
+    return gio.maps[file] + gio.blockVarOffset[(size_t)block*gio.vars.size() + var];
+}
+
+
+//======================================================================================
+
+
+void unmapGIOFile(Mapped_gio &gio){
+    // Unmaps all data files mapped for a Mapped_gio
+    
+    for(int f = 0; f < gio.maps.size(); ++f){
+        if(gio.maps[f] != NULL){ munmap(const_cast<char*>(gio.maps[f]), gio.mapSizes[f]); }
+        gio.maps[f] = NULL;
+    }
+}
+
+
+//======================================================================================
+
+
 //////////////////////////////////////////////////////
 //
 //                cosmo functions
@@ -890,3 +1990,532 @@ void rotation_matrix(const vector<vector<float> > &K, const float B, vector<vect
     R.push_back( vector<float>(Rarr[1], Rarr[1]+3) );
     R.push_back( vector<float>(Rarr[2], Rarr[2]+3) );  
 }
+
+
+//======================================================================================
+
+
+void haloRotation(const float *pos, float *R){
+    
+    // Computes the rotation matrix which moves the position pos to (|pos|, 0, 0), 
+    // i.e. onto the equator at (r, 90, 0) in spherical coords. This gives the same 
+    // result as normCross(), vecPairAngle(), cross_prod_matrix(), and rotation_matrix() 
+    // in sequence, with scalar arithmetic and no temporary vectors, for use over
+    // many halos
+    //
+    // Params:
+    // :param pos: the three-dimensional position
+    // :param R: array of 9 floats to hold the rotation matrix, row major
+    // :return: None
+
+    // the axis of rotation is k = (pos x [r, 0, 0]) / |pos x [r, 0, 0]|, which is
+    // parallel to [0, pos_z, -pos_y], and the angle between them is acos(pos_x / r)
+    double r = sqrt((double)pos[0]*pos[0] + (double)pos[1]*pos[1] + (double)pos[2]*pos[2]);
+    double mag_k = sqrt((double)pos[1]*pos[1] + (double)pos[2]*pos[2]);
+    double k[3] = {0, 0, 0};
+    if(mag_k > 0){
+        k[1] = pos[2] / mag_k;
+        k[2] = -pos[1] / mag_k;
+    }
+    double B = acos(pos[0] / r);
+    
+    // R = I + sin(B)K + (1-cos(B))K^2, where K is the cross-product matrix of k
+    double K[3][3] = {
+        { 0.0, -k[2], k[1]},
+        { k[2], 0.0, -k[0]},
+        {-k[1], k[0], 0.0 }
+    };
+    for(int i = 0; i < 3; ++i){
+        for(int j = 0; j < 3; ++j){
+            double K2 = K[i][0]*K[0][j] + K[i][1]*K[1][j] + K[i][2]*K[2][j];
+            R[3*i+j] = (i == j) + sin(B)*K[i][j] + (1-cos(B))*K2;
+        }
+    }
+}
+
+
+//======================================================================================
+
+
+//////////////////////////////////////////////////////
+//
+//              footprint functions
+//
+//////////////////////////////////////////////////////
+
+
+static int findRoot(vector<int> &parent, int h){
+    // Returns the representative of the set containing h in a disjoint-set 
+    // forest, halving the path along the way
+
+    while(parent[h] != h){
+        parent[h] = parent[parent[h]];
+        h = parent[h];
+    }
+    return h;
+}
+
+
+//======================================================================================
+
+
+int groupOverlappingFootprints(const vector<float> &theta_bounds, 
+                               const vector<float> &phi_bounds,
+                               int maxGroupSize, vector<int> &groupOf){
+    // Groups halos whose rough angular footprints (as computed in processLC.cpp) 
+    // overlap, directly or through a chain of other halos, so that their cutouts
+    // can share one particle store. Halos are swept in order of their lower theta 
+    // bound, so only pairs which overlap in theta are compared. A merge which 
+    // would make a group larger than maxGroupSize is skipped, in which case those
+    // halos are simply cut out separately.
+    //
+    // Params:
+    // :param theta_bounds: the rough [min, max] theta bounds, in arcsec, two per halo
+    // :param phi_bounds: the rough [min, max] phi bounds, in arcsec, two per halo
+    // :param maxGroupSize: the largest number of halos allowed in one group
+    // :param groupOf: vector to fill with the group index of each halo, from 0 
+    //                 to the number of groups - 1
+    // :return: the number of groups (including groups of one halo)
+
+    int numHalos = theta_bounds.size()/2;
+    vector<int> parent(numHalos);
+    vector<int> size(numHalos, 1);
+    std::iota(parent.begin(), parent.end(), 0);
+
+    vector<int> order(numHalos);
+    std::iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), 
+         [&](int a, int b){return theta_bounds[2*a] < theta_bounds[2*b];} );
+
+    for(int i = 0; i < numHalos; ++i){
+        int a = order[i];
+        for(int j = i+1; j < numHalos and theta_bounds[2*order[j]] < theta_bounds[2*a+1]; ++j){
+            int b = order[j];
+            if(phi_bounds[2*b] >= phi_bounds[2*a+1] or phi_bounds[2*a] >= phi_bounds[2*b+1]){ 
+                continue; 
+            }
+            
+            int ra = findRoot(parent, a);
+            int rb = findRoot(parent, b);
+            if(ra == rb or size[ra] + size[rb] > maxGroupSize){ continue; }
+            if(size[ra] < size[rb]){ swap(ra, rb); }
+            parent[rb] = ra;
+            size[ra] += size[rb];
+        }
+    }
+
+    // number the groups densely
+    int numGroups = 0;
+    vector<int> rootGroup(numHalos, -1);
+    groupOf.resize(numHalos);
+    for(int h = 0; h < numHalos; ++h){
+        int r = findRoot(parent, h);
+        if(rootGroup[r] < 0){ rootGroup[r] = numGroups++; }
+        groupOf[h] = rootGroup[r];
+    }
+    return numGroups;
+}
+
+
+//======================================================================================
+
+
+void buildFootprintMask(const vector<float> &theta_bounds, const vector<float> &phi_bounds,
+                        Footprint_mask &mask){
+    // Builds a coarse mask of the union of many rectangular (theta, phi) footprints, 
+    // such as the rough cutout bounds of all target halos, on a grid of 
+    // FOOTPRINT_CELL arcsec cells over theta in [0, 180] deg and (atan-folded) phi 
+    // in [-90, 90] deg. Every cell touching any footprint is set, so that the mask
+    // is conservative: a particle outside of it is outside every footprint, and can
+    // be dropped right after reading. The footprint bounds are given as flat arrays, 
+    // with [min, max] for each footprint, in arcsec
+    //
+    // Params:
+    // :param theta_bounds: the [min, max] theta bounds of each footprint (2 per footprint)
+    // :param phi_bounds: the [min, max] phi bounds of each footprint (2 per footprint)
+    // :param mask: the mask to fill
+    // :return: none
+
+    mask.cellSize = FOOTPRINT_CELL;
+    mask.nTheta = (int)ceil(180.0 * 3600.0 / mask.cellSize);
+    mask.nPhi = (int)ceil(180.0 * 3600.0 / mask.cellSize);
+    mask.cells.assign((size_t)mask.nTheta * mask.nPhi, 0);
+
+    int numFootprints = theta_bounds.size() / 2;
+    for(int f = 0; f < numFootprints; ++f){
+        int t0 = max(0, (int)floor(theta_bounds[2*f] / mask.cellSize));
+        int t1 = min(mask.nTheta-1, (int)floor(theta_bounds[2*f+1] / mask.cellSize));
+        int p0 = max(0, (int)floor(phi_bounds[2*f] / mask.cellSize) + mask.nPhi/2);
+        int p1 = min(mask.nPhi-1, (int)floor(phi_bounds[2*f+1] / mask.cellSize) + mask.nPhi/2);
+        for(int t = t0; t <= t1; ++t){
+            for(int p = p0; p <= p1; ++p){ mask.cells[(size_t)t*mask.nPhi + p] = 1; }
+        }
+    }
+}
+
+
+//======================================================================================
+
+
+bool footprintContains(const Footprint_mask &mask, float theta, float phi){
+    // Checks whether a point, in arcsec, lies in a cell of a footprint mask built by 
+    // buildFootprintMask()
+    
+    int t = (int)floor(theta / mask.cellSize);
+    int p = (int)floor(phi / mask.cellSize) + mask.nPhi/2;
+    if(t < 0 or t >= mask.nTheta or p < 0 or p >= mask.nPhi){ 
+        // only reachable at the exact upper edges of the domain
+        t = min(max(t, 0), mask.nTheta-1);
+        p = min(max(p, 0), mask.nPhi-1);
+    }
+    return mask.cells[(size_t)t*mask.nPhi + p];
+}
+
+
+//======================================================================================
+
+
+void buildOccupancyMask(const vector<particle_pos> &particles, Footprint_mask &mask){
+    // Builds a coarse mask of the sky actually covered by a set of particles, on a grid
+    // of OCCUPANCY_CELL arcsec cells laid out as in buildFootprintMask(), with every 
+    // cell holding at least one particle set. Reduced over ranks with MPI_BOR, this 
+    // gives the coverage of a lightcone step
+    //
+    // Params:
+    // :param particles: the particles, with theta and phi in arcsec
+    // :param mask: the mask to fill
+    // :return: none
+
+    mask.cellSize = OCCUPANCY_CELL;
+    mask.nTheta = (int)ceil(180.0 * 3600.0 / mask.cellSize);
+    mask.nPhi = (int)ceil(180.0 * 3600.0 / mask.cellSize);
+    mask.cells.assign((size_t)mask.nTheta * mask.nPhi, 0);
+
+    for(size_t n = 0; n < particles.size(); ++n){
+        int t = min(max((int)floor(particles[n].theta / mask.cellSize), 0), mask.nTheta-1);
+        int p = min(max((int)floor(particles[n].phi / mask.cellSize) + mask.nPhi/2, 0), mask.nPhi-1);
+        mask.cells[(size_t)t*mask.nPhi + p] = 1;
+    }
+}
+
+
+//======================================================================================
+
+
+bool footprintOverlaps(const Footprint_mask &mask, float theta_min, float theta_max, 
+                       float phi_min, float phi_max){
+    // Checks whether a rectangular (theta, phi) footprint, in arcsec, touches any set 
+    // cell of a mask built by buildFootprintMask() or buildOccupancyMask(). A false 
+    // return means that no point of the mask lies within the footprint
+
+    int t0 = max(0, (int)floor(theta_min / mask.cellSize));
+    int t1 = min(mask.nTheta-1, (int)floor(theta_max / mask.cellSize));
+    int p0 = max(0, (int)floor(phi_min / mask.cellSize) + mask.nPhi/2);
+    int p1 = min(mask.nPhi-1, (int)floor(phi_max / mask.cellSize) + mask.nPhi/2);
+    for(int t = t0; t <= t1; ++t){
+        for(int p = p0; p <= p1; ++p){ 
+            if(mask.cells[(size_t)t*mask.nPhi + p]){ return true; }
+        }
+    }
+    return false;
+}
+
+
+//======================================================================================
+
+
+//////////////////////////////////////////////////////
+//
+//                healpix functions
+//
+//////////////////////////////////////////////////////
+
+
+bool valid_nside(int nside){
+    // Checks that nside is usable for a nested HEALPix map (a positive
+    // power of 2 no larger than 2^29)
+    //
+    // Params:
+    // :param nside: the HEALPix resolution parameter
+    // :return: true if nside is valid, false otherwise
+
+    return nside > 0 and nside <= (1<<29) and (nside & (nside-1)) == 0;
+}
+
+
+//======================================================================================
+
+
+static int64_t spread_bits(int64_t v){
+    // Interleaves the lower 32 bits of v with zeros (bit i moves to bit 2i), 
+    // as needed to build nested pixel indices from face-local (ix, iy)
+    
+    v &= 0xFFFFFFFFLL;
+    v = (v | (v<<16)) & 0x0000FFFF0000FFFFLL;
+    v = (v | (v<< 8)) & 0x00FF00FF00FF00FFLL;
+    v = (v | (v<< 4)) & 0x0F0F0F0F0F0F0F0FLL;
+    v = (v | (v<< 2)) & 0x3333333333333333LL;
+    v = (v | (v<< 1)) & 0x5555555555555555LL;
+    return v;
+}
+
+
+//======================================================================================
+
+
+int64_t vec2pix_nest(int nside, double x, double y, double z){
+    // Returns the nested HEALPix pixel index containing the direction of the 
+    // (not necessarily normalized) vector [x, y, z]. This follows 
+    // ang2pix_nest_z_phi() from the HEALPix C library (Gorski et al. 2005), 
+    // with sin(theta) computed from x and y directly to retain precision 
+    // near the poles.
+    //
+    // Params:
+    // :param nside: the HEALPix resolution parameter (a power of 2)
+    // :param x: the x component of the direction vector
+    // :param y: the y component of the direction vector
+    // :param z: the z component of the direction vector
+    // :return: the nested pixel index, in [0, 12*nside^2)
+    
+    const double twothird = 2.0/3.0;
+    const double inv_halfpi = 2.0/M_PI;
+
+    double rxy = sqrt(x*x + y*y);
+    double r = sqrt(rxy*rxy + z*z);
+    double cth = z/r;
+    double sth = rxy/r;
+    double za = fabs(cth);
+    
+    // tt in [0, 4)
+    double phi = atan2(y, x);
+    if(phi < 0){ phi += 2*M_PI; }
+    double tt = phi * inv_halfpi;
+    if(tt >= 4.0){ tt = 0.0; }
+
+    int64_t ns = nside;
+    int face_num;
+    int64_t ix, iy;
+
+    if(za <= twothird){
+        // equatorial region
+        double temp1 = ns*(0.5+tt);
+        double temp2 = ns*(cth*0.75);
+        int64_t jp = (int64_t)(temp1-temp2);  // index of ascending edge line
+        int64_t jm = (int64_t)(temp1+temp2);  // index of descending edge line
+        int64_t ifp = jp/ns; 
+        int64_t ifm = jm/ns;
+        face_num = (ifp==ifm) ? (ifp|4) : ((ifp<ifm) ? ifp : (ifm+8));
+        ix = jm & (ns-1);
+        iy = ns - (jp & (ns-1)) - 1;
+    }
+    else{
+        // polar region
+        int ntt = (int)tt;
+        if(ntt >= 4){ ntt = 3; }
+        double tp = tt - ntt;
+        double tmp = ns * sth / sqrt((1.0+za)/3.0);
+        
+        int64_t jp = (int64_t)(tp*tmp);        // increasing edge line index
+        int64_t jm = (int64_t)((1.0-tp)*tmp);  // decreasing edge line index
+        if(jp >= ns){ jp = ns-1; }
+        if(jm >= ns){ jm = ns-1; }
+        
+        if(cth >= 0){
+            face_num = ntt; 
+            ix = ns - jm - 1; 
+            iy = ns - jp - 1;
+        }else{
+            face_num = ntt + 8;
+            ix = jp;
+            iy = jm;
+        }
+    }
+    return face_num*ns*ns + spread_bits(ix) + (spread_bits(iy)<<1);
+}
+
+
+//======================================================================================
+
+
+void accumulateCountMap(const vector<POSVEL_T> &x, const vector<POSVEL_T> &y,
+                        const vector<POSVEL_T> &z, size_t Np, int nside,
+                        vector<int64_t> &counts){
+    // Bins the first Np particles given by the position vectors x, y, z into a 
+    // full-sky nested HEALPix count map, as seen from the observer (origin).
+    // The OpenMP threads share the one map, incrementing its pixels atomically, so 
+    // that no thread needs a map of its own.
+    //
+    // Params:
+    // :param x: particle x positions
+    // :param y: particle y positions
+    // :param z: particle z positions
+    // :param Np: the number of particles to bin
+    // :param nside: the HEALPix resolution parameter (a power of 2)
+    // :param counts: vector to hold the resulting map, of length 12*nside^2
+    // :return: none
+
+    int64_t npix = 12 * (int64_t)nside * nside;
+    counts.assign(npix, 0);
+
+    #pragma omp parallel for schedule(static)
+    for(int64_t n = 0; n < (int64_t)Np; ++n){
+        // particles sitting on the observer have no direction
+        if(x[n] == 0 && y[n] == 0 && z[n] == 0){ continue; }
+        int64_t pix = vec2pix_nest(nside, x[n], y[n], z[n]);
+        #pragma omp atomic
+        counts[pix]++;
+    }
+}
+
+
+//======================================================================================
+
+
+void writeCountMap(string out_dir, int step, int nside, vector<int64_t> &counts, 
+                   int myrank){
+    // Sums the per-rank HEALPix count maps for a lightcone step to rank 0, which 
+    // writes the result to out_dir/countMap_nside{nside}.{step}.bin as a raw 
+    // array of 12*nside^2 int64 counts, in nested pixel ordering. Must be called 
+    // by all ranks. The map is reduced, and written, MAP_REDUCE_CHUNK pixels at a 
+    // time, so that rank 0 needs no second full map, and each reduction fits an int 
+    // count.
+    //
+    // Params:
+    // :param out_dir: the directory in which to write the map 
+    // :param step: the lightcone step from which the map was built
+    // :param nside: the HEALPix resolution parameter of the map
+    // :param counts: this rank's count map
+    // :param myrank: this rank's identifier
+    // :return: none
+
+    int64_t npix = counts.size();
+    vector<int64_t> map_counts;
+    if(myrank == 0){ map_counts.resize(min(npix, (int64_t)MAP_REDUCE_CHUNK)); }
+    
+    ostringstream map_file_name;
+    map_file_name << out_dir << "countMap_nside" << nside << "." << step << ".bin";
+    ofstream map_file;
+    if(myrank == 0){ map_file.open(map_file_name.str().c_str(), ios::out | ios::binary); }
+    
+    int64_t total = 0;
+    for(int64_t p0 = 0; p0 < npix; p0 += MAP_REDUCE_CHUNK){
+        int chunk = (int)min(npix - p0, (int64_t)MAP_REDUCE_CHUNK);
+        MPI_Reduce(&counts[p0], map_counts.data(), chunk, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        
+        if(myrank == 0){
+            map_file.write((char*)&map_counts[0], chunk*sizeof(int64_t));
+            total = accumulate(map_counts.begin(), map_counts.begin() + chunk, total);
+        }
+    }
+
+    if(myrank == 0){
+        map_file.close();
+        cout << "Wrote " << total << " particles to HEALPix map " << map_file_name.str() << endl;
+    }
+}
+
+
+//======================================================================================
+
+
+void footprintTiles(const Footprint_mask &mask, int nside, vector<int64_t> &tiles){
+    // Finds the nested HEALPix pixels (the tiles of a lightcone store, see buildLCStore()
+    // in processLC.cpp) which may hold particles inside a footprint mask. The mask is 
+    // first grown by twice the pixel size, which is more than the diameter of any pixel,
+    // so that every pixel touching the mask lies entirely within the grown mask. Each 
+    // grown cell is then sampled on a grid finer than a quarter pixel, in both of the 
+    // directions that its atan-folded phi stands for (x > 0 and x < 0), so that every 
+    // such pixel contains at least one sample.
+    //
+    // Params:
+    // :param mask: the footprint mask, as built by buildFootprintMask()
+    // :param nside: the HEALPix resolution parameter of the tiles
+    // :param tiles: to be filled with the needed pixel indices, in ascending order
+    // :return: none
+
+    int nTheta = mask.nTheta;
+    int nPhi = mask.nPhi;
+    double cell = mask.cellSize / 3600.0 * M_PI/180.0;
+    double pixSize = sqrt(4*M_PI / (12.0*nside*nside));
+    int growTheta = (int)ceil(2*pixSize / cell);
+
+    // grow along phi, by more cells toward the poles. Folded phi wraps around at 
+    // +-90 deg, where the two hemispheres x > 0 and x < 0 meet
+    vector<uint8_t> grownPhi((size_t)nTheta * nPhi, 0);
+    for(int t = 0; t < nTheta; ++t){
+        double minSin = min(sin(max(0, t-growTheta) * cell), 
+                            sin(min(nTheta, t+growTheta+1) * cell));
+        bool wholeRow = (minSin*cell*nPhi/2 < 2*pixSize);
+        int growPhi = wholeRow ? 0 : (int)ceil(2*pixSize / (cell*minSin));
+        
+        vector<int> diff(nPhi+1, 0);
+        for(int p = 0; p < nPhi; ++p){
+            if(!mask.cells[(size_t)t*nPhi + p]){ continue; }
+            int p0 = p - growPhi;
+            int p1 = p + growPhi + 1;
+            if(wholeRow or p1 - p0 >= nPhi){
+                diff[0]++;
+                diff[nPhi]--;
+            }else if(p0 < 0){
+                diff[p0 + nPhi]++;
+                diff[nPhi]--;
+                diff[0]++;
+                diff[p1]--;
+            }else if(p1 > nPhi){
+                diff[p0]++;
+                diff[nPhi]--;
+                diff[0]++;
+                diff[p1 - nPhi]--;
+            }else{
+                diff[p0]++;
+                diff[p1]--;
+            }
+        }
+        int run = 0;
+        for(int p = 0; p < nPhi; ++p){
+            run += diff[p];
+            grownPhi[(size_t)t*nPhi + p] = (run > 0);
+        }
+    }
+
+    // then along theta
+    vector<uint8_t> grown((size_t)nTheta * nPhi, 0);
+    for(int p = 0; p < nPhi; ++p){
+        vector<int> diff(nTheta+1, 0);
+        for(int t = 0; t < nTheta; ++t){
+            if(!grownPhi[(size_t)t*nPhi + p]){ continue; }
+            diff[max(0, t-growTheta)]++;
+            diff[min(nTheta, t+growTheta+1)]--;
+        }
+        int run = 0;
+        for(int t = 0; t < nTheta; ++t){
+            run += diff[t];
+            grown[(size_t)t*nPhi + p] = (run > 0);
+        }
+    }
+
+    // sample the grown cells
+    int numSub = (int)ceil(cell / (pixSize/4));
+    vector<uint8_t> needed(12*(int64_t)nside*nside, 0);
+    for(int t = 0; t < nTheta; ++t){
+        for(int p = 0; p < nPhi; ++p){
+            if(!grown[(size_t)t*nPhi + p]){ continue; }
+            for(int i = 0; i < numSub; ++i){
+                double theta = (t + (i+0.5)/numSub) * cell;
+                for(int j = 0; j < numSub; ++j){
+                    double phi = (p - nPhi/2 + (j+0.5)/numSub) * cell;
+                    double x = sin(theta)*cos(phi);
+                    double y = sin(theta)*sin(phi);
+                    double z = cos(theta);
+                    needed[vec2pix_nest(nside, x, y, z)] = 1;
+                    needed[vec2pix_nest(nside, -x, -y, z)] = 1;
+                }
+            }
+        }
+    }
+    
+    tiles.clear();
+    for(int64_t pix = 0; pix < needed.size(); ++pix){
+        if(needed[pix]){ tiles.push_back(pix); }
+    }
+}
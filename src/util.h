@@ -18,6 +18,9 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <vector>
 #include <omp.h>
 #include <mpi.h>
@@ -37,15 +40,13 @@ struct Buffers_read {
     vector<POSVEL_T> y;
     vector<POSVEL_T> z;
     vector<POSVEL_T> d;
-    vector<POSVEL_T> vx;
-    vector<POSVEL_T> vy;
-    vector<POSVEL_T> vz;
     vector<POSVEL_T> a;
     vector<ID_T> id;
-    vector<int> rotation;
-    vector<int32_t> replication;
     vector<float> theta;
     vector<float> phi;
+
+    // raw buffers for the non-core columns, in the order of Column_schema::extra
+    vector<vector<char> > extra;
 };
 
 struct Buffers_write {
@@ -54,21 +55,33 @@ struct Buffers_write {
     vector<POSVEL_T> x;
     vector<POSVEL_T> y;
     vector<POSVEL_T> z;
-    vector<POSVEL_T> vx;
-    vector<POSVEL_T> vy;
-    vector<POSVEL_T> vz;
     vector<POSVEL_T> redshift;
     vector<ID_T> id;
-    vector<int> rotation;
-    vector<int32_t> replication;
     vector<float> theta;
     vector<float> phi;
+
+    // Buffers for derived columns, in the order requested in Cutout_options
+    vector<vector<float> > derived;
+    
+    // raw buffers for the exchanged non-core columns, in the order of 
+    // Column_schema::extra (entries for unexchanged columns stay empty)
+    vector<vector<char> > extra;
     
     // Buffers to fill with MPI file writing offset values
     vector<int> np_count; // length of output data vecotrs for each rank
     vector<int> np_offset; // cumulative sum of np_count
 };
 
+struct Halo_selection {
+
+    // the particles found in one halo's cutout by the cutout kernel in processLC.cpp,
+    // with their positions in the halo's rotated frame, if needed for output
+    vector<int> n;                // positions of the particles in the search buffer
+    vector<float> v_rot;          // rotated cartesian position (3 per particle)
+    vector<float> v_theta;        // rotated spherical angles, in arcsec
+    vector<float> v_phi;
+};
+
 struct particle_pos {
 
     // struct for containing individual "primary" particle quantities
@@ -82,17 +95,275 @@ struct particle_pos {
     POSVEL_T a;
     ID_T id;
     int myrank;
+    
+    // line-of-sight velocity (v·x)/d, if velocities were read. This fits in 
+    // what would otherwise be struct padding, so costs nothing to exchange
+    POSVEL_T v_los;
 };
 
-struct particle_vel {
+enum Core_col {
+
+    // columns always carried in particle_pos, each of which may or may not
+    // be selected for output
+    CORE_ID,
+    CORE_X,
+    CORE_Y,
+    CORE_Z,
+    CORE_REDSHIFT,
+    CORE_THETA,
+    CORE_PHI,
+    NUM_CORE
+};
 
-    // struct for containing individual "secondary" particle quantities
-    POSVEL_T vx;
-    POSVEL_T vy;
-    POSVEL_T vz;
-    int rotation;
-    int32_t replication;
-    int myrank;
+struct Column_info {
+
+    // a non-core input column (e.g. vx, rotation, or any galaxy property),
+    // with its type as given by the GenericIO header
+    string name;
+    int size;        // bytes per element
+    bool isFloat;
+    bool isSigned;
+    bool exchange;   // if false, the column is only read for use on the reading rank 
+                     // (e.g. vx for v_los), and is not redistributed or written
+    int rowOffset;   // byte offset of the column within an exchanged row
+};
+
+struct Column_schema {
+
+    // the columns to be read, exchanged, and written in a run. Built by 
+    // selectColumns() from the --columns list, and completed per step from 
+    // the GenericIO header in processLC.cpp
+    bool writeCore[NUM_CORE];
+    vector<Column_info> extra;
+    int rowSize;     // bytes per particle of all exchanged extra columns
+};
+
+struct Halo_geometry {
+
+    // per-halo cutout geometry for the halo overload of processLC(), as flat tables
+    // indexed by halo, built by computeHaloGeometry() in processLC.cpp. All angles
+    // in arcsec
+    float theta_cut[2];          // constant (equatorial) bounds, the same for all halos
+    float phi_cut[2];
+    vector<float> R;             // rotation matrix per halo, row major (9 per halo)
+    vector<float> theta_rough;   // rough [min, max] bounds per halo (2 per halo)
+    vector<float> phi_rough;
+    vector<float> halo_r;        // distance to the halo
+};
+
+struct Id_filter {
+
+    // a set of particle ids to restrict cutouts to, as read by readIdFile(). 
+    // Membership is first tested against the Bloom filter, and only confirmed
+    // by binary search in the exact sorted set for Bloom hits
+    vector<uint64_t> bloom;   // Bloom filter bits, a power-of-2 number of them
+    int numHashes;
+    vector<ID_T> ids;         // sorted, unique
+};
+
+struct Footprint_mask {
+
+    // a coarse (theta, phi) occupancy grid of the union of all cutout footprints in a 
+    // run, as built by buildFootprintMask(), used to drop particles which can't be in
+    // any cutout right after reading. Also used for the sky coverage of a step, as 
+    // built by buildOccupancyMask(), to skip halos which can't hold any particles
+    float cellSize;               // arcsec
+    int nTheta;                   // theta in [0, 180] deg
+    int nPhi;                     // phi in [-90, 90] deg
+    vector<uint8_t> cells;        // theta major
+};
+
+struct Theta_index {
+
+    // a compact search index over the theta keys of theta-sorted particles, as built by
+    // buildThetaIndex(), in Eytzinger (breadth-first) order, so that the first levels
+    // of every search share cache lines, and later levels can be prefetched
+    vector<float> keys;           // 1-based; keys[k] has children at 2k and 2k+1
+    vector<int> pos;              // position of keys[k] in the sorted particles
+};
+
+struct Cell_index {
+
+    // a 3D index of particles on a grid of cubic cells, as built by buildCellIndex(), 
+    // for comoving volume cutouts. Cell keys pack the (offset) integer cell coordinates 
+    // in 21 bits each, z lowest, so that a run of cells along z is a run of keys
+    float cellSize;               // at least the particles' max extent / 2^20
+    vector<uint64_t> keys;        // cell key of each particle, ascending
+    vector<int> order;            // position of each particle, in the order of keys
+};
+
+struct Mapped_gio {
+
+    // a GenericIO file opened for reading from memory-mapped pages by mapGIOFile().
+    // Data files are mapped on first use by mappedBlock()
+    vector<Column_info> vars;          // variables, in file order
+    vector<string> fileNames;          // data files (the file itself, or its partitions)
+    vector<const char*> maps;          // mapped data files, NULL until needed
+    vector<size_t> mapSizes;
+    vector<int> blockFile;             // data file holding each block
+    vector<int64_t> blockRank;         // writing rank of each block, if partitioned
+    vector<uint64_t> blockNp;          // elements per block, once its data file is mapped
+    vector<uint64_t> blockVarOffset;   // byte offset of each variable of each block
+    bool ok = false;
+};
+
+struct Step_manifest {
+
+    // the lightcone steps of a run, with their GenericIO header files and sizes, 
+    // as built once by buildStepManifest() in processLC.cpp (and possibly cached on
+    // disk). All vectors are indexed by step, in the order of steps
+    string subdirPrefix;          // the step subdirectory name, less the step number
+    vector<string> steps;         // step numbers, as strings, ascending
+    vector<string> headers;       // full path to each step's header file
+    vector<int> numBlocks;        // number of blocks (writing ranks) in each step
+    vector<int64_t> numElems;     // number of particles in each step
+    vector<int64_t> headerSize;   // header file size and modification time, to 
+    vector<int64_t> headerMtime;  // validate cached entries
+};
+
+struct Cutout_options {
+
+    // run options beyond the basic cutout specification, set from the command
+    // line in main.cpp and passed through to both processLC() overloads
+
+    // top-level output directory (for products that aren't per-halo)
+    string outDir;
+
+    // the steps to process, with their header files (see buildStepManifest())
+    Step_manifest manifest;
+
+    // if > 0, accumulate a full-sky nested HEALPix particle count map at
+    // this nside for each step read
+    int healpixNside = 0;
+
+    // derived columns to compute in the cutout kernel and write, as 
+    // Derived_col values (see derivedColumnIndex() in util.cpp)
+    vector<int> derivedCols;
+
+    // columns to write, other than derived columns. If empty, all core 
+    // columns are written, plus velocities, rotation, and replication 
+    // unless --posOnly was given
+    vector<string> columns;
+
+    // if true, halos with overlapping footprints are cut out together, with 
+    // each particle written once to a shared group store along with a bitmask 
+    // of the halos it belongs to
+    bool dedupOverlaps = false;
+
+    // if useIdFilter, only particles with ids in idFilter are redistributed 
+    // and written (see --idFile in main.cpp)
+    bool useIdFilter = false;
+    Id_filter idFilter;
+
+    // if propsCatalog, the properties and cutout geometry of all target halos are 
+    // written to one columnar catalog in outDir, rather than a properties.csv per 
+    // halo. The per-halo files are then only written if propsCSV is also set
+    bool propsCatalog = false;
+    bool propsCSV = false;
+
+    // if > 0, do a dry run, estimating the cost of the run from this fraction of 
+    // each step, without performing the cutout
+    float planFraction = 0;
+
+    // if either is > 0, only this many ranks per node, or in total, open and read the
+    // input, and forward it to the others in the redistribution (readersPerNode wins)
+    int readersPerNode = 0;
+    int totalReaders = 0;
+
+    // if true, read uncompressed POSIX GenericIO input from memory-mapped pages, 
+    // materializing only particles inside the cutout footprints (halo cutouts only)
+    bool mmapInput = false;
+
+    // if true, read GenericIO input one block at a time, keeping only particles inside
+    // the cutout footprints as each block is read (halo cutouts only)
+    bool streamInput = false;
+
+    // if > 0, after planning, partition the halos into this many halo files of 
+    // balanced estimated cost, rather than performing the cutout
+    int numShards = 0;
+
+    // if storeNside > 0, convert the lightcone into a sky-tiled store in outDir, with
+    // tiles of this HEALPix nside, rather than performing a cutout (see buildLCStore())
+    int storeNside = 0;
+
+    // if not empty, halo cutouts are served from the tiles of the store in this 
+    // directory which intersect the cutout footprints, rather than from the lightcone
+    string storeDir;
+
+    // if not empty, halo cutouts are cut from the output of an earlier cutout with 
+    // custom theta-phi bounds in this directory, rather than from the lightcone
+    string cutoutDir;
+
+    // if not empty, each rank's redistributed and sorted particles for each step of a 
+    // halo cutout are cached in this (node-local) directory, and reused by later runs
+    // over the same steps, with the same number of ranks and columns
+    string cacheDir;
+
+    // if > 1, make a quick-look preview of halo cutouts, reading only every 
+    // previewStride-th GenericIO block of each step
+    int previewStride = 0;
+
+    // if watchPoll > 0, halo cutouts are made of each step in [minStep, maxStep] as
+    // soon as the simulation has finished writing it, checking for new steps at least
+    // every watchPoll seconds, until maxStep is done or no new step appears for
+    // watchIdle seconds (see waitForSteps()). manifestFile is the manifest cache, if any
+    int watchPoll = 0;
+    int watchIdle = 0;
+    int minStep = 0;
+    int maxStep = 0;
+    string manifestFile;
+
+    // if volumeRadius > 0, halo cutouts are of all particles within this comoving 
+    // distance of each halo (a sphere), or, if volumeBox, within this distance along 
+    // each axis (a box), rather than within an angular field of view
+    float volumeRadius = 0;
+    bool volumeBox = false;
+
+    // if true, halos skipped in a step for lying outside of its sky coverage are 
+    // recorded in outDir/empty_halos.csv
+    bool markEmpty = false;
+};
+
+// max halos sharing one group store, as membership is a uint64_t bitmask
+#define MAX_GROUP_SIZE 64
+
+// cell size of a Footprint_mask, in arcsec
+#define FOOTPRINT_CELL 360.0
+
+// cell size of a per-step sky occupancy mask, in arcsec
+#define OCCUPANCY_CELL 3600.0
+
+// largest nside of a --healpix count map, of which each rank holds a full copy, and
+// the number of pixels reduced to rank 0 at a time
+#define MAX_MAP_NSIDE 8192
+#define MAP_REDUCE_CHUNK (1 << 24)
+
+// largest nside of a lightcone store (so that each rank's slice of the tile index 
+// fits an MPI count), and the nside of the coarse tiles over which it's balanced
+#define MAX_STORE_NSIDE 8192
+#define STORE_BALANCE_NSIDE 256
+
+enum Cutout_shape {
+
+    // the footprint of a halo cutout, for which the cutout kernel is specialized 
+    SHAPE_FIELD,     // an angular field of view (-b)
+    SHAPE_SPHERE,    // a comoving sphere (--sphere)
+    SHAPE_BOX,       // a comoving, axis-aligned cube (--box)
+    NUM_SHAPES
+};
+
+enum Derived_col {
+    
+    // columns that can be computed from the particle data and the target halo
+    // geometry in the cutout kernel, rather than written raw and computed later
+    DERIVED_V_LOS,   // line-of-sight velocity w.r.t. the observer
+    DERIVED_D,       // comoving distance from the observer
+    DERIVED_X_ROT,   // halo-centric cartesian position in the rotated frame, where 
+    DERIVED_Y_ROT,   // x_rot is along the line of sight to the halo
+    DERIVED_Z_ROT,   
+    DERIVED_X_TAN,   // gnomonic (tangent-plane) projection about the halo, in arcsec,
+    DERIVED_Y_TAN,   // along increasing rotated phi and decreasing rotated theta
+    NUM_DERIVED
 };
 
 
@@ -106,32 +377,70 @@ struct particle_vel {
 //////////////////////////////////////////////////////
 
 MPI_Datatype createParticles_pos();
-MPI_Datatype createParticles_vel();
-
-template<typename T>
-bool comp_rank(const T &a, const T &b){
-    // compare the myrank fields of two structs. Type T should be either a
-    // particle_pos or particle_vel
-    //
-    // Params:
-    // :param a: a particle struct, as defined in util.h
-    // :param b: a particle struct, as defined in util.h
-    // :return: a bool indicating whether or not the identifier of the rank
-    //          possessing a is smaller in value than the identifier of the
-    //          rank posessing b
-
-    return a.myrank < b.myrank;
-}
+MPI_Datatype createParticles_row(int rowSize);
 
 void comp_rank_scatter(size_t Np, vector<int> &idxRemap, int numranks);
 
+void exchangeSlots(const vector<int> &dest, int numranks, vector<int> &send_count, 
+                   vector<int> &send_offset, vector<int> &slots);
+
 bool comp_by_theta(const particle_pos &a, const particle_pos &b);
 
+void buildThetaIndex(const vector<particle_pos> &particles, Theta_index &index);
+
+int thetaLowerBound(const Theta_index &index, float theta);
+
+int thetaUpperBound(const Theta_index &index, float theta);
+
+void thetaRanges(const Theta_index &index, const vector<float> &theta_bounds, 
+                 vector<int> &ranges);
+
+void buildCellIndex(const vector<particle_pos> &particles, float cellSize, Cell_index &index);
+
+void queryCellIndex(const Cell_index &index, const float *center, float halfWidth, 
+                    vector<int> &found);
+
 bool does_file_exist(string filename);
 
+void splitCommaList(string list, vector<string> &items);
+
+int derivedColumnIndex(string name);
+
+string derivedColumnName(int col);
+
+int coreColumnIndex(string name);
+
+string coreColumnName(int col);
+
+void selectColumns(const vector<string> &columns, bool positionOnly, bool needVel,
+                   Column_schema &schema);
+
+int findColumn(const Column_schema &schema, string name);
+
+double columnValue(const Column_info &col, const char *data);
+
+void writeColumn(string file_name, void *data, int count, MPI_Datatype type, 
+                 MPI_Offset offset);
+
+void readIdFile(string idFileName, Id_filter &filter, int myrank);
+
+bool idFilterContains(const Id_filter &filter, ID_T id);
+
+size_t filterReadBuffers(Buffers_read &r, size_t Np, const Id_filter &filter);
+
+size_t filterReadBuffers(Buffers_read &r, size_t Np, const Footprint_mask &mask);
+
 void readHaloFile(string haloFileName, vector<float> &haloPos,
                   vector<string> &haloTags, vector<float> &haloProps,
-                  string massDef = "sod");
+                  string massDef = "sod", float minMass = 0);
+
+bool isGenericIOFile(string fileName);
+
+bool mapGIOFile(string fileName, Mapped_gio &gio);
+
+const char *mappedBlock(Mapped_gio &gio, int block, int var);
+
+void unmapGIOFile(Mapped_gio &gio);
 
 int getLCSubdirs(string dir, vector<string> &subdirs);
 
@@ -201,7 +510,50 @@ vector<vector<float> > invert_3x3(const vector<vector<float> > &m);
 void cross_prod_matrix(const vector<float> &k, 
                        vector<vector<float> > &K);
 
-void rotation_matrix(const vector<vector<float> > &K, const float B, 
+void rotation_matrix(const vector<vector<float> > &K, const float B,
                      vector<vector<float> > &R);
 
+void haloRotation(const float *pos, float *R);
+
+
+//////////////////////////////////////////////////////
+//
+//              footprint functions
+//
+//////////////////////////////////////////////////////
+
+int groupOverlappingFootprints(const vector<float> &theta_bounds, 
+                               const vector<float> &phi_bounds,
+                               int maxGroupSize, vector<int> &groupOf);
+
+void buildFootprintMask(const vector<float> &theta_bounds, const vector<float> &phi_bounds,
+                        Footprint_mask &mask);
+
+bool footprintContains(const Footprint_mask &mask, float theta, float phi);
+
+void buildOccupancyMask(const vector<particle_pos> &particles, Footprint_mask &mask);
+
+bool footprintOverlaps(const Footprint_mask &mask, float theta_min, float theta_max, 
+                       float phi_min, float phi_max);
+
+
+//////////////////////////////////////////////////////
+//
+//               healpix functions
+//
+//////////////////////////////////////////////////////
+
+bool valid_nside(int nside);
+
+int64_t vec2pix_nest(int nside, double x, double y, double z);
+
+void accumulateCountMap(const vector<POSVEL_T> &x, const vector<POSVEL_T> &y,
+                        const vector<POSVEL_T> &z, size_t Np, int nside,
+                        vector<int64_t> &counts);
+
+void writeCountMap(string out_dir, int step, int nside, vector<int64_t> &counts,
+                   int myrank);
+
+void footprintTiles(const Footprint_mask &mask, int nside, vector<int64_t> &tiles);
+
 #endif